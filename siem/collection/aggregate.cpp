@@ -0,0 +1,336 @@
+#include "aggregate.h"
+#include "collection.h"
+#include "filter.h"
+#include "sorter.h"
+#include "secondary_index.h"
+#include <stdexcept>
+
+using namespace std;
+using json = nlohmann::json;
+
+static string field_reference(const json& operand, const string& where){
+    if(!operand.is_string() || operand.get<string>().size() < 2 || operand.get<string>()[0] != '$'){
+        throw runtime_error(where + ": ожидается ссылка на поле вида \"$поле\"");
+    }
+    return operand.get<string>().substr(1);
+}
+
+static AccumulatorOp parse_accumulator(const string& op){
+    if(op == "$count") return AccumulatorOp::Count;
+    if(op == "$sum") return AccumulatorOp::Sum;
+    if(op == "$min") return AccumulatorOp::Min;
+    if(op == "$max") return AccumulatorOp::Max;
+    if(op == "$avg") return AccumulatorOp::Avg;
+    if(op == "$approx_distinct") return AccumulatorOp::ApproxDistinct;
+    throw runtime_error("неизвестный накопитель $group: " + op);
+}
+
+Grouper::Grouper(const json& spec) : id_object(false){
+    if(!spec.is_object() || !spec.contains("_id")){
+        throw runtime_error("$group требует объект с полем _id");
+    }
+
+    const json& id = spec["_id"];
+    if(id.is_object()){
+        id_object = true;
+        for(auto it = id.begin(); it != id.end(); ++it){
+            id_names.push_back(it.key());
+            id_fields.push_back(field_reference(it.value(), "$group._id." + it.key()));
+        }
+    }else if(!id.is_null()){
+        id_fields.push_back(field_reference(id, "$group._id"));
+    }
+
+    for(auto it = spec.begin(); it != spec.end(); ++it){
+        if(it.key() == "_id") continue;
+        if(!it.value().is_object() || it.value().size() != 1){
+            throw runtime_error("$group." + it.key() + ": ожидается {\"$накопитель\": операнд}");
+        }
+        Accumulator acc;
+        acc.name = it.key();
+        acc.op = parse_accumulator(it.value().begin().key());
+        const json& operand = it.value().begin().value();
+
+        if(acc.op == AccumulatorOp::Sum && operand.is_number()){
+            acc.value = operand;
+        }else if(acc.op != AccumulatorOp::Count){
+            acc.field = field_reference(operand, "$group." + it.key());
+        }
+        accumulators.push_back(acc);
+    }
+}
+
+void Grouper::collect_fields(Vector<string>& fields) const{
+    for(unsigned int i = 0; i < id_fields.get_size(); i++) fields.push_back(id_fields[i]);
+    for(unsigned int i = 0; i < accumulators.get_size(); i++){
+        if(!accumulators[i].field.empty()) fields.push_back(accumulators[i].field);
+    }
+}
+
+bool Grouper::sketch_only(Vector<string>& names, Vector<string>& fields) const{
+    if(!id_fields.empty() || accumulators.empty()) return false;
+    for(unsigned int a = 0; a < accumulators.get_size(); a++){
+        if(accumulators[a].op != AccumulatorOp::ApproxDistinct) return false;
+    }
+    for(unsigned int a = 0; a < accumulators.get_size(); a++){
+        names.push_back(accumulators[a].name);
+        fields.push_back(accumulators[a].field);
+    }
+    return true;
+}
+
+GroupState Grouper::new_group(const json& id) const{
+    GroupState state;
+    state.id = id;
+    for(unsigned int a = 0; a < accumulators.get_size(); a++){
+        state.values.push_back(json());
+        state.sketches.push_back(HyperLogLog());
+        state.int_sums.push_back(0);
+        state.sums.push_back(0);
+        state.counts.push_back(0);
+        state.integral.push_back(true);
+    }
+    return state;
+}
+
+void Grouper::add(const json& document){
+    // Ключ группы: значения полей _id в виде SecondaryIndex::make_key (5 и 5.0 совпадают)
+    string key;
+    json id = id_object ? json::object() : json();
+    for(unsigned int i = 0; i < id_fields.get_size(); i++){
+        auto it = document.find(id_fields[i]);
+        json value = it != document.end() ? *it : json();
+        key += SecondaryIndex::make_key(value);
+        key.push_back('\x1f');
+        if(id_object) id[id_names[i]] = value;
+        else id = value;
+    }
+
+    unsigned int g = 0;
+    if(!index.try_get(key, g)){
+        g = groups.get_size();
+        index.insert(key, g);
+        groups.push_back(new_group(id));
+    }
+
+    GroupState& state = groups[g];
+    for(unsigned int a = 0; a < accumulators.get_size(); a++){
+        const Accumulator& acc = accumulators[a];
+        if(acc.op == AccumulatorOp::Count){
+            state.counts[a]++;
+            continue;
+        }
+
+        const json* value = &acc.value;
+        if(!acc.field.empty()){
+            auto it = document.find(acc.field);
+            if(it == document.end() || it->is_null()) continue;
+            value = &*it;
+        }
+
+        if(acc.op == AccumulatorOp::ApproxDistinct){
+            state.sketches[a].add(*value);
+            continue;
+        }
+
+        if(acc.op == AccumulatorOp::Min || acc.op == AccumulatorOp::Max){
+            if(state.counts[a] == 0 ||
+               (acc.op == AccumulatorOp::Min ? *value < state.values[a] : state.values[a] < *value)){
+                state.values[a] = *value;
+            }
+            state.counts[a]++;
+            continue;
+        }
+
+        if(!value->is_number()) continue;
+        if(value->is_number_integer()){
+            state.int_sums[a] += value->get<long long>();
+        }else{
+            state.integral[a] = false;
+        }
+        state.sums[a] += value->get<double>();
+        state.counts[a]++;
+    }
+}
+
+void Grouper::finish(Vector<json>& out) const{
+    GroupState empty;
+    if(groups.empty() && id_fields.empty()) empty = new_group(json());
+
+    unsigned int total = groups.empty() && id_fields.empty() ? 1 : groups.get_size();
+    for(unsigned int g = 0; g < total; g++){
+        const GroupState& state = groups.empty() ? empty : groups[g];
+        json row = json::object();
+        row["_id"] = state.id;
+        for(unsigned int a = 0; a < accumulators.get_size(); a++){
+            const Accumulator& acc = accumulators[a];
+            switch(acc.op){
+                case AccumulatorOp::Count:
+                    row[acc.name] = state.counts[a];
+                    break;
+                case AccumulatorOp::Sum:
+                    if(state.integral[a]) row[acc.name] = state.int_sums[a];
+                    else row[acc.name] = state.sums[a];
+                    break;
+                case AccumulatorOp::Min:
+                case AccumulatorOp::Max:
+                    row[acc.name] = state.values[a];
+                    break;
+                case AccumulatorOp::Avg:
+                    if(state.counts[a] == 0) row[acc.name] = nullptr;
+                    else row[acc.name] = state.sums[a] / (double)state.counts[a];
+                    break;
+                case AccumulatorOp::ApproxDistinct:
+                    row[acc.name] = state.sketches[a].estimate();
+                    break;
+            }
+        }
+        out.push_back(row);
+    }
+}
+
+static const string& stage_name(const json& stage){
+    if(!stage.is_object() || stage.size() != 1){
+        throw runtime_error("стадия aggregate должна быть объектом с одним ключом");
+    }
+    return stage.begin().key();
+}
+
+static void check_sort(const json& rules){
+    if(!rules.is_object() || rules.empty()){
+        throw runtime_error("$sort требует непустой объект {\"поле\": 1 | -1}");
+    }
+    for(auto it = rules.begin(); it != rules.end(); ++it){
+        if(it.value() != 1 && it.value() != -1){
+            throw runtime_error("направление сортировки поля " + it.key() + " должно быть 1 или -1");
+        }
+    }
+}
+
+static unsigned int limit_value(const json& value){
+    if(!value.is_number_integer() || value.get<long long>() <= 0){
+        throw runtime_error("$limit требует положительное целое");
+    }
+    return value.get<unsigned int>();
+}
+
+Aggregation::Aggregation(const json& pipeline) : pipeline(pipeline){
+    if(!pipeline.is_array()){
+        throw runtime_error("pipeline должен быть массивом стадий");
+    }
+    for(const auto& stage : pipeline){
+        const string& name = stage_name(stage);
+        const json& arg = stage.begin().value();
+        if(name == "$match") Filter check(arg);
+        else if(name == "$group") Grouper check(arg);
+        else if(name == "$sort") check_sort(arg);
+        else if(name == "$limit") limit_value(arg);
+        else throw runtime_error("неизвестная стадия aggregate: " + name);
+    }
+}
+
+// Стадия над готовыми строками; skip - сколько следующих стадий она поглотила
+void Aggregation::apply_stage(const json& stage, const json* next, Vector<json>& rows, unsigned int& skip){
+    const string& name = stage.begin().key();
+    const json& arg = stage.begin().value();
+    skip = 0;
+
+    if(name == "$match"){
+        Filter filter(arg);
+        Vector<json> kept;
+        for(unsigned int i = 0; i < rows.get_size(); i++){
+            if(filter.matches(rows[i])) kept.push_back(rows[i]);
+        }
+        rows = kept;
+    }else if(name == "$group"){
+        Grouper grouper(arg);
+        for(unsigned int i = 0; i < rows.get_size(); i++) grouper.add(rows[i]);
+        rows.clear();
+        grouper.finish(rows);
+    }else if(name == "$sort"){
+        unsigned int limit = 0;
+        if(next && stage_name(*next) == "$limit"){
+            limit = limit_value(next->begin().value());
+            skip = 1;
+        }
+        // Строки уже в памяти, сбрасывать их на диск незачем
+        Sorter sorter(arg, limit, "", 0xFFFFFFFFu);
+        for(unsigned int i = 0; i < rows.get_size(); i++) sorter.add(rows[i]);
+        rows.clear();
+        sorter.finish([&](const json& row){
+            rows.push_back(row);
+            return true;
+        });
+    }else if(name == "$limit"){
+        unsigned int limit = limit_value(arg);
+        if(rows.get_size() > limit){
+            Vector<json> head;
+            for(unsigned int i = 0; i < limit; i++) head.push_back(rows[i]);
+            rows = head;
+        }
+    }
+}
+
+void Aggregation::run(const Collection& collection, Vector<json>& out) const{
+    out.clear();
+    unsigned int count = pipeline.size();
+    unsigned int i = 0;
+
+    json filter = json::object();
+    if(i < count && stage_name(pipeline[i]) == "$match"){
+        filter = pipeline[i].begin().value();
+        i++;
+    }
+
+    // Первая стадия после $match читает коллекцию потоком
+    const string source = i < count ? stage_name(pipeline[i]) : string();
+    Vector<string> names, sketch_fields;
+    if(source == "$group" && Grouper(pipeline[i].begin().value()).sketch_only(names, sketch_fields)){
+        json row = json::object();
+        row["_id"] = nullptr;
+        for(unsigned int a = 0; a < names.get_size(); a++){
+            row[names[a]] = collection.approx_distinct(filter, sketch_fields[a]).estimate();
+        }
+        out.push_back(row);
+        i++;
+    }else if(source == "$group"){
+        Grouper grouper(pipeline[i].begin().value());
+        Vector<string> fields;
+        grouper.collect_fields(fields);
+        json projection = json::array();
+        for(unsigned int f = 0; f < fields.get_size(); f++) projection.push_back(fields[f]);
+        if(projection.empty()) projection.push_back("_id");
+
+        Cursor cursor = collection.find_cursor(filter, projection, 0);
+        Vector<json> batch;
+        while(cursor.next_batch(batch)){
+            for(unsigned int b = 0; b < batch.get_size(); b++) grouper.add(batch[b]);
+        }
+        grouper.finish(out);
+        i++;
+    }else if(source == "$sort"){
+        int limit = 0;
+        if(i + 1 < count && stage_name(pipeline[i + 1]) == "$limit"){
+            limit = (int)limit_value(pipeline[i + 1].begin().value());
+        }
+        collection.find_sorted(filter, json::object(), pipeline[i].begin().value(), limit, [&](const json& document){
+            out.push_back(document);
+            return true;
+        });
+        i += limit > 0 ? 2 : 1;
+    }else{
+        int limit = source == "$limit" ? (int)limit_value(pipeline[i].begin().value()) : 0;
+        Cursor cursor = collection.find_cursor(filter, json::object(), limit);
+        Vector<json> batch;
+        while(cursor.next_batch(batch)){
+            for(unsigned int b = 0; b < batch.get_size(); b++) out.push_back(batch[b]);
+        }
+        if(limit > 0) i++;
+    }
+
+    while(i < count){
+        unsigned int skip = 0;
+        apply_stage(pipeline[i], i + 1 < count ? &pipeline[i + 1] : nullptr, out, skip);
+        i += 1 + skip;
+    }
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <string>
+#include "../containers/vector.h"
+#include "../containers/hash_map.h"
+#include "../include/json.hpp"
+#include "hyperloglog.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+class Collection;
+
+enum class AccumulatorOp {
+    Count,
+    Sum,
+    Min,
+    Max,
+    Avg,
+    ApproxDistinct
+};
+
+// Накопитель $group: name - поле строки результата; field - поле документа
+// ("$поле" в запросе) или пусто, если операнд - константа value ($sum: 1)
+struct Accumulator {
+    string name;
+    AccumulatorOp op;
+    string field;
+    json value;
+
+    Accumulator() : op(AccumulatorOp::Count) {}
+};
+
+// Состояние одной группы: значение _id и по накопителю - текущее значение
+// (min/max), целая и дробная суммы, число учтённых значений и скетч
+// различных значений ($approx_distinct)
+struct GroupState {
+    json id;
+    Vector<json> values;
+    Vector<HyperLogLog> sketches;
+    Vector<long long> int_sums;
+    Vector<double> sums;
+    Vector<long long> counts;
+    Vector<bool> integral;
+};
+
+// Хеш-группировка $group: документы подаются по одному, в памяти по строке на группу.
+// _id группы: null (одна группа), "$поле" или объект {"имя": "$поле", ...}.
+// Накопители: $count, $sum (число или "$поле"), $min, $max, $avg ("$поле") и
+// $approx_distinct ("$поле", оценка HyperLogLog с ошибкой около 0.8%, см. HyperLogLog).
+// При _id: null строка выдаётся и для пустого входа.
+class Grouper {
+private:
+    bool id_object;
+    Vector<string> id_names;
+    Vector<string> id_fields;
+    Vector<Accumulator> accumulators;
+    HashMap<string, unsigned int> index;
+    Vector<GroupState> groups;
+
+    GroupState new_group(const json& id) const;
+
+public:
+    explicit Grouper(const json& spec);
+
+    // Поля документа, которые нужны группировке
+    void collect_fields(Vector<string>& fields) const;
+    // Группа одна (_id: null) и все накопители - $approx_distinct: тогда ответ
+    // собирается из скетчей сегментов (Collection::approx_distinct)
+    bool sketch_only(Vector<string>& names, Vector<string>& fields) const;
+    void add(const json& document);
+    void finish(Vector<json>& out) const;
+    unsigned int size() const { return groups.get_size(); }
+};
+
+// Конвейер aggregate: массив стадий $match, $group, $sort и $limit.
+// Начальные стадии выполняются во время чтения коллекции: $match становится
+// фильтром курсора, $group читает только нужные поля и копит группы по хешу,
+// $sort с последующим $limit держит кучу лучших документов. Остальные стадии
+// применяются к уже полученным строкам.
+class Aggregation {
+private:
+    json pipeline;
+
+    static void apply_stage(const json& stage, const json* next, Vector<json>& rows, unsigned int& skip);
+
+public:
+    // Некорректный конвейер отклоняется исключением
+    explicit Aggregation(const json& pipeline);
+
+    void run(const Collection& collection, Vector<json>& out) const;
+};
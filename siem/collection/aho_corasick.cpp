@@ -0,0 +1,95 @@
+#include "aho_corasick.h"
+#include "../containers/hash_map.h"
+#include <mutex>
+
+using namespace std;
+
+static const unsigned int NO_STATE = 0xFFFFFFFFu;
+static const unsigned int CACHE_LIMIT = 64;
+
+static unsigned char fold(unsigned char c, bool ignore_case){
+    return ignore_case && c >= 'A' && c <= 'Z' ? (unsigned char)(c - 'A' + 'a') : c;
+}
+
+AhoCorasick::AhoCorasick(const Vector<string>& patterns, bool ignore_case) : classes(1){
+    for(unsigned int b = 0; b < 256; b++) byte_class[b] = 0;
+    for(unsigned int p = 0; p < patterns.get_size(); p++){
+        for(size_t i = 0; i < patterns[p].size(); i++){
+            unsigned char c = fold((unsigned char)patterns[p][i], ignore_case);
+            if(byte_class[c] == 0) byte_class[c] = (unsigned short)classes++;
+        }
+    }
+    if(ignore_case){
+        for(unsigned int c = 'A'; c <= 'Z'; c++) byte_class[c] = byte_class[c - 'A' + 'a'];
+    }
+
+    // Бор образцов
+    for(unsigned int k = 0; k < classes; k++) next.push_back(NO_STATE);
+    output.push_back(false);
+    for(unsigned int p = 0; p < patterns.get_size(); p++){
+        unsigned int state = 0;
+        for(size_t i = 0; i < patterns[p].size(); i++){
+            unsigned int k = byte_class[(unsigned char)patterns[p][i]];
+            if(next[state * classes + k] == NO_STATE){
+                next[state * classes + k] = output.get_size();
+                for(unsigned int j = 0; j < classes; j++) next.push_back(NO_STATE);
+                output.push_back(false);
+            }
+            state = next[state * classes + k];
+        }
+        output[state] = true;
+    }
+
+    // Обход в ширину: ссылки неудачи и достройка переходов
+    Vector<unsigned int> fail;
+    for(unsigned int s = 0; s < output.get_size(); s++) fail.push_back(0);
+    Vector<unsigned int> queue;
+    for(unsigned int k = 0; k < classes; k++){
+        unsigned int child = next[k];
+        if(child == NO_STATE) next[k] = 0;
+        else queue.push_back(child);
+    }
+    for(unsigned int head = 0; head < queue.get_size(); head++){
+        unsigned int state = queue[head];
+        if(output[fail[state]]) output[state] = true;
+        for(unsigned int k = 0; k < classes; k++){
+            unsigned int child = next[state * classes + k];
+            unsigned int fallback = next[fail[state] * classes + k];
+            if(child == NO_STATE){
+                next[state * classes + k] = fallback;
+            }else{
+                fail[child] = fallback;
+                queue.push_back(child);
+            }
+        }
+    }
+}
+
+bool AhoCorasick::search(const string& text) const{
+    if(output[0]) return true;
+    unsigned int state = 0;
+    for(size_t i = 0; i < text.size(); i++){
+        state = next[state * classes + byte_class[(unsigned char)text[i]]];
+        if(output[state]) return true;
+    }
+    return false;
+}
+
+static mutex g_cache_mutex;
+static HashMap<string, shared_ptr<const AhoCorasick>> g_cache;
+
+shared_ptr<const AhoCorasick> AhoCorasick::compile(const Vector<string>& patterns, bool ignore_case){
+    string key = ignore_case ? "i" : "c";
+    for(unsigned int i = 0; i < patterns.get_size(); i++){
+        key += to_string(patterns[i].size()) + ":" + patterns[i];
+    }
+
+    lock_guard<mutex> lock(g_cache_mutex);
+    const shared_ptr<const AhoCorasick>* cached = g_cache.get(key);
+    if(cached) return *cached;
+
+    shared_ptr<const AhoCorasick> automaton(new AhoCorasick(patterns, ignore_case));
+    if(g_cache.size() >= CACHE_LIMIT) g_cache.clear();
+    g_cache.insert(key, automaton);
+    return automaton;
+}
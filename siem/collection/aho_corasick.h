@@ -0,0 +1,27 @@
+#pragma once
+#include <string>
+#include <memory>
+#include "../containers/vector.h"
+
+using namespace std;
+
+// Автомат Ахо-Корасик для поиска любой из многих подстрок за один проход по тексту.
+// Байты, не встречающиеся в образцах, сводятся в один класс, поэтому таблица
+// переходов занимает states * (число различных байтов образцов + 1) ячеек.
+// Переходы по неудаче достроены заранее: на каждый байт текста один переход.
+class AhoCorasick {
+private:
+    unsigned short byte_class[256];
+    unsigned int classes;
+    Vector<unsigned int> next;
+    Vector<bool> output;
+
+    AhoCorasick(const Vector<string>& patterns, bool ignore_case);
+
+public:
+    // Автомат для набора образцов; одинаковые наборы берутся из кэша
+    static shared_ptr<const AhoCorasick> compile(const Vector<string>& patterns, bool ignore_case);
+
+    bool search(const string& text) const;
+    unsigned int get_states() const { return output.get_size(); }
+};
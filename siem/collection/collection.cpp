@@ -3,108 +3,16 @@
 #include <iostream>
 #include <filesystem>
 #include "../include/json.hpp"
+#include "scan_executor.h"
+#include "sorter.h"
+#include "prefilter.h"
+#include "aggregate.h"
+#include "date_histogram.h"
 
 using namespace std;
 namespace fs = filesystem;
 using json = nlohmann::json;
 
-static bool check_operators(const json& document, const string& field, const json& operators) {
-    if(!document.contains(field)){
-        return false;
-    }
-
-    for (auto it = operators.begin(); it != operators.end(); ++it) {
-        string op = it.key();
-        auto& op_value = it.value();
-
-        if(op == "$eq"){
-            if(document[field] != op_value) return false;
-        }else if(op == "$ne"){
-            if(document[field] == op_value) return false;
-        }else if(op == "$gt"){
-            if(!(document[field] > op_value)) return false;
-        }else if(op == "$lt"){
-            if(!(document[field] < op_value)) return false;
-        }else if(op == "$gte"){
-            if(!(document[field] >= op_value)) return false;
-        }else if(op == "$lte"){
-            if(!(document[field] <= op_value)) return false;
-        }else if(op == "$in"){
-            if(!op_value.is_array()) return false;
-            bool found = false;
-            for(const auto& item : op_value){
-                if(document[field] == item){
-                    found = true;
-                    break;
-                }
-            }
-            if(!found) return false;
-        }else if(op == "$nin"){
-            if(!op_value.is_array()) return false;
-            for(const auto& item : op_value){
-                if(document[field] == item){
-                    return false;
-                }
-            }
-        }
-    }
-    return true;
-}
-
-static bool matches_filter(const json& document, const json& filter) {
-    if (filter.empty()) return true;
-    if (!filter.is_object()) return false;
-
-    for (auto it = filter.begin(); it != filter.end(); ++it) {
-        string key = it.key();
-        auto& condition = it.value();
-
-        if (key == "$and") {
-            if (!condition.is_array()) return false;
-            for (const auto& cond : condition) {
-                if (!matches_filter(document, cond)) return false;
-            }
-        }
-        else if (key == "$or") {
-            if (!condition.is_array()) return false;
-            bool found_match = false;
-            for (const auto& cond : condition) {
-                if (matches_filter(document, cond)) {
-                    found_match = true;
-                    break;
-                }
-            }
-            if (!found_match) return false;
-        }
-        else if (key == "$not") {
-            if (matches_filter(document, condition)) return false;
-        }
-        else if (condition.is_primitive() || condition.is_string()) {
-            if (!document.contains(key) || document[key] != condition) {
-                return false;
-            }
-        }
-        else if (condition.is_object()) {
-            if (!check_operators(document, key, condition)) {
-                return false;
-            }
-        }
-    }
-    return true;
-}
-
-static bool compare_documents(const json& a, const json& b, const json& sort_rules) {
-    for (auto& [field, direction] : sort_rules.items()) {
-        if (!a.contains(field) && !b.contains(field)) continue;
-        if (!a.contains(field)) return false;
-        if (!b.contains(field)) return true;
-
-        if (a[field] < b[field]) return direction == 1;
-        if (a[field] > b[field]) return direction == -1;
-    }
-    return false;
-}
-
 static void apply_update_operators(json& document, const json& update_data) {
     for (auto& [operator_name, operations] : update_data.items()) {
         if (operator_name == "$set") {
@@ -145,19 +53,54 @@ static void apply_update_operators(json& document, const json& update_data) {
     }
 }
 
+static json project_document(const json& document, const json& projection) {
+    if (projection.empty()) return document;
+
+    json projected_doc;
+    for (auto it = projection.begin(); it != projection.end(); ++it) {
+        string field_name = it.value();
+        if (document.contains(field_name)) {
+            projected_doc[field_name] = document[field_name];
+        }
+    }
+    return projected_doc;
+}
+
 Collection::Collection(const string& name, const string& db_path,
-                       int tuples_limit, const json& structure)
-    : name(name), db_path(db_path), tuples_limit(tuples_limit), structure(structure){
+                       int tuples_limit, const json& structure,
+                       const CollectionOptions& options)
+    : name(name), db_path(db_path), tuples_limit(tuples_limit), structure(structure), options(options),
+      rollups_ready(false), topk_ready(false), layout_version(0), open_streams(0){
 
     string collection_path = db_path + name + "/";
     create_directory(collection_path);
 
-    string first_file = get_file_path(1);
-    if(!file_exists(first_file)){
-        ofstream file(first_file);
-        file << "[]";
-        file.close();
+    // Прогоны сортировки, оставшиеся после аварийной остановки, не нужны
+    error_code ec;
+    fs::remove_all(get_sort_dir(), ec);
+
+    // Для упорядоченных полей ведутся минимумы и максимумы по сегментам
+    if(structure.is_object()){
+        for(auto it = structure.begin(); it != structure.end(); ++it){
+            if(!it.value().is_string()) continue;
+            string type = it.value().get<string>();
+            if(type == "timestamp" || type == "int" || type == "float"){
+                zone_fields.push_back(it.key());
+            }
+        }
+    }
+
+    for(unsigned int i = 0; i < options.rollups.get_size(); i++){
+        rollups.push_back(Rollup(options.rollups[i]));
+    }
+    for(unsigned int i = 0; i < options.topk.get_size(); i++){
+        topk.push_back(TopKSketch(options.topk[i]));
     }
+
+    migrate_legacy_files();
+    open_segments();
+    build_indexes();
+    write_manifest();
 }
 
 bool Collection::file_exists(const string& path) const{
@@ -172,94 +115,928 @@ void Collection::create_directory(const string& path) const{
 }
 
 string Collection::get_file_path(int file_num) const{
+    return db_path + name + "/" + to_string(file_num) + ".seg";
+}
+
+string Collection::get_column_file_path(int file_num) const{
+    return db_path + name + "/" + to_string(file_num) + ".col";
+}
+
+string Collection::get_sort_dir() const{
+    return db_path + name + "/sort";
+}
+
+string Collection::get_legacy_file_path(int file_num) const{
     return db_path + name + "/" + to_string(file_num) + ".json";
 }
 
-int Collection::get_last_file_number() const{
+SegmentEncoding Collection::get_encoding() const{
+    return options.encoding.empty() ? SegmentEncoding::Json : parse_segment_encoding(options.encoding);
+}
+
+// Старые файлы N.json (массив документов целиком) переводятся в сегменты N.seg
+void Collection::migrate_legacy_files(){
     int file_num = 1;
-    while(file_exists(get_file_path(file_num))){
+    while(file_exists(get_legacy_file_path(file_num))){
+        string legacy_path = get_legacy_file_path(file_num);
+        string segment_path = get_file_path(file_num);
+
+        if(!file_exists(segment_path)){
+            json data = json::array();
+            try{
+                ifstream in(legacy_path);
+                in >> data;
+            }catch(const exception&){
+                data = json::array();
+            }
+
+            Vector<json> documents;
+            if(data.is_array()){
+                for(const auto& document : data){
+                    documents.push_back(document);
+                }
+            }
+
+            Segment segment(file_num, segment_path, get_encoding());
+            segment.rewrite(documents);
+        }
+
+        fs::remove(legacy_path);
         file_num++;
     }
-    return file_num - 1;
 }
 
-int Collection::count_documents_in_file(const string& file_path) const {
-    if(!file_exists(file_path)) return 0;
+// Запечатанный сегмент хранится как N.col; если после сбоя остались
+// обе копии, N.col уже полностью записан и N.seg лишний
+string Collection::resolve_segment_path(int file_num){
+    string row_path = get_file_path(file_num);
+    string column_path = get_column_file_path(file_num);
+    if(file_exists(column_path)){
+        if(file_exists(row_path)) fs::remove(row_path);
+        return column_path;
+    }
+    return file_exists(row_path) ? row_path : "";
+}
+
+// Строковый сегмент с числом записей, размером и кодированием в манифесте
+static bool described_row_segment(const json& entry){
+    return entry.value("format", "") == "row" && entry.contains("encoding") && entry["encoding"].is_string() &&
+           entry.contains("documents") && entry["documents"].is_number_unsigned() &&
+           entry.contains("deleted") && entry["deleted"].is_number_unsigned() &&
+           entry.contains("bytes") && entry["bytes"].is_number_integer();
+}
 
+// Список сегментов берётся из manifest.json без перебора файлов на диске.
+// Файл, указанный в манифесте, открывается напрямую; только если его нет
+// (сбой между запечатыванием и записью манифеста), путь ищется заново.
+// Записи строкового сегмента перебираются только после размера из манифеста:
+// у запечатанного это пустой хвост, у активного - дописанное после записи манифеста.
+// Сегмент, созданный после последней записи манифеста, подхватывается
+// одной проверкой следующего номера.
+// Номера сегментов возрастают, но могут идти с пропусками: сегменты,
+// целиком вышедшие за срок хранения, удаляются (см. expire).
+bool Collection::load_manifest(){
+    json manifest;
     try{
-        ifstream file(file_path);
-        json data;
-        file >> data;
-        if(!data.is_array()) return 0;
-        return (int)data.size();
-    } catch(const exception&){
-        return 0;
+        ifstream in(get_manifest_path());
+        if(!in.is_open()) return false;
+        in >> manifest;
+    }catch(const exception&){
+        return false;
+    }
+    if(!manifest.is_object() || !manifest.contains("segments") || !manifest["segments"].is_array()){
+        return false;
+    }
+
+    string collection_path = db_path + name + "/";
+    int last_number = 0;
+    for(const auto& entry : manifest["segments"]){
+        if(!entry.is_object() || !entry.contains("number") || !entry["number"].is_number_integer()){
+            return false;
+        }
+        int number = entry["number"].get<int>();
+        if(number <= last_number) return false;
+
+        string path = entry.contains("file") && entry["file"].is_string()
+                      ? collection_path + entry["file"].get<string>()
+                      : get_file_path(number);
+
+        Segment segment(number, path);
+        try{
+            if(described_row_segment(entry)){
+                SegmentEncoding encoding = parse_segment_encoding(entry["encoding"].get<string>());
+                segment.open(entry["documents"].get<unsigned int>() + entry["deleted"].get<unsigned int>(),
+                             entry["bytes"].get<long long>(), encoding);
+            }else{
+                segment.open();
+            }
+        }catch(const exception&){
+            string resolved = resolve_segment_path(number);
+            if(resolved.empty()){
+                throw runtime_error("Сегмент " + to_string(number) + " из манифеста коллекции " +
+                                    name + " не найден на диске");
+            }
+            segment = Segment(number, resolved);
+            segment.open();
+        }
+        if(entry.contains("partition") && entry["partition"].is_string()){
+            segment.set_partition(entry["partition"].get<string>());
+        }
+        segments.push_back(segment);
+        last_number = number;
     }
+
+    string next_path = resolve_segment_path(last_number + 1);
+    while(!next_path.empty()){
+        Segment segment(last_number + 1, next_path);
+        segment.open();
+        segments.push_back(segment);
+        last_number++;
+        next_path = resolve_segment_path(last_number + 1);
+    }
+    return true;
 }
 
-void Collection::insert(const json& document) {
-    if (!document.contains("_id")) {
-        throw runtime_error("Документ должен содержать поле _id");
+void Collection::open_segments(){
+    segments.clear();
+
+    if(!load_manifest()){
+        segments.clear();
+        int last_number = last_file_number();
+        for(int file_num = 1; file_num <= last_number; file_num++){
+            string path = resolve_segment_path(file_num);
+            if(path.empty()) continue;
+            Segment segment(file_num, path);
+            segment.open();
+            segments.push_back(segment);
+        }
     }
-    if(!document["_id"].is_string()){
-        throw runtime_error("Поле _id должно быть строкой");
+
+    if(segments.empty()){
+        Segment segment(1, get_file_path(1), get_encoding());
+        segment.create();
+        segments.push_back(segment);
     }
+}
 
-    string document_id = document["_id"].get<string>();
+// Наибольший номер N среди файлов N.seg и N.col коллекции (0 - сегментов нет)
+int Collection::last_file_number() const{
+    int last_number = 0;
+    for(const auto& entry : fs::directory_iterator(db_path + name)){
+        string extension = entry.path().extension().string();
+        if(extension != ".seg" && extension != ".col") continue;
+        string stem = entry.path().stem().string();
+        if(stem.empty() || stem.size() > 9) continue;
+        bool numeric = true;
+        for(char c : stem){
+            if(c < '0' || c > '9'){ numeric = false; break; }
+        }
+        if(numeric) last_number = max(last_number, stoi(stem));
+    }
+    return last_number;
+}
 
-    auto existing = find_one({{"_id", document_id}}, json::object(), json::object());
-    if (!existing.empty()) {
-        throw runtime_error("Документ с _id уже существует");
+// Ключ партиции документа: день ("2026-10-18") или час ("2026-10-18T15") поля времени
+string Collection::partition_key(const json& document) const{
+    if(options.partition_field.empty()) return "";
+    if(!document.contains(options.partition_field)) return "";
+    const json& value = document[options.partition_field];
+    if(!value.is_string()) return "";
+
+    string ts = value.get<string>();
+    size_t len = options.partition_interval == "hour" ? 13 : 10;
+    return ts.size() >= len ? ts.substr(0, len) : ts;
+}
+
+// Новый сегмент начинается, когда текущий заполнен или документ относится
+// к более поздней партиции времени, чем всё, что уже лежит в сегменте.
+// Прежний сегмент запечатывается позже, фоновой задачей (seal_segments).
+Segment& Collection::get_insert_segment(const json& document){
+    Segment& last = segments[segments.get_size() - 1];
+    string key = partition_key(document);
+
+    bool full = (int)last.size() >= tuples_limit;
+    bool next_partition = last.size() > 0 && !key.empty() && key > last.get_partition();
+    if(!full && !next_partition){
+        return last;
+    }
+
+    int next_num = last.get_number() + 1;
+    Segment segment(next_num, get_file_path(next_num), get_encoding());
+    segment.create();
+    segments.push_back(segment);
+    write_manifest();
+    return segments[segments.get_size() - 1];
+}
+
+// Шаг фоновой задачи: сегменты, в которые больше не вставляют, переводятся
+// в колоночный формат (sealed_format columnar) и получают файл индексов N.idx.
+// Пока открыты потоковые чтения, сегменты не трогаются.
+int Collection::seal_segments(int max_segments){
+    if(open_streams > 0) return 0;
+    int sealed = 0;
+    for(unsigned int s = 0; s + 1 < segments.get_size() && sealed < max_segments; s++){
+        Segment& segment = segments[s];
+        if(segment.size() == 0) continue;
+        if(options.sealed_format == "columnar" && !segment.is_columnar()){
+            seal_segment(segment);
+        }else if(!segment.has_saved_indexes()){
+            save_segment_indexes(segment);
+        }else{
+            continue;
+        }
+        sealed++;
+    }
+    if(sealed > 0) write_manifest();
+    return sealed;
+}
+
+// Заполненный сегмент переписывается по колонкам из structure (и _id).
+// Порядковые номера записей сохраняются, поэтому индексы остаются верными,
+// меняются только смещения в id_index.
+void Collection::seal_segment(Segment& segment){
+    Vector<string> names;
+    names.push_back("_id");
+    if(structure.is_object()){
+        for(auto it = structure.begin(); it != structure.end(); ++it){
+            if(it.key() != "_id") names.push_back(it.key());
+        }
+    }
+
+    // Помеченные удалёнными записи при запечатывании выбрасываются, и номера
+    // остальных сдвигаются; тогда индексы сегмента строятся заново
+    bool renumbered = segment.dead_count() > 0;
+    segment.seal_columnar(names, get_column_file_path(segment.get_number()));
+
+    if(renumbered){
+        layout_version++;
+        segment.get_index().clear();
+        segment.get_text_index().clear();
+        segment.get_trigram_index().clear();
+        segment.get_distinct().clear();
+        segment.get_zones().clear();
+        segment.for_each([&](unsigned int ordinal, const json& document){
+            index_document(document, segment, ordinal);
+            return true;
+        });
+        save_segment_indexes(segment);
+        return;
     }
 
-    int last_file_num = get_last_file_number();
-    int target_file_num = last_file_num <= 0 ? 1 : last_file_num;
-    string target_path = get_file_path(target_file_num);
+    Vector<string> id_field;
+    id_field.push_back("_id");
+    segment.for_each([&](unsigned int ordinal, const json& document){
+        if(document.contains("_id") && document["_id"].is_string()){
+            id_index.insert(document["_id"].get<string>(), DocRef(segment.get_number(), ordinal, -1));
+        }
+        return true;
+    }, &id_field);
+    save_segment_indexes(segment);
+}
+
+string Collection::get_manifest_path() const{
+    return db_path + name + "/manifest.json";
+}
 
-    int current_count = count_documents_in_file(target_path);
-    if(current_count >= tuples_limit){
-        target_file_num++;
-        target_path = get_file_path(target_file_num);
-        ofstream new_file(target_path);
-        new_file << "[]";
-        new_file.close();
-    } else if(!file_exists(target_path)) {
-        ofstream new_file(target_path);
-        new_file << "[]";
-        new_file.close();
+static const char* encoding_name(SegmentEncoding encoding){
+    switch(encoding){
+        case SegmentEncoding::Cbor: return "cbor";
+        case SegmentEncoding::MsgPack: return "msgpack";
+        default: return "json";
     }
+}
 
-    json data = json::array();
+// manifest.json - опись коллекции: по каждому сегменту файл, формат,
+// состояние (active - последний, в него идёт вставка; sealed - остальные),
+// число документов и размер на момент записи манифеста, партиция и зоны min/max
+void Collection::write_manifest() const{
+    json manifest;
+    manifest["segments"] = json::array();
+    for(unsigned int s = 0; s < segments.get_size(); s++){
+        const Segment& segment = segments[s];
+        string path = segment.get_path();
+        manifest["segments"].push_back({
+            {"number", segment.get_number()},
+            {"file", path.substr(path.find_last_of('/') + 1)},
+            {"format", segment.is_columnar() ? "columnar" : "row"},
+            {"encoding", segment.is_columnar() ? "json" : encoding_name(segment.get_encoding())},
+            {"state", s + 1 == segments.get_size() ? "active" : "sealed"},
+            {"documents", segment.live_size()},
+            {"deleted", segment.dead_count()},
+            {"bytes", segment.get_bytes()},
+            {"partition", segment.get_partition()},
+            {"zones", segment.get_zones().to_json()}
+        });
+    }
 
+    string path = get_manifest_path();
+    string tmp_path = path + ".tmp";
     {
-        ifstream in(target_path);
-        if(in.is_open()){
-            try{
-                in >> data;
-            }catch(...){
-                data = json::array();
+        ofstream out(tmp_path, ios::trunc);
+        if(!out.is_open()) return;
+        out << manifest.dump(2, ' ', false, json::error_handler_t::replace);
+        out.close();
+        if(!out) return;
+    }
+    fs::rename(tmp_path, path);
+}
+
+int Collection::find_segment_index(int number) const{
+    int lo = 0;
+    int hi = (int)segments.get_size() - 1;
+    while(lo <= hi){
+        int mid = (lo + hi) / 2;
+        int n = segments[mid].get_number();
+        if(n == number) return mid;
+        if(n < number) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return -1;
+}
+
+void Collection::index_document(const json& document, Segment& segment, unsigned int ordinal){
+    if(document.contains("_id") && document["_id"].is_string()){
+        id_index.insert(document["_id"].get<string>(),
+                        DocRef(segment.get_number(), ordinal, segment.get_offset(ordinal)));
+    }
+
+    for(unsigned int i = 0; i < options.indexes.get_size(); i++){
+        const string& field = options.indexes[i];
+        if(document.contains(field)){
+            segment.get_index().add(field, document[field], ordinal);
+        }
+    }
+
+    for(unsigned int i = 0; i < options.text_fields.get_size(); i++){
+        const string& field = options.text_fields[i];
+        auto it = document.find(field);
+        if(it != document.end() && it->is_string()){
+            segment.get_text_index().add(field, it->get_ref<const string&>(), ordinal);
+        }
+    }
+
+    for(unsigned int i = 0; i < options.trigram_fields.get_size(); i++){
+        const string& field = options.trigram_fields[i];
+        auto it = document.find(field);
+        if(it != document.end() && it->is_string()){
+            segment.get_trigram_index().add(field, it->get_ref<const string&>(), ordinal);
+        }
+    }
+
+    for(unsigned int i = 0; i < options.distinct_fields.get_size(); i++){
+        const string& field = options.distinct_fields[i];
+        auto it = document.find(field);
+        if(it != document.end() && !it->is_null()){
+            segment.get_distinct().add(field, *it);
+        }
+    }
+
+    for(unsigned int i = 0; i < zone_fields.get_size(); i++){
+        const string& field = zone_fields[i];
+        if(document.contains(field)){
+            segment.get_zones().update(field, document[field]);
+        }
+    }
+
+    if(!options.retention_field.empty()){
+        auto it = document.find(options.retention_field);
+        long long seconds = 0;
+        if(it != document.end() && DateHistogram::parse_timestamp(*it, seconds)){
+            segment.get_zones().update_time(seconds);
+        }
+    }
+
+    string key = partition_key(document);
+    if(key > segment.get_partition()){
+        segment.set_partition(key);
+    }
+}
+
+void Collection::unindex_document(const json& document, int segment_number){
+    if(!document.contains("_id") || !document["_id"].is_string()) return;
+    unindex_id(document["_id"].get<string>(), segment_number);
+}
+
+void Collection::unindex_id(const string& id, int segment_number){
+    DocRef ref;
+    if(id_index.try_get(id, ref) && ref.segment == segment_number){
+        id_index.erase(id);
+    }
+}
+
+// Индексы сегментов, в которые больше не вставляют, читаются из N.idx;
+// по записям строятся только активный сегмент и сегменты без годного файла
+void Collection::build_indexes(){
+    id_index.clear();
+    for(unsigned int r = 0; r < rollups.get_size(); r++) rollups[r].clear();
+    for(unsigned int t = 0; t < topk.get_size(); t++) topk[t].clear();
+    rollups_ready = rollups.empty();
+    topk_ready = topk.empty();
+
+    json config = index_config();
+    for(unsigned int s = 0; s < segments.get_size(); s++){
+        Segment& segment = segments[s];
+        bool active = s + 1 == segments.get_size();
+
+        json ids;
+        if(!active && segment.load_indexes(config, ids)){
+            for(unsigned int ordinal = 0; ordinal < ids.size(); ordinal++){
+                const json& id = ids[ordinal];
+                if(!id.is_string() || segment.is_deleted(ordinal)) continue;
+                id_index.insert(id.get<string>(), DocRef(segment.get_number(), ordinal, segment.get_offset(ordinal)));
             }
+            continue;
         }
+
+        segment.get_index().clear();
+        segment.get_text_index().clear();
+        segment.get_trigram_index().clear();
+        segment.get_distinct().clear();
+        segment.get_zones().clear();
+        segment.for_each([&](unsigned int ordinal, const json& document){
+            index_document(document, segment, ordinal);
+            return true;
+        });
+        if(!active) save_segment_indexes(segment);
     }
+}
+
+static json names_json(const Vector<string>& names){
+    json out = json::array();
+    for(unsigned int i = 0; i < names.get_size(); i++) out.push_back(names[i]);
+    return out;
+}
 
-    if(!data.is_array()){
-        data = json::array();
+// Настройки, от которых зависит содержимое N.idx: при их смене файл не годится
+json Collection::index_config() const{
+    return {
+        {"indexes", names_json(options.indexes)},
+        {"text", names_json(options.text_fields)},
+        {"trigram", names_json(options.trigram_fields)},
+        {"distinct", names_json(options.distinct_fields)},
+        {"zones", names_json(zone_fields)},
+        {"retention", options.retention_field},
+        {"partition", {options.partition_field, options.partition_interval}}
+    };
+}
+
+void Collection::save_segment_indexes(const Segment& segment, const json* known_ids) const{
+    if(known_ids){
+        segment.save_indexes(index_config(), *known_ids);
+        return;
     }
 
-    data.push_back(document);
+    json ids = json::array();
+    for(unsigned int i = 0; i < segment.size(); i++) ids.push_back(nullptr);
+
+    Vector<string> id_field;
+    id_field.push_back("_id");
+    segment.for_each([&](unsigned int ordinal, const json& document){
+        auto it = document.find("_id");
+        if(it != document.end() && it->is_string()) ids[ordinal] = *it;
+        return true;
+    }, &id_field);
+    segment.save_indexes(index_config(), ids);
+}
+
+// Свёртки и скетчи читают только свои поля всех живых документов
+void Collection::build_summaries() const{
+    if(rollups_ready && topk_ready) return;
 
-    {
-        ofstream out(target_path, ios::trunc);
-        if(!out.is_open()){
-            throw runtime_error("Не удалось открыть файл коллекции для записи");
+    Vector<string> fields;
+    if(!rollups_ready){
+        for(unsigned int r = 0; r < rollups.get_size(); r++) rollups[r].collect_fields(fields);
+    }
+    if(!topk_ready){
+        for(unsigned int t = 0; t < topk.get_size(); t++) topk[t].collect_fields(fields);
+    }
+
+    for(unsigned int s = 0; s < segments.get_size(); s++){
+        segments[s].for_each([&](unsigned int, const json& document){
+            if(!rollups_ready){
+                for(unsigned int r = 0; r < rollups.get_size(); r++) rollups[r].add(document, 1);
+            }
+            if(!topk_ready){
+                for(unsigned int t = 0; t < topk.get_size(); t++) topk[t].add(document);
+            }
+            return true;
+        }, &fields);
+    }
+    rollups_ready = true;
+    topk_ready = true;
+}
+
+// Свёртки и скетчи частых значений ведутся по всем живым документам коллекции.
+// Скетч только прибавляет, поэтому удаление подсчитанного им документа сбрасывает
+// все скетчи до следующего запроса topk.
+void Collection::update_summaries(const json& document, long long delta){
+    if(rollups_ready){
+        for(unsigned int r = 0; r < rollups.get_size(); r++){
+            rollups[r].add(document, delta);
         }
-        out << data.dump(4, ' ', false, json::error_handler_t::replace);
-        out.close();
     }
+    if(!topk_ready) return;
+
+    for(unsigned int t = 0; t < topk.get_size(); t++){
+        if(delta > 0){
+            topk[t].add(document);
+        }else if(topk[t].counts(document)){
+            for(unsigned int i = 0; i < topk.get_size(); i++) topk[i].clear();
+            topk_ready = false;
+            return;
+        }
+    }
+}
+
+// Перезаписывает сегмент целиком; смещения и номера его документов меняются,
+// поэтому индексы этого сегмента перестраиваются
+void Collection::rewrite_segment(unsigned int s, const Vector<json>& old_documents, const Vector<json>& new_documents){
+    Segment& segment = segments[s];
+    for(unsigned int i = 0; i < old_documents.get_size(); i++){
+        unindex_document(old_documents[i], segment.get_number());
+    }
+    // Компактация и перекодирование передают тот же набор документов
+    if(&old_documents != &new_documents){
+        for(unsigned int i = 0; i < old_documents.get_size(); i++) update_summaries(old_documents[i], -1);
+        for(unsigned int i = 0; i < new_documents.get_size(); i++) update_summaries(new_documents[i], 1);
+    }
+    segment.rewrite(new_documents);
+    layout_version++;
+    segment.get_index().clear();
+    segment.get_text_index().clear();
+    segment.get_trigram_index().clear();
+    segment.get_distinct().clear();
+    segment.get_zones().clear();
+    for(unsigned int i = 0; i < new_documents.get_size(); i++){
+        index_document(new_documents[i], segment, i);
+    }
+    if(s + 1 < segments.get_size()) save_segment_indexes(segment);
+    write_manifest();
+}
+
+static void union_sorted(const Vector<unsigned int>& a, const Vector<unsigned int>& b, Vector<unsigned int>& out){
+    unsigned int i = 0, j = 0;
+    while(i < a.get_size() || j < b.get_size()){
+        unsigned int v;
+        if(j >= b.get_size() || (i < a.get_size() && a[i] < b[j])) v = a[i++];
+        else if(i >= a.get_size() || b[j] < a[i]) v = b[j++];
+        else { v = a[i]; i++; j++; }
+        out.push_back(v);
+    }
+}
+
+static void intersect_sorted(const Vector<unsigned int>& a, const Vector<unsigned int>& b, Vector<unsigned int>& out){
+    unsigned int i = 0, j = 0;
+    while(i < a.get_size() && j < b.get_size()){
+        if(a[i] < b[j]) i++;
+        else if(b[j] < a[i]) j++;
+        else { out.push_back(a[i]); i++; j++; }
+    }
+}
+
+static bool contains_name(const Vector<string>& names, const string& name){
+    for(unsigned int i = 0; i < names.get_size(); i++){
+        if(names[i] == name) return true;
+    }
+    return false;
+}
+
+// Записи сегмента со словами запроса $text: для $all списки пересекаются,
+// начиная с самого короткого, для $any объединяются
+bool Collection::text_candidates(const Segment& segment, const string& field, const json& operand,
+                                 Vector<unsigned int>& out) const{
+    Vector<string> tokens;
+    bool any = false;
+    try{
+        Filter::text_terms(operand, tokens, any);
+    }catch(const exception&){
+        return false;
+    }
+
+    const TextIndex& text = segment.get_text_index();
+    out.clear();
+    if(any){
+        for(unsigned int i = 0; i < tokens.get_size(); i++){
+            Vector<unsigned int> one;
+            text.lookup(field, tokens[i], one);
+            Vector<unsigned int> merged;
+            union_sorted(out, one, merged);
+            out = merged;
+        }
+        return true;
+    }
+
+    unsigned int shortest = 0;
+    for(unsigned int i = 1; i < tokens.get_size(); i++){
+        if(text.count(field, tokens[i]) < text.count(field, tokens[shortest])) shortest = i;
+    }
+    text.lookup(field, tokens[shortest], out);
+    for(unsigned int i = 0; i < tokens.get_size() && !out.empty(); i++){
+        if(i == shortest) continue;
+        Vector<unsigned int> postings;
+        text.lookup(field, tokens[i], postings);
+        Vector<unsigned int> narrowed;
+        intersect_sorted(out, postings, narrowed);
+        out = narrowed;
+    }
+    return true;
+}
+
+// Записи сегмента хотя бы с одной из подстрок $any_of_substrings: объединение
+// кандидатов по триграммам каждой; подстрока короче трёх байт индекс отключает
+bool Collection::any_substring_candidates(const Segment& segment, const string& field, const json& condition,
+                                          Vector<unsigned int>& out) const{
+    Vector<string> patterns;
+    if(!Filter::any_substrings(condition, patterns)) return false;
+
+    out.clear();
+    for(unsigned int i = 0; i < patterns.get_size(); i++){
+        Vector<string> literal;
+        literal.push_back(patterns[i]);
+        Vector<unsigned int> one;
+        if(!segment.get_trigram_index().candidates(field, literal, one)) return false;
+        Vector<unsigned int> merged;
+        union_sorted(out, one, merged);
+        out = merged;
+    }
+    return true;
+}
+
+// Кандидаты сегмента по индексам для условий верхнего уровня вида
+// {"поле": значение}, {"поле": {"$eq": v}}, {"поле": {"$in": [...]}}
+// и {"поле": {"$text": ...}} для полей полнотекстового индекса,
+// {"поле": {"$contains" | "$regex" | "$any_of_substrings": ...}} для полей индекса триграмм.
+// $and пересекает кандидатов ветвей с индексом, $or объединяет их, если
+// индекс есть у каждой ветви. Возвращает false, если ни одно условие не покрыто индексом.
+bool Collection::index_candidates(const Segment& segment, const json& filter, Vector<unsigned int>& out) const{
+    if(!filter.is_object() ||
+       (options.indexes.empty() && options.text_fields.empty() && options.trigram_fields.empty())) return false;
+
+    bool used = false;
+    for(auto it = filter.begin(); it != filter.end(); ++it){
+        const string& field = it.key();
+        const json& condition = it.value();
+        Vector<unsigned int> postings;
+
+        if(field == "$and" || field == "$or"){
+            if(!condition.is_array()) continue;
+            bool any_branch = field == "$or";
+            bool branch_used = false;
+            bool covered = true;
+            for(const auto& branch : condition){
+                Vector<unsigned int> one;
+                if(!index_candidates(segment, branch, one)){
+                    if(any_branch){ covered = false; break; }
+                    continue;
+                }
+                Vector<unsigned int> merged;
+                if(!branch_used) merged = one;
+                else if(any_branch) union_sorted(postings, one, merged);
+                else intersect_sorted(postings, one, merged);
+                postings = merged;
+                branch_used = true;
+            }
+            if(!covered || (!branch_used && !any_branch)) continue;
+        }else if(condition.is_object() && condition.contains("$text") &&
+                 contains_name(options.text_fields, field)){
+            if(!text_candidates(segment, field, condition["$text"], postings)) continue;
+        }else if(condition.is_object() && (condition.contains("$contains") || condition.contains("$regex")) &&
+                 contains_name(options.trigram_fields, field)){
+            Vector<string> literals;
+            bool ignore_case = false;
+            if(!Filter::substring_literals(condition, literals, ignore_case)) continue;
+            if(!segment.get_trigram_index().candidates(field, literals, postings)) continue;
+        }else if(condition.is_object() && condition.contains("$any_of_substrings") &&
+                 contains_name(options.trigram_fields, field)){
+            if(!any_substring_candidates(segment, field, condition, postings)) continue;
+        }else if(!contains_name(options.indexes, field)){
+            continue;
+        }else if(condition.is_primitive() && !condition.is_null()){
+            segment.get_index().lookup(field, condition, postings);
+        }else if(condition.is_object() && condition.size() == 1 && condition.contains("$eq")){
+            segment.get_index().lookup(field, condition["$eq"], postings);
+        }else if(condition.is_object() && condition.size() == 1 && condition.contains("$in") &&
+                 condition["$in"].is_array()){
+            for(const auto& value : condition["$in"]){
+                Vector<unsigned int> one;
+                segment.get_index().lookup(field, value, one);
+                Vector<unsigned int> merged;
+                union_sorted(postings, one, merged);
+                postings = merged;
+            }
+        }else{
+            continue;
+        }
+
+        if(!used){
+            out = postings;
+            used = true;
+        }else{
+            Vector<unsigned int> narrowed;
+            intersect_sorted(out, postings, narrowed);
+            out = narrowed;
+        }
+        if(out.empty()) break;
+    }
+    return used;
+}
+
+// Номера записей сегмента, удовлетворяющих фильтру, не больше max_count (0 - без ограничения).
+// Для колоночного сегмента читаются только колонки полей фильтра.
+// Фильтр только из равенств ($eq, $in скаляров) по индексированным полям:
+// кандидаты из индекса и есть ответ, документы проверять не нужно
+bool Collection::index_exact(const json& filter) const{
+    if(!filter.is_object() || filter.empty()) return false;
+    for(auto it = filter.begin(); it != filter.end(); ++it){
+        if(!contains_name(options.indexes, it.key())) return false;
+        const json& condition = it.value();
+        if(condition.is_primitive() && !condition.is_null()) continue;
+        if(!condition.is_object() || condition.size() != 1) return false;
+        if(condition.contains("$eq")){
+            if(!condition["$eq"].is_primitive() || condition["$eq"].is_null()) return false;
+        }else if(condition.contains("$in") && condition["$in"].is_array()){
+            for(const auto& value : condition["$in"]){
+                if(!value.is_primitive() || value.is_null()) return false;
+            }
+        }else{
+            return false;
+        }
+    }
+    return true;
+}
+
+void Collection::matching_ordinals(const Segment& segment, const Filter& filter, unsigned int max_count,
+                                   Vector<unsigned int>& out) const{
+    Vector<string> fields;
+    filter.collect_fields(fields);
+
+    auto visit = [&](unsigned int ordinal, const json& document){
+        if(!filter.matches(document)) return true;
+        out.push_back(ordinal);
+        return max_count == 0 || out.get_size() < max_count;
+    };
+
+    Prefilter prefilter(filter, segment.get_encoding());
+    const Prefilter* bytes_filter = prefilter.empty() ? nullptr : &prefilter;
+    Vector<unsigned int> candidates;
+    if(index_candidates(segment, filter.get_source(), candidates)){
+        segment.for_each_at(candidates, visit, &fields, bytes_filter);
+    }else{
+        segment.for_each(visit, &fields, 0, bytes_filter);
+    }
+}
+
+// Документы сегмента, подходящие под фильтр и ещё не удалённые (не больше max_count,
+// 0 - без ограничения): их номера и _id. Если задан pinned, проверяется только эта
+// запись. Только чтение, поэтому сегменты обрабатываются параллельно.
+void Collection::find_tombstones(const Segment& segment, const Filter& filter, unsigned int max_count,
+                                 const DocRef* pinned, Vector<unsigned int>& ordinals, Vector<string>& ids,
+                                 Vector<json>& documents) const{
+    Vector<string> fields;
+    filter.collect_fields(fields);
+    fields.push_back("_id");
+    for(unsigned int r = 0; r < rollups.get_size(); r++) rollups[r].collect_fields(fields);
+    for(unsigned int t = 0; t < topk.get_size(); t++) topk[t].collect_fields(fields);
+
+    auto visit = [&](unsigned int ordinal, const json& document){
+        if(!filter.matches(document)) return true;
+        ordinals.push_back(ordinal);
+        if(document.contains("_id") && document["_id"].is_string()){
+            ids.push_back(document["_id"].get<string>());
+        }
+        // Поля свёрток нужны, чтобы вычесть удаляемые документы из счётчиков
+        if(!rollups.empty() || !topk.empty()) documents.push_back(document);
+        return max_count == 0 || ordinals.get_size() < max_count;
+    };
+
+    Prefilter prefilter(filter, segment.get_encoding());
+    const Prefilter* bytes_filter = prefilter.empty() ? nullptr : &prefilter;
+    Vector<unsigned int> candidates;
+    if(pinned){
+        candidates.push_back(pinned->ordinal);
+        segment.for_each_at(candidates, visit, &fields, bytes_filter);
+    }else if(index_candidates(segment, filter.get_source(), candidates)){
+        segment.for_each_at(candidates, visit, &fields, bytes_filter);
+    }else{
+        segment.for_each(visit, &fields, 0, bytes_filter);
+    }
+}
+
+int Collection::apply_tombstones(unsigned int s, const Vector<unsigned int>& ordinals, const Vector<string>& ids,
+                                 const Vector<json>& documents){
+    if(ordinals.empty()) return 0;
+
+    Segment& segment = segments[s];
+    segment.mark_deleted(ordinals);
+    for(unsigned int i = 0; i < ids.get_size(); i++){
+        unindex_id(ids[i], segment.get_number());
+    }
+    for(unsigned int i = 0; i < documents.get_size(); i++){
+        update_summaries(documents[i], -1);
+    }
+    return (int)ordinals.get_size();
+}
+
+// Поля, достаточные для фильтра и проекции; false - нужен документ целиком
+bool Collection::read_fields(const Filter& filter, const json& projection, Vector<string>& fields){
+    if(!projection.is_array() || projection.empty()) return false;
+    filter.collect_fields(fields);
+    for(auto it = projection.begin(); it != projection.end(); ++it){
+        if(!it->is_string()) return false;
+        string field = it->get<string>();
+        bool seen = false;
+        for(unsigned int i = 0; i < fields.get_size(); i++){
+            if(fields[i] == field){ seen = true; break; }
+        }
+        if(!seen) fields.push_back(field);
+    }
+    return true;
+}
+
+// Подходящие документы одного сегмента с проекцией, не больше max_count (0 - все)
+void Collection::scan_segment(const Segment& segment, const Filter& filter, const json& projection,
+                              unsigned int max_count, Vector<json>& out) const{
+    try{
+        if(!segment.get_zones().may_match(filter.get_source(), zone_fields)) return;
+
+        if(segment.is_columnar()){
+            Vector<string> projection_fields;
+            for(auto it = projection.begin(); it != projection.end(); ++it){
+                if(it.value().is_string()) projection_fields.push_back(it.value().get<string>());
+            }
+
+            Vector<unsigned int> matched;
+            matching_ordinals(segment, filter, max_count, matched);
+            segment.for_each_at(matched, [&](unsigned int, const json& document){
+                out.push_back(project_document(document, projection));
+                return true;
+            }, projection.empty() ? nullptr : &projection_fields);
+            return;
+        }
+
+        auto visit = [&](unsigned int, const json& document){
+            if(!filter.matches(document)) return true;
+            out.push_back(project_document(document, projection));
+            return max_count == 0 || out.get_size() < max_count;
+        };
+
+        Vector<string> fields;
+        const Vector<string>* read = read_fields(filter, projection, fields) ? &fields : nullptr;
+        Prefilter prefilter(filter, segment.get_encoding());
+        const Prefilter* bytes_filter = prefilter.empty() ? nullptr : &prefilter;
+        Vector<unsigned int> candidates;
+        if(index_candidates(segment, filter.get_source(), candidates)){
+            segment.for_each_at(candidates, visit, read, bytes_filter);
+        }else{
+            segment.for_each(visit, read, 0, bytes_filter);
+        }
+    }catch(const exception&){
+    }
+}
+
+// Если фильтр фиксирует _id строкой, документ находится по индексу без сканирования.
+// pinned = true означает, что кандидат не больше одного; ref заполнен, если он есть.
+bool Collection::locate_by_id(const json& filter, DocRef& ref, bool& pinned) const{
+    pinned = false;
+    if(!filter.is_object() || !filter.contains("_id")) return false;
+
+    const json& condition = filter["_id"];
+    string id;
+    if(condition.is_string()){
+        id = condition.get<string>();
+    }else if(condition.is_object() && condition.size() == 1 &&
+             condition.contains("$eq") && condition["$eq"].is_string()){
+        id = condition["$eq"].get<string>();
+    }else{
+        return false;
+    }
+
+    pinned = true;
+    return id_index.try_get(id, ref);
+}
+
+void Collection::insert(const json& document) {
+    if (!document.contains("_id")) {
+        throw runtime_error("Документ должен содержать поле _id");
+    }
+    if(!document["_id"].is_string()){
+        throw runtime_error("Поле _id должно быть строкой");
+    }
+
+    string document_id = document["_id"].get<string>();
+
+    if (id_index.contains(document_id)) {
+        throw runtime_error("Документ с _id уже существует");
+    }
+
+    Segment& segment = get_insert_segment(document);
+    segment.append(document);
+    index_document(document, segment, segment.size() - 1);
+    update_summaries(document, 1);
 }
 
 void Collection::insert_many(const Vector<json>& documents) {
-    Vector<string> ids;
+    HashMap<string, bool> ids;
 
     for (unsigned int i = 0; i < documents.get_size(); i++) {
         const auto& doc = documents[i];
@@ -268,20 +1045,12 @@ void Collection::insert_many(const Vector<json>& documents) {
         }
         string doc_id = doc["_id"].get<string>();
 
-        bool found_duplicate = false;
-        for (unsigned int j = 0; j < ids.get_size(); j++) {
-            if (ids[j] == doc_id) {
-                found_duplicate = true;
-                break;
-            }
-        }
-        if (found_duplicate) {
+        if (ids.contains(doc_id)) {
             throw runtime_error("Найден дубликат _id в переданных документах");
         }
-        ids.push_back(doc_id);
+        ids.insert(doc_id, true);
 
-        auto existing = find_one({{"_id", doc_id}}, json::object(), json::object());
-        if (!existing.empty()) {
+        if (id_index.contains(doc_id)) {
             throw runtime_error("Документ с _id уже существует в базе");
         }
     }
@@ -291,221 +1060,570 @@ void Collection::insert_many(const Vector<json>& documents) {
     }
 }
 
+void Collection::sync() const{
+    for(unsigned int s = 0; s < segments.get_size(); s++){
+        segments[s].sync();
+    }
+    write_manifest();
+}
+
+// Перекодирует строковые сегменты, записанные в другом кодировании,
+// в кодирование из schema.json. Возвращает число перезаписанных сегментов.
+int Collection::convert_encoding(){
+    int converted = 0;
+    for(unsigned int s = 0; s < segments.get_size(); s++){
+        Segment& segment = segments[s];
+        if(segment.is_columnar() || segment.get_encoding() == get_encoding()) continue;
+
+        Vector<json> data;
+        segment.read_all(data);
+        segment.set_encoding(get_encoding());
+        rewrite_segment(s, data, data);
+        converted++;
+    }
+    return converted;
+}
+
 int Collection::update_many(const json& filter, const json& update_data){
-    int file_num = 1;
+    Filter compiled(filter);
     int updated_count = 0;
 
-    while(true){
-        string file_path = get_file_path(file_num);
-        if(!file_exists(file_path)) break;
+    DocRef ref;
+    bool pinned = false;
+    bool found = locate_by_id(filter, ref, pinned);
+    if(pinned && !found) return 0;
+
+    Vector<unsigned int> targets;
+    for(unsigned int s = 0; s < segments.get_size(); s++){
+        if(pinned && segments[s].get_number() != ref.segment) continue;
+        if(!segments[s].get_zones().may_match(filter, zone_fields)) continue;
+        Vector<unsigned int> candidates;
+        if(!pinned && index_candidates(segments[s], filter, candidates) && candidates.empty()) continue;
+        targets.push_back(s);
+    }
 
-        try{
-            ifstream file_in(file_path);
-            json data;
-            file_in >> data;
-            file_in.close();
-
-            if(!data.is_array()){
-                file_num++;
-                continue;
-            }
+    // Сегменты читаются и обновляются в памяти параллельно окнами по числу потоков,
+    // перезапись на диск и переиндексация идут последовательно
+    unsigned int width = ScanExecutor::shared().get_threads();
+    for(unsigned int base = 0; base < targets.get_size(); base += width){
+        unsigned int count = targets.get_size() - base < width ? targets.get_size() - base : width;
+
+        Vector<Vector<json>> old_data;
+        Vector<Vector<json>> new_data;
+        Vector<int> changed;
+        for(unsigned int i = 0; i < count; i++){
+            old_data.push_back(Vector<json>());
+            new_data.push_back(Vector<json>());
+            changed.push_back(0);
+        }
 
-            bool changes_made = false;
-            for(auto& document : data){
-                if(matches_filter(document, filter)){
-                    apply_update_operators(document, update_data);
-                    changes_made = true;
-                    updated_count++;
+        ScanExecutor::shared().run(count, [&](unsigned int i){
+            const Segment& segment = segments[targets[base + i]];
+            try{
+                if(segment.is_columnar()){
+                    Vector<unsigned int> matched;
+                    matching_ordinals(segment, compiled, 1, matched);
+                    if(matched.empty()) return;
                 }
+                segment.read_all(old_data[i]);
+                for(unsigned int d = 0; d < old_data[i].get_size(); d++){
+                    json document = old_data[i][d];
+                    if(compiled.matches(document)){
+                        apply_update_operators(document, update_data);
+                        changed[i]++;
+                    }
+                    new_data[i].push_back(document);
+                }
+            }catch(const exception&){
+                changed[i] = 0;
             }
-            if(changes_made){
-                ofstream file_out(file_path, ios::trunc);
-                file_out << data.dump(4, ' ', false, json::error_handler_t::replace);
-                file_out.close();
+        });
+
+        for(unsigned int i = 0; i < count; i++){
+            if(changed[i] == 0) continue;
+            try{
+                rewrite_segment(targets[base + i], old_data[i], new_data[i]);
+                updated_count += changed[i];
+            }catch(const exception&){
             }
-        }catch(const exception&){
         }
-        file_num++;
     }
 
     return updated_count;
 }
 
 int Collection::update_one(const json& filter, const json& update_data){
-    int file_num = 1;
-
-    while(true){
-        string file_path = get_file_path(file_num);
-        if(!file_exists(file_path)) break;
-
+    Filter compiled(filter);
+    DocRef ref;
+    bool pinned = false;
+    bool found = locate_by_id(filter, ref, pinned);
+    if(pinned && !found) return 0;
+
+    for(unsigned int s = 0; s < segments.get_size(); s++){
+        if(pinned && segments[s].get_number() != ref.segment) continue;
+        if(!segments[s].get_zones().may_match(filter, zone_fields)) continue;
+        Vector<unsigned int> candidates;
+        if(!pinned && index_candidates(segments[s], filter, candidates) && candidates.empty()) continue;
+        if(segments[s].is_columnar()){
+            Vector<unsigned int> matched;
+            matching_ordinals(segments[s], compiled, 1, matched);
+            if(matched.empty()) continue;
+        }
         try{
-            ifstream file_in(file_path);
-            json data;
-            file_in >> data;
-            file_in.close();
-
-            if(!data.is_array()){
-                file_num++;
-                continue;
-            }
-
-            for(auto& document : data){
-                if(matches_filter(document, filter)){
-                    apply_update_operators(document, update_data);
-
-                    ofstream file_out(file_path, ios::trunc);
-                    file_out << data.dump(4, ' ', false, json::error_handler_t::replace);
-                    file_out.close();
+            Vector<json> data;
+            Vector<unsigned int> ordinals;
+            segments[s].read_all(data, &ordinals);
+
+            for(unsigned int i = 0; i < data.get_size(); i++){
+                if(pinned && ordinals[i] != ref.ordinal) continue;
+                if(compiled.matches(data[i])){
+                    Vector<json> new_data = data;
+                    apply_update_operators(new_data[i], update_data);
+                    rewrite_segment(s, data, new_data);
                     return 1;
                 }
             }
         }catch(const exception&){
         }
-        file_num++;
     }
     return 0;
 }
 
 int Collection::delete_many(const json& filter){
-    int file_num = 1;
-    int deleted_count = 0;
-
-    while(true){
-        string file_path = get_file_path(file_num);
-        if(!file_exists(file_path)) break;
+    Filter compiled(filter);
+
+    DocRef ref;
+    bool pinned = false;
+    bool found = locate_by_id(filter, ref, pinned);
+    if(pinned && !found) return 0;
+
+    Vector<unsigned int> targets;
+    for(unsigned int s = 0; s < segments.get_size(); s++){
+        if(pinned && segments[s].get_number() != ref.segment) continue;
+        if(!segments[s].get_zones().may_match(filter, zone_fields)) continue;
+        targets.push_back(s);
+    }
 
+    // Поиск удаляемых записей идёт параллельно, пометка - последовательно:
+    // она меняет файлы N.del и общий индекс _id
+    Vector<Vector<unsigned int>> ordinals;
+    Vector<Vector<string>> ids;
+    Vector<Vector<json>> documents;
+    for(unsigned int t = 0; t < targets.get_size(); t++){
+        ordinals.push_back(Vector<unsigned int>());
+        ids.push_back(Vector<string>());
+        documents.push_back(Vector<json>());
+    }
+    ScanExecutor::shared().run(targets.get_size(), [&](unsigned int t){
         try{
-            ifstream file_in(file_path);
-            json data;
-            file_in >> data;
-            file_in.close();
-
-            if(!data.is_array()){
-                file_num++;
-                continue;
-            }
+            find_tombstones(segments[targets[t]], compiled, 0, pinned ? &ref : nullptr,
+                            ordinals[t], ids[t], documents[t]);
+        }catch(const exception&){
+            ordinals[t].clear();
+            ids[t].clear();
+            documents[t].clear();
+        }
+    });
 
-            json new_data = json::array();
-            bool changes_made = false;
-            for(auto& document : data){
-                if(matches_filter(document, filter)){
-                    changes_made = true;
-                    deleted_count++;
-                }else{
-                    new_data.push_back(document);
-                }
-            }
-            if(changes_made){
-                ofstream file_out(file_path, ios::trunc);
-                file_out << new_data.dump(4, ' ', false, json::error_handler_t::replace);
-                file_out.close();
-            }
+    int deleted_count = 0;
+    for(unsigned int t = 0; t < targets.get_size(); t++){
+        try{
+            deleted_count += apply_tombstones(targets[t], ordinals[t], ids[t], documents[t]);
         }catch(const exception&){
         }
-        file_num++;
     }
-
     return deleted_count;
 }
 
 int Collection::delete_one(const json& filter){
-    int file_num = 1;
+    Filter compiled(filter);
 
-    while(true){
-        string file_path = get_file_path(file_num);
-        if(!file_exists(file_path)) break;
+    DocRef ref;
+    bool pinned = false;
+    bool found = locate_by_id(filter, ref, pinned);
+    if(pinned && !found) return 0;
 
+    for(unsigned int s = 0; s < segments.get_size(); s++){
+        if(pinned && segments[s].get_number() != ref.segment) continue;
+        if(!segments[s].get_zones().may_match(filter, zone_fields)) continue;
         try{
-            ifstream file_in(file_path);
-            json data;
-            file_in >> data;
-            file_in.close();
-
-            if(!data.is_array()){
-                file_num++;
-                continue;
-            }
+            Vector<unsigned int> ordinals;
+            Vector<string> ids;
+            Vector<json> documents;
+            find_tombstones(segments[s], compiled, 1, pinned ? &ref : nullptr, ordinals, ids, documents);
+            if(apply_tombstones(s, ordinals, ids, documents) > 0) return 1;
+        }catch(const exception&){
+        }
+    }
+
+    return 0;
+}
+
+// Перезаписывает сегменты, в которых доля помеченных удалёнными записей
+// не меньше dead_ratio, но не больше max_segments за вызов, чтобы держать
+// блокировку недолго. Возвращает число перезаписанных сегментов.
+// Пока открыто потоковое чтение, компактация откладывается до следующего прохода
+int Collection::compact(double dead_ratio, int max_segments){
+    if(open_streams > 0) return 0;
+    int compacted = 0;
+    for(unsigned int s = 0; s < segments.get_size() && compacted < max_segments; s++){
+        Segment& segment = segments[s];
+        if(segment.dead_count() == 0) continue;
+        if((double)segment.dead_count() < dead_ratio * (double)segment.size()) continue;
+
+        Vector<json> data;
+        segment.read_all(data);
+        rewrite_segment(s, data, data);
+        compacted++;
+    }
+    return compacted;
+}
 
-            json new_data = json::array();
-            bool deleted = false;
-            for(auto& document : data){
-                if(!deleted && matches_filter(document, filter)){
-                    deleted = true;
-                }else{
-                    new_data.push_back(document);
+// Шаг удаления по сроку хранения: документы, у которых поле retention_field
+// старше now - retention_seconds, удаляются. Сегмент, в котором устарели все
+// записи, удаляется с диска целиком, без чтения и перезаписи; из него читаются
+// только _id и поля свёрток, чтобы убрать его из общего индекса и счётчиков.
+// В сегменте на границе срока устаревшие записи помечаются в N.del, как при
+// delete_many, и исчезают при компактации. Последний сегмент, куда идёт
+// вставка, целиком не удаляется, как и любой сегмент, пока открыто потоковое
+// чтение. Обрабатывает не больше max_segments
+// сегментов; возвращает, сколько обработано.
+int Collection::expire(long long now, int max_segments){
+    if(options.retention_field.empty() || options.retention_seconds <= 0) return 0;
+    long long cutoff = now - options.retention_seconds;
+
+    Vector<string> fields;
+    fields.push_back("_id");
+    fields.push_back(options.retention_field);
+    for(unsigned int r = 0; r < rollups.get_size(); r++) rollups[r].collect_fields(fields);
+    for(unsigned int t = 0; t < topk.get_size(); t++) topk[t].collect_fields(fields);
+
+    bool summaries = (rollups_ready && !rollups.empty()) || (topk_ready && !topk.empty());
+
+    int processed = 0;
+    for(unsigned int s = 0; s < segments.get_size() && processed < max_segments; s++){
+        Segment& segment = segments[s];
+        long long lo = 0;
+        long long hi = 0;
+        unsigned int known = 0;
+        if(!segment.get_zones().time_range(lo, hi, known) || lo >= cutoff) continue;
+
+        // Границы времени оставшихся записей и их _id (для файла индексов)
+        Vector<unsigned int> ordinals;
+        Vector<string> ids;
+        Vector<json> documents;
+        json kept_ids = json::array();
+        for(unsigned int i = 0; i < segment.size(); i++) kept_ids.push_back(nullptr);
+        long long kept_lo = 0;
+        long long kept_hi = 0;
+        unsigned int kept = 0;
+        segment.for_each([&](unsigned int ordinal, const json& document){
+            long long seconds = 0;
+            auto it = document.find(options.retention_field);
+            bool timed = it != document.end() && DateHistogram::parse_timestamp(*it, seconds);
+            auto id = document.find("_id");
+            bool has_id = id != document.end() && id->is_string();
+
+            if(!timed || seconds >= cutoff){
+                if(has_id) kept_ids[ordinal] = *id;
+                if(timed){
+                    if(kept == 0 || seconds < kept_lo) kept_lo = seconds;
+                    if(kept == 0 || seconds > kept_hi) kept_hi = seconds;
+                    kept++;
                 }
+                return true;
             }
-            if(deleted){
-                ofstream file_out(file_path, ios::trunc);
-                file_out << new_data.dump(4, ' ', false, json::error_handler_t::replace);
-                file_out.close();
-                return 1;
+            ordinals.push_back(ordinal);
+            if(has_id) ids.push_back(id->get<string>());
+            if(summaries) documents.push_back(document);
+            return true;
+        }, &fields);
+
+        bool whole = open_streams == 0 && s + 1 < segments.get_size() &&
+                     ordinals.get_size() == segment.live_size();
+        if(whole){
+            int number = segment.get_number();
+            for(unsigned int i = 0; i < ids.get_size(); i++) unindex_id(ids[i], number);
+            for(unsigned int i = 0; i < documents.get_size(); i++) update_summaries(documents[i], -1);
+
+            Segment dropped = segment;
+            Vector<Segment> rest;
+            for(unsigned int i = 0; i < segments.get_size(); i++){
+                if(i != s) rest.push_back(segments[i]);
             }
-        }catch(const exception&){
+            segments = rest;
+            layout_version++;
+            // Манифест без сегмента записывается до удаления файлов: после
+            // сбоя между ними сегмента уже нет в описи коллекции
+            write_manifest();
+            dropped.remove_files();
+            s--;
+            processed++;
+            continue;
+        }
+
+        // Время сегмента сужается до оставшихся записей, чтобы следующие
+        // проходы не перечитывали его, пока новые записи не устареют
+        bool changed = apply_tombstones(s, ordinals, ids, documents) > 0;
+        segment.get_zones().set_time(kept_lo, kept_hi, kept);
+        if(s + 1 < segments.get_size()) save_segment_indexes(segment, &kept_ids);
+        if(changed){
+            write_manifest();
+            processed++;
         }
-        file_num++;
     }
+    return processed;
+}
 
-    return 0;
+json Collection::project(const json& document, const json& projection){
+    return project_document(document, projection);
+}
+
+Cursor Collection::find_cursor(const json& filter, const json& projection, int limit, unsigned int batch_size) const{
+    return Cursor(this, filter, projection, limit, batch_size);
 }
 
 Vector<json> Collection::find(const json& filter, const json& projection, const json& sort, int limit) const{
     Vector<json> results;
-    int file_num = 1;
+    Vector<json> batch;
 
-    while (true) {
-        string file_path = get_file_path(file_num);
-        if (!file_exists(file_path)) break;
-
-        try {
-            ifstream file(file_path);
-            if (!file.is_open()) { file_num++; continue; }
-
-            json data;
-            file >> data;
-
-            if (!data.is_array()) { file_num++; continue; }
-
-            for (const auto& document : data) {
-                if (matches_filter(document, filter)) {
-                    json projected_doc;
-                    if (projection.empty()) {
-                        projected_doc = document;
-                    } else {
-                        for (auto it = projection.begin(); it != projection.end(); ++it) {
-                            string field_name = it.value();
-                            if (document.contains(field_name)) {
-                                projected_doc[field_name] = document[field_name];
-                            }
-                        }
-                    }
-                    results.push_back(projected_doc);
+    if(sort.empty()){
+        Cursor cursor = find_cursor(filter, projection, limit);
+        while(cursor.next_batch(batch)){
+            for(unsigned int i = 0; i < batch.get_size(); i++){
+                results.push_back(batch[i]);
+            }
+        }
+        return results;
+    }
 
-                    if (limit > 0 && results.get_size() >= (unsigned int)limit) {
-                        return results;
-                    }
-                }
+    find_sorted(filter, projection, sort, limit, [&](const json& document){
+        results.push_back(document);
+        return true;
+    });
+    return results;
+}
+
+// Limit применяется к уже упорядоченному результату: с limit в памяти держится
+// куча из limit документов, без него большой результат сортируется через диск
+void Collection::find_sorted(const json& filter, const json& projection, const json& sort, int limit,
+                             const function<bool(const json&)>& emit) const{
+    Sorter sorter(sort, limit > 0 ? (unsigned int)limit : 0, get_sort_dir());
+    Cursor cursor = find_cursor(filter, projection, 0);
+    Vector<json> batch;
+    while(cursor.next_batch(batch)){
+        for(unsigned int i = 0; i < batch.get_size(); i++){
+            sorter.add(batch[i]);
+        }
+    }
+    sorter.finish(emit);
+}
+
+Vector<json> Collection::aggregate(const json& pipeline) const{
+    Aggregation aggregation(pipeline);
+    Vector<json> rows;
+    aggregation.run(*this, rows);
+    return rows;
+}
+
+json Collection::date_histogram(const json& filter, const json& spec) const{
+    DateHistogram histogram(spec);
+
+    // Без фильтра ответ берётся из свёртки с наименьшим числом ячеек
+    if(filter.is_null() || (filter.is_object() && filter.empty())){
+        const Rollup* best = nullptr;
+        for(unsigned int r = 0; r < rollups.get_size(); r++){
+            if(!rollups[r].can_answer(histogram)) continue;
+            build_summaries();
+            if(!best || rollups[r].size() < best->size()) best = &rollups[r];
+        }
+        if(best){
+            best->answer(histogram);
+            return histogram.finish();
+        }
+    }
+
+    // Границы массива интервалов - по минимумам и максимумам поля в сегментах
+    json lo, hi;
+    bool found = false;
+    for(unsigned int s = 0; s < segments.get_size(); s++){
+        json seg_lo, seg_hi;
+        if(!segments[s].get_zones().range(histogram.get_field(), seg_lo, seg_hi)) continue;
+        if(!found || seg_lo < lo) lo = seg_lo;
+        if(!found || hi < seg_hi) hi = seg_hi;
+        found = true;
+    }
+    if(found) histogram.reserve(lo, hi);
+
+    Vector<string> fields;
+    histogram.collect_fields(fields);
+    json projection = json::array();
+    for(unsigned int i = 0; i < fields.get_size(); i++) projection.push_back(fields[i]);
+
+    Cursor cursor = find_cursor(filter, projection, 0);
+    Vector<json> batch;
+    while(cursor.next_batch(batch)){
+        for(unsigned int i = 0; i < batch.get_size(); i++) histogram.add(batch[i]);
+    }
+    return histogram.finish();
+}
+
+// Сегмент, целиком подходящий под фильтр (фильтра нет или он задаёт диапазон,
+// в который попадают минимум и максимум зоны), без удалённых записей отдаёт
+// готовый скетч; остальные сегменты читаются по полю field параллельно
+HyperLogLog Collection::approx_distinct(const json& filter, const string& field) const{
+    Filter compiled(filter);
+    const json& source = compiled.get_source();
+    bool sketched = contains_name(options.distinct_fields, field);
+
+    HyperLogLog result;
+    Vector<unsigned int> targets;
+    for(unsigned int s = 0; s < segments.get_size(); s++){
+        const Segment& segment = segments[s];
+        if(!segment.get_zones().may_match(source, zone_fields)) continue;
+        if(sketched && segment.dead_count() == 0 &&
+           (source.empty() || segment.get_zones().covers(source, zone_fields, segment.size()))){
+            const HyperLogLog* sketch = segment.get_distinct().get(field);
+            if(sketch) result.merge(*sketch);
+            continue;
+        }
+        targets.push_back(s);
+    }
+
+    json projection = json::array();
+    projection.push_back(field);
+    Vector<HyperLogLog> partial;
+    for(unsigned int t = 0; t < targets.get_size(); t++) partial.push_back(HyperLogLog());
+    ScanExecutor::shared().run(targets.get_size(), [&](unsigned int t){
+        try{
+            Vector<json> documents;
+            scan_segment(segments[targets[t]], compiled, projection, 0, documents);
+            for(unsigned int i = 0; i < documents.get_size(); i++){
+                auto it = documents[i].find(field);
+                if(it != documents[i].end() && !it->is_null()) partial[t].add(*it);
             }
+        }catch(const exception&){
+        }
+    });
+    for(unsigned int t = 0; t < partial.get_size(); t++) result.merge(partial[t]);
+    return result;
+}
 
-        } catch (const exception&) {
+// Без подходящего скетча значения считаются точно хешем по одному полю
+json Collection::top_values(const json& filter, const string& field, unsigned int k) const{
+    Vector<TopKCounter> counters;
+    const TopKSketch* sketch = nullptr;
+    for(unsigned int t = 0; t < topk.get_size(); t++){
+        if(topk[t].can_answer(field, filter, k)){
+            build_summaries();
+            sketch = &topk[t];
+            break;
         }
+    }
 
-        file_num++;
+    json result = json::array();
+    if(sketch){
+        sketch->top(k, counters);
+        for(unsigned int i = 0; i < counters.get_size(); i++){
+            result.push_back({{"value", counters[i].value}, {"count", counters[i].count},
+                              {"error", counters[i].error}});
+        }
+        return result;
     }
 
-    if (!sort.empty() && results.get_size() > 0) {
-        for (unsigned int i = 0; i < results.get_size() - 1; i++) {
-            for (unsigned int j = 0; j < results.get_size() - i - 1; j++) {
-                if (!compare_documents(results[j], results[j + 1], sort)) {
-                    json temp = results[j];
-                    results[j] = results[j + 1];
-                    results[j + 1] = temp;
-                }
+    HashMap<string, unsigned int> index;
+    Vector<json> values;
+    Vector<long long> counts;
+    json projection = json::array();
+    projection.push_back(field);
+
+    Cursor cursor = find_cursor(filter, projection, 0);
+    Vector<json> batch;
+    while(cursor.next_batch(batch)){
+        for(unsigned int i = 0; i < batch.get_size(); i++){
+            auto it = batch[i].find(field);
+            if(it == batch[i].end() || it->is_null()) continue;
+            string key = SecondaryIndex::make_key(*it);
+            unsigned int v = 0;
+            if(!index.try_get(key, v)){
+                v = values.get_size();
+                index.insert(key, v);
+                values.push_back(*it);
+                counts.push_back(0);
             }
+            counts[v]++;
         }
     }
 
-    return results;
+    Sorter sorter(json({{"count", -1}}), k, get_sort_dir());
+    for(unsigned int v = 0; v < values.get_size(); v++){
+        sorter.add({{"value", values[v]}, {"count", counts[v]}, {"error", 0}});
+    }
+    sorter.finish([&](const json& row){
+        result.push_back(row);
+        return true;
+    });
+    return result;
+}
+
+// Без фильтра и для сегментов, целиком попадающих в диапазон по зонам, число
+// берётся из размеров сегментов, для равенств по индексированным полям - из
+// индекса. Остальные сегменты сканируются параллельно только по полям фильтра.
+long long Collection::count(const json& filter) const{
+    Filter compiled(filter);
+    const json& source = compiled.get_source();
+
+    DocRef ref;
+    bool pinned = false;
+    bool found = locate_by_id(source, ref, pinned);
+    if(pinned){
+        if(!found) return 0;
+        if(source.size() == 1) return 1;
+        json projection = json::array();
+        projection.push_back("_id");
+        Cursor cursor = find_cursor(source, projection, 1);
+        Vector<json> batch;
+        return cursor.next_batch(batch) ? 1 : 0;
+    }
+
+    bool indexed = index_exact(source);
+    long long total = 0;
+    Vector<unsigned int> targets;
+    for(unsigned int s = 0; s < segments.get_size(); s++){
+        const Segment& segment = segments[s];
+        if(source.empty()){
+            total += segment.size() - segment.dead_count();
+            continue;
+        }
+        if(!segment.get_zones().may_match(source, zone_fields)) continue;
+        if(segment.dead_count() == 0 && segment.get_zones().covers(source, zone_fields, segment.size())){
+            total += segment.size();
+            continue;
+        }
+        if(indexed){
+            Vector<unsigned int> candidates;
+            index_candidates(segment, source, candidates);
+            for(unsigned int i = 0; i < candidates.get_size(); i++){
+                if(!segment.is_deleted(candidates[i])) total++;
+            }
+            continue;
+        }
+        targets.push_back(s);
+    }
+
+    Vector<long long> counts;
+    for(unsigned int t = 0; t < targets.get_size(); t++) counts.push_back(0);
+    ScanExecutor::shared().run(targets.get_size(), [&](unsigned int t){
+        try{
+            Vector<unsigned int> ordinals;
+            matching_ordinals(segments[targets[t]], compiled, 0, ordinals);
+            counts[t] = ordinals.get_size();
+        }catch(const exception&){
+            counts[t] = 0;
+        }
+    });
+    for(unsigned int t = 0; t < counts.get_size(); t++) total += counts[t];
+    return total;
 }
 
 json Collection::find_one(const json& filter, const json& projection, const json& sort) const {
@@ -514,4 +1632,4 @@ json Collection::find_one(const json& filter, const json& projection, const json
         return results[0];
     }
     return json();
-}
+}
\ No newline at end of file
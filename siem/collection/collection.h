@@ -2,30 +2,111 @@
 #include <string>
 #include <fstream>
 #include <iostream>
+#include <functional>
 #include "../containers/vector.h"
 #include "../containers/hash_map.h"
 #include "../include/json.hpp"
+#include "../schema/schema.h"
+#include "segment.h"
+#include "cursor.h"
+#include "filter.h"
+#include "rollup.h"
+#include "top_k.h"
 
 using namespace std;
 using json = nlohmann::json;
 
+// Положение документа: номер сегмента, порядковый номер записи и смещение в файле
+struct DocRef {
+    int segment;
+    unsigned int ordinal;
+    long long offset;
+
+    DocRef() : segment(0), ordinal(0), offset(0) {}
+    DocRef(int segment, unsigned int ordinal, long long offset)
+        : segment(segment), ordinal(ordinal), offset(offset) {}
+};
+
 class Collection {
+    friend class Cursor;
+
 private:
     string name;
     string db_path;
     int tuples_limit;
     json structure;
+    CollectionOptions options;
+    Vector<string> zone_fields;
+    Vector<Segment> segments;
+    HashMap<string, DocRef> id_index;
+    // Свёртки и скетчи строятся при первом запросе, которому они нужны
+    // (build_summaries), чтобы открытие коллекции не читало все записи;
+    // скетчи строятся заново и после удаления подсчитанного документа
+    mutable Vector<Rollup> rollups;
+    mutable Vector<TopKSketch> topk;
+    mutable bool rollups_ready;
+    mutable bool topk_ready;
+    // Версия раскладки: меняется, когда у документов меняются номера записей
+    // или позиции сегментов (перезапись, запечатывание с выбросом удалённых,
+    // удаление сегмента). Курсор по ней узнаёт, что его позиция устарела.
+    unsigned long long layout_version;
+    // Число потоковых чтений, отпускающих блокировку между пачками (см. Cursor);
+    // пока они открыты, фоновые задачи сегменты не перестраивают
+    mutable unsigned int open_streams;
 
     string get_file_path(int file_num) const;
+    string get_legacy_file_path(int file_num) const;
+    string get_column_file_path(int file_num) const;
+    string get_sort_dir() const;
+    SegmentEncoding get_encoding() const;
     bool file_exists(const string& path) const;
     void create_directory(const string& path) const;
-    int get_last_file_number() const;
-    int count_documents_in_file(const string& file_path) const;
+    void migrate_legacy_files();
+    void open_segments();
+    bool load_manifest();
+    string resolve_segment_path(int file_num);
+    int last_file_number() const;
+    Segment& get_insert_segment(const json& document);
+    void seal_segment(Segment& segment);
+    string partition_key(const json& document) const;
+    string get_manifest_path() const;
+    void write_manifest() const;
+
+    int find_segment_index(int number) const;
+    bool locate_by_id(const json& filter, DocRef& ref, bool& pinned) const;
+    bool index_candidates(const Segment& segment, const json& filter, Vector<unsigned int>& out) const;
+    bool index_exact(const json& filter) const;
+    bool text_candidates(const Segment& segment, const string& field, const json& operand,
+                         Vector<unsigned int>& out) const;
+    bool any_substring_candidates(const Segment& segment, const string& field, const json& condition,
+                                  Vector<unsigned int>& out) const;
+    void matching_ordinals(const Segment& segment, const Filter& filter, unsigned int max_count,
+                           Vector<unsigned int>& out) const;
+    void build_indexes();
+    json index_config() const;
+    // known_ids - уже прочитанные _id по номерам записей
+    void save_segment_indexes(const Segment& segment, const json* known_ids = nullptr) const;
+    void build_summaries() const;
+    void index_document(const json& document, Segment& segment, unsigned int ordinal);
+    void unindex_document(const json& document, int segment_number);
+    void unindex_id(const string& id, int segment_number);
+    void find_tombstones(const Segment& segment, const Filter& filter, unsigned int max_count,
+                         const DocRef* pinned, Vector<unsigned int>& ordinals, Vector<string>& ids,
+                         Vector<json>& documents) const;
+    int apply_tombstones(unsigned int s, const Vector<unsigned int>& ordinals, const Vector<string>& ids,
+                         const Vector<json>& documents);
+    void update_summaries(const json& document, long long delta);
+    static bool read_fields(const Filter& filter, const json& projection, Vector<string>& fields);
+    void scan_segment(const Segment& segment, const Filter& filter, const json& projection,
+                      unsigned int max_count, Vector<json>& out) const;
+    void rewrite_segment(unsigned int s, const Vector<json>& old_documents, const Vector<json>& new_documents);
 
 public:
-    Collection() : name(""), db_path(""), tuples_limit(0), structure(json::object()) {}
+    Collection() : name(""), db_path(""), tuples_limit(0), structure(json::object()),
+                   rollups_ready(true), topk_ready(true), layout_version(0), open_streams(0) {}
     Collection(const string& name, const string& db_path,
-               int tuples_limit, const json& structure);
+               int tuples_limit, const json& structure,
+               const CollectionOptions& options = CollectionOptions());
 
     void insert(const json& document);
     void insert_many(const Vector<json>& documents);
@@ -35,39 +116,77 @@ public:
                       const json& sort = json::object(),
                       int limit = 0) const;
 
+    // Ленивый вариант find без сортировки: документы выдаются пачками по batch_size
+    Cursor find_cursor(const json& filter = json::object(),
+                       const json& projection = json::object(),
+                       int limit = 0, unsigned int batch_size = 256) const;
+
+    // find с сортировкой, выдающий документы по одному без накопления результата
+    void find_sorted(const json& filter, const json& projection, const json& sort, int limit,
+                     const function<bool(const json&)>& emit) const;
+
+    // Конвейер aggregate ($match, $group, $sort, $limit), см. Aggregation
+    Vector<json> aggregate(const json& pipeline) const;
+
+    // Число документов filter по интервалам времени, см. DateHistogram
+    json date_histogram(const json& filter, const json& spec) const;
+
+    // Скетч различных непустых значений field среди документов filter
+    HyperLogLog approx_distinct(const json& filter, const string& field) const;
+
+    // k самых частых значений field среди документов filter:
+    // [{"value": ..., "count": n, "error": e}], см. TopKSketch
+    json top_values(const json& filter, const string& field, unsigned int k) const;
+
+    // Число документов filter; документы при подсчёте не строятся
+    long long count(const json& filter) const;
+
+    static json project(const json& document, const json& projection);
+
     json find_one(const json& filter, const json& projection, const json& sort) const;
 
     int update_one(const json& filter, const json& update_data);
     int update_many(const json& filter, const json& update_data);
     int delete_one(const json& filter);
     int delete_many(const json& filter);
+    int compact(double dead_ratio, int max_segments);
+    // Запечатывает не больше max_segments сегментов, в которые больше не вставляют
+    int seal_segments(int max_segments);
+    // Удаление документов старше срока хранения из schema.json (retention)
+    // на момент now (секунды Unix), см. определение
+    int expire(long long now, int max_segments);
+
+    void sync() const;
+    int convert_encoding();
+
+    unsigned long long get_layout_version() const { return layout_version; }
+    void open_stream() const { open_streams++; }
+    void close_stream() const { if(open_streams > 0) open_streams--; }
 
+    bool contains_id(const string& id) const { return id_index.contains(id); }
     string get_name() const { return name; }
 
     Vector<string> get_file_info() const {
         Vector<string> files;
-        int file_num = 1;
-        while(file_exists(get_file_path(file_num))){
-            files.push_back(get_file_path(file_num));
-            file_num++;
+        for(unsigned int i = 0; i < segments.get_size(); i++){
+            files.push_back(segments[i].get_path());
         }
         return files;
     }
 
     void print_file_contents() {
-        int file_num = 1;
-        while(file_exists(get_file_path(file_num))){
-            cout << "Файл " << get_file_path(file_num) << ":" << endl;
+        for(unsigned int i = 0; i < segments.get_size(); i++){
+            cout << "Файл " << segments[i].get_path() << ":" << endl;
             try {
-                ifstream file(get_file_path(file_num));
-                json data;
-                file >> data;
+                json data = json::array();
+                segments[i].for_each([&](unsigned int, const json& document){
+                    data.push_back(document);
+                    return true;
+                });
                 cout << data.dump(2, ' ', false, json::error_handler_t::replace) << endl;
-                file.close();
             } catch(const exception& e) {
                 cout << "Ошибка чтения файла: " << e.what() << endl;
             }
-            file_num++;
         }
     }
 };
@@ -0,0 +1,364 @@
+#include "column_file.h"
+#include "../containers/hash_map.h"
+#include <fstream>
+#include <stdexcept>
+
+using namespace std;
+using json = nlohmann::json;
+
+const char* ColumnFile::EXTRA_COLUMN = "_extra";
+
+static const char COLUMN_MAGIC[4] = {'S', 'C', 'O', 'L'};
+static const unsigned char COLUMN_VERSION = 1;
+static const unsigned char KIND_PLAIN = 0;
+static const unsigned char KIND_DICT = 1;
+static const unsigned int DICT_MAX_VALUES = 1024;
+
+static void put_uint(string& out, unsigned long long v, int width){
+    for(int i = 0; i < width; i++){
+        out.push_back((char)((v >> (8 * i)) & 0xFF));
+    }
+}
+
+static unsigned long long get_uint(const string& buf, size_t pos, int width){
+    unsigned long long v = 0;
+    for(int i = 0; i < width; i++){
+        v |= (unsigned long long)(unsigned char)buf[pos + i] << (8 * i);
+    }
+    return v;
+}
+
+static bool read_exact(istream& in, string& buf, size_t n){
+    buf.resize(n);
+    if(n == 0) return true;
+    return (bool)in.read(&buf[0], (streamsize)n);
+}
+
+static unsigned long long missing_code(int width){
+    return width == 1 ? 0xFFULL : width == 2 ? 0xFFFFULL : 0xFFFFFFFFULL;
+}
+
+static bool column_value(const json& document, const string& name, const Vector<string>& names, json& out){
+    if(name != ColumnFile::EXTRA_COLUMN){
+        if(!document.contains(name)) return false;
+        out = document[name];
+        return true;
+    }
+
+    json extra = json::object();
+    for(auto it = document.begin(); it != document.end(); ++it){
+        bool declared = false;
+        for(unsigned int i = 0; i < names.get_size(); i++){
+            if(names[i] == it.key()){ declared = true; break; }
+        }
+        if(!declared) extra[it.key()] = it.value();
+    }
+    if(extra.empty()) return false;
+    out = extra;
+    return true;
+}
+
+// Значения в наборе строк: смещения (rows + 1) и склеенные тексты значений
+static void encode_texts(string& block, const Vector<string>& texts){
+    unsigned long long pos = 0;
+    for(unsigned int i = 0; i < texts.get_size(); i++){
+        put_uint(block, pos, 4);
+        pos += texts[i].size();
+        if(pos > 0xFFFFFFFFULL){
+            throw runtime_error("Колонка колоночного сегмента больше 4 ГБ");
+        }
+    }
+    put_uint(block, pos, 4);
+    for(unsigned int i = 0; i < texts.get_size(); i++){
+        block += texts[i];
+    }
+}
+
+static string encode_column(const string& name, const Vector<string>& names,
+                            const Vector<json>& documents, unsigned char& kind){
+    unsigned int rows = documents.get_size();
+    Vector<string> texts;
+    HashMap<string, unsigned int> dict;
+    Vector<string> dict_texts;
+    bool dictionary = rows >= 8;
+
+    for(unsigned int r = 0; r < rows; r++){
+        json value;
+        string text;
+        if(column_value(documents[r], name, names, value)){
+            text = value.dump(-1, ' ', false, json::error_handler_t::replace);
+        }
+        texts.push_back(text);
+
+        if(dictionary && !text.empty() && !dict.contains(text)){
+            dict.insert(text, dict_texts.get_size());
+            dict_texts.push_back(text);
+            if(dict_texts.get_size() > DICT_MAX_VALUES || dict_texts.get_size() * 4 > rows){
+                dictionary = false;
+            }
+        }
+    }
+
+    string block;
+    if(!dictionary){
+        kind = KIND_PLAIN;
+        encode_texts(block, texts);
+        return block;
+    }
+
+    kind = KIND_DICT;
+    int width = dict_texts.get_size() < 0xFF ? 1 : dict_texts.get_size() < 0xFFFF ? 2 : 4;
+    put_uint(block, dict_texts.get_size(), 4);
+    put_uint(block, (unsigned long long)width, 1);
+    encode_texts(block, dict_texts);
+    for(unsigned int r = 0; r < rows; r++){
+        unsigned int code = 0;
+        if(texts[r].empty() || !dict.try_get(texts[r], code)){
+            put_uint(block, missing_code(width), width);
+        }else{
+            put_uint(block, code, width);
+        }
+    }
+    return block;
+}
+
+void ColumnFile::write(const string& path, const Vector<string>& names, const Vector<json>& documents){
+    Vector<string> all_names = names;
+    all_names.push_back(EXTRA_COLUMN);
+
+    string header;
+    header.append(COLUMN_MAGIC, 4);
+    put_uint(header, COLUMN_VERSION, 1);
+    put_uint(header, documents.get_size(), 4);
+    put_uint(header, all_names.get_size(), 4);
+
+    unsigned long long directory_size = 0;
+    for(unsigned int i = 0; i < all_names.get_size(); i++){
+        directory_size += 2 + all_names[i].size() + 1 + 8 + 8;
+    }
+
+    ofstream out(path, ios::binary | ios::trunc);
+    if(!out.is_open()){
+        throw runtime_error("Не удалось создать колоночный сегмент " + path);
+    }
+    out.write(header.data(), (streamsize)header.size());
+    out.write(string(directory_size, '\0').data(), (streamsize)directory_size);
+
+    unsigned long long pos = header.size() + directory_size;
+    string directory;
+    for(unsigned int i = 0; i < all_names.get_size(); i++){
+        unsigned char kind = KIND_PLAIN;
+        string block = encode_column(all_names[i], names, documents, kind);
+        out.write(block.data(), (streamsize)block.size());
+
+        put_uint(directory, all_names[i].size(), 2);
+        directory += all_names[i];
+        put_uint(directory, kind, 1);
+        put_uint(directory, pos, 8);
+        put_uint(directory, block.size(), 8);
+        pos += block.size();
+    }
+
+    out.seekp((streamoff)header.size());
+    out.write(directory.data(), (streamsize)directory.size());
+    out.close();
+    if(!out){
+        throw runtime_error("Ошибка записи колоночного сегмента " + path);
+    }
+}
+
+void ColumnFile::open(const string& file_path){
+    path = file_path;
+    columns.clear();
+    rows = 0;
+
+    ifstream in(path, ios::binary);
+    if(!in.is_open()){
+        throw runtime_error("Не удалось открыть колоночный сегмент " + path);
+    }
+
+    string buf;
+    if(!read_exact(in, buf, 13) || buf.compare(0, 4, string(COLUMN_MAGIC, 4)) != 0){
+        throw runtime_error("Файл " + path + " не является колоночным сегментом");
+    }
+    if((unsigned char)buf[4] != COLUMN_VERSION){
+        throw runtime_error("Неизвестная версия колоночного сегмента " + path);
+    }
+    rows = (unsigned int)get_uint(buf, 5, 4);
+    unsigned int count = (unsigned int)get_uint(buf, 9, 4);
+
+    for(unsigned int i = 0; i < count; i++){
+        ColumnInfo info;
+        if(!read_exact(in, buf, 2)) throw runtime_error("Повреждён каталог колонок " + path);
+        size_t name_len = (size_t)get_uint(buf, 0, 2);
+        if(!read_exact(in, info.name, name_len) || !read_exact(in, buf, 17)){
+            throw runtime_error("Повреждён каталог колонок " + path);
+        }
+        info.kind = (unsigned char)buf[0];
+        info.offset = get_uint(buf, 1, 8);
+        info.length = get_uint(buf, 9, 8);
+        columns.push_back(info);
+    }
+}
+
+int ColumnFile::find_column(const string& name) const{
+    for(unsigned int i = 0; i < columns.get_size(); i++){
+        if(columns[i].name == name) return (int)i;
+    }
+    return -1;
+}
+
+Vector<string> ColumnFile::get_column_names() const{
+    Vector<string> names;
+    for(unsigned int i = 0; i < columns.get_size(); i++){
+        if(columns[i].name != EXTRA_COLUMN) names.push_back(columns[i].name);
+    }
+    return names;
+}
+
+static json parse_text(const string& block, size_t begin, size_t end){
+    if(end <= begin) return json(json::value_t::discarded);
+    try{
+        return json::parse(block.begin() + (long)begin, block.begin() + (long)end);
+    }catch(const exception&){
+        return json(json::value_t::discarded);
+    }
+}
+
+void ColumnFile::read_column(const string& name, Vector<json>& values) const{
+    read_rows(name, 0, rows, values);
+}
+
+// Читаются только байты строк [first, first + count): срез таблицы смещений
+// и данных (или кодов словаря вместе со словарём)
+void ColumnFile::read_rows(const string& name, unsigned int first, unsigned int count,
+                           Vector<json>& values) const{
+    values.clear();
+    if(first >= rows) return;
+    if(count > rows - first) count = rows - first;
+
+    int c = find_column(name);
+    if(c < 0){
+        for(unsigned int r = 0; r < count; r++) values.push_back(json(json::value_t::discarded));
+        return;
+    }
+
+    const ColumnInfo& info = columns[c];
+    ifstream in(path, ios::binary);
+    auto read_at = [&](unsigned long long offset, size_t length, string& out){
+        in.seekg((streamoff)(info.offset + offset));
+        if(!read_exact(in, out, length)){
+            throw runtime_error("Не удалось прочитать колонку " + name + " из " + path);
+        }
+    };
+
+    if(info.kind == KIND_PLAIN){
+        string table;
+        read_at((unsigned long long)first * 4, (size_t)(count + 1) * 4, table);
+        unsigned long long base = get_uint(table, 0, 4);
+        unsigned long long last = get_uint(table, (size_t)count * 4, 4);
+        string block;
+        if(last > base) read_at((unsigned long long)(rows + 1) * 4 + base, (size_t)(last - base), block);
+        for(unsigned int r = 0; r < count; r++){
+            size_t begin = (size_t)(get_uint(table, (size_t)r * 4, 4) - base);
+            size_t end = (size_t)(get_uint(table, (size_t)(r + 1) * 4, 4) - base);
+            values.push_back(parse_text(block, begin, end));
+        }
+        return;
+    }
+
+    string header;
+    read_at(0, 5, header);
+    unsigned int dict_count = (unsigned int)get_uint(header, 0, 4);
+    int width = (int)get_uint(header, 4, 1);
+    unsigned long long dict_offsets = 5;
+    unsigned long long dict_data = dict_offsets + (unsigned long long)(dict_count + 1) * 4;
+
+    string table;
+    read_at(dict_offsets, (size_t)(dict_count + 1) * 4, table);
+    size_t dict_bytes = (size_t)get_uint(table, (size_t)dict_count * 4, 4);
+    string block;
+    if(dict_bytes > 0) read_at(dict_data, dict_bytes, block);
+
+    // Разбираются только значения словаря, встретившиеся в этих строках
+    Vector<json> dict;
+    Vector<bool> parsed;
+    for(unsigned int d = 0; d < dict_count; d++){
+        dict.push_back(json());
+        parsed.push_back(false);
+    }
+
+    string codes;
+    read_at(dict_data + dict_bytes + (unsigned long long)first * width, (size_t)count * width, codes);
+    for(unsigned int r = 0; r < count; r++){
+        unsigned long long code = get_uint(codes, (size_t)r * width, width);
+        if(code == missing_code(width) || code >= dict_count){
+            values.push_back(json(json::value_t::discarded));
+            continue;
+        }
+        unsigned int d = (unsigned int)code;
+        if(!parsed[d]){
+            size_t begin = (size_t)get_uint(table, (size_t)d * 4, 4);
+            size_t end = (size_t)get_uint(table, (size_t)(d + 1) * 4, 4);
+            dict[d] = parse_text(block, begin, end);
+            parsed[d] = true;
+        }
+        values.push_back(dict[d]);
+    }
+}
+
+json ColumnFile::read_value(const string& name, unsigned int row) const{
+    int c = find_column(name);
+    if(c < 0 || row >= rows) return json(json::value_t::discarded);
+
+    const ColumnInfo& info = columns[c];
+    ifstream in(path, ios::binary);
+    string buf;
+
+    if(info.kind == KIND_PLAIN){
+        in.seekg((streamoff)(info.offset + (unsigned long long)row * 4));
+        if(!read_exact(in, buf, 8)) return json(json::value_t::discarded);
+        unsigned long long begin = get_uint(buf, 0, 4);
+        unsigned long long end = get_uint(buf, 4, 4);
+        if(end <= begin) return json(json::value_t::discarded);
+        in.seekg((streamoff)(info.offset + (unsigned long long)(rows + 1) * 4 + begin));
+        if(!read_exact(in, buf, (size_t)(end - begin))) return json(json::value_t::discarded);
+        return parse_text(buf, 0, buf.size());
+    }
+
+    in.seekg((streamoff)info.offset);
+    if(!read_exact(in, buf, 5)) return json(json::value_t::discarded);
+    unsigned int dict_count = (unsigned int)get_uint(buf, 0, 4);
+    int width = (int)get_uint(buf, 4, 1);
+    unsigned long long dict_offsets = info.offset + 5;
+    unsigned long long dict_data = dict_offsets + (unsigned long long)(dict_count + 1) * 4;
+
+    in.seekg((streamoff)(dict_offsets + (unsigned long long)dict_count * 4));
+    if(!read_exact(in, buf, 4)) return json(json::value_t::discarded);
+    unsigned long long codes = dict_data + get_uint(buf, 0, 4);
+
+    in.seekg((streamoff)(codes + (unsigned long long)row * width));
+    if(!read_exact(in, buf, (size_t)width)) return json(json::value_t::discarded);
+    unsigned long long code = get_uint(buf, 0, width);
+    if(code == missing_code(width) || code >= dict_count) return json(json::value_t::discarded);
+
+    in.seekg((streamoff)(dict_offsets + code * 4));
+    if(!read_exact(in, buf, 8)) return json(json::value_t::discarded);
+    unsigned long long begin = get_uint(buf, 0, 4);
+    unsigned long long end = get_uint(buf, 4, 4);
+    in.seekg((streamoff)(dict_data + begin));
+    if(!read_exact(in, buf, (size_t)(end - begin))) return json(json::value_t::discarded);
+    return parse_text(buf, 0, buf.size());
+}
+
+void ColumnFile::assemble(json& document, const string& name, const json& value){
+    if(value.is_discarded()) return;
+    if(name == EXTRA_COLUMN){
+        if(!value.is_object()) return;
+        for(auto it = value.begin(); it != value.end(); ++it){
+            document[it.key()] = it.value();
+        }
+        return;
+    }
+    document[name] = value;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <string>
+#include "../containers/vector.h"
+#include "../include/json.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+struct ColumnInfo {
+    string name;
+    unsigned char kind;
+    unsigned long long offset;
+    unsigned long long length;
+
+    ColumnInfo() : kind(0), offset(0), length(0) {}
+};
+
+// Колоночный файл запечатанного сегмента N.col: по колонке на каждое поле
+// из structure и служебная колонка _extra для прочих полей документа.
+// Строки с малым числом различных значений кодируются словарём.
+// Отсутствующее значение читается как json discarded.
+class ColumnFile {
+private:
+    string path;
+    unsigned int rows;
+    Vector<ColumnInfo> columns;
+
+    int find_column(const string& name) const;
+
+public:
+    static const char* EXTRA_COLUMN;
+
+    ColumnFile() : rows(0) {}
+
+    static void write(const string& path, const Vector<string>& names, const Vector<json>& documents);
+
+    void open(const string& path);
+    unsigned int get_rows() const { return rows; }
+    bool has_column(const string& name) const { return find_column(name) >= 0; }
+    Vector<string> get_column_names() const;
+
+    void read_column(const string& name, Vector<json>& values) const;
+    // Значения строк [first, first + count) без чтения колонки целиком
+    void read_rows(const string& name, unsigned int first, unsigned int count, Vector<json>& values) const;
+    json read_value(const string& name, unsigned int row) const;
+
+    static void assemble(json& document, const string& name, const json& value);
+};
@@ -0,0 +1,276 @@
+#include "cursor.h"
+#include "collection.h"
+#include "scan_executor.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+// Кусок параллельного чтения - не больше CHUNK_BATCHES пачек записей
+static const unsigned int CHUNK_BATCHES = 4;
+
+Cursor::Cursor(const Collection* collection, const json& filter, const json& projection,
+               int limit, unsigned int batch_size)
+    : collection(collection), filter(filter), projection(projection), partial(false), limit(limit),
+      batch_size(batch_size > 0 ? batch_size : 1), returned(0),
+      layout_version(collection->get_layout_version()), segment(0),
+      prepared(false), finished(false), pinned(false), pinned_segment(0), pinned_ordinal(0),
+      use_window(false), use_ordinals(false), ordinals_pos(0), next_ordinal(0),
+      window_pos(0), pending_pos(0){
+
+    partial = Collection::read_fields(this->filter, projection, fields);
+
+    // Фильтр с фиксированным _id читает не больше одной записи
+    DocRef ref;
+    bool found = collection->locate_by_id(this->filter.get_source(), ref, pinned);
+    if(pinned){
+        int s = found ? collection->find_segment_index(ref.segment) : -1;
+        if(s < 0){
+            finished = true;
+            return;
+        }
+        pinned_segment = (unsigned int)s;
+        pinned_ordinal = ref.ordinal;
+        segment = pinned_segment;
+    }
+}
+
+void Cursor::next_segment(){
+    prepared = false;
+    use_window = false;
+    use_ordinals = false;
+    ordinals.clear();
+    ordinals_pos = 0;
+    next_ordinal = 0;
+
+    if(pinned){
+        finished = true;
+        return;
+    }
+    segment++;
+}
+
+// Выбирает способ чтения сегмента; false - сегмент можно пропустить целиком
+bool Cursor::prepare(const Segment& seg){
+    prepared = true;
+
+    if(pinned){
+        use_ordinals = true;
+        ordinals.push_back(pinned_ordinal);
+        prefilter = Prefilter(filter, seg.get_encoding());
+        return true;
+    }
+
+    if(!seg.get_zones().may_match(filter.get_source(), collection->zone_fields)) return false;
+    prefilter = Prefilter(filter, seg.get_encoding());
+
+    // При нескольких потоках сегменты читаются кусками параллельно; колоночный
+    // сегмент читается кусками и при одном потоке (сначала колонки фильтра,
+    // затем колонки проекции найденных строк)
+    use_window = ScanExecutor::shared().get_threads() > 1 || seg.is_columnar();
+
+    if(collection->index_candidates(seg, filter.get_source(), ordinals)){
+        use_ordinals = true;
+        return !ordinals.empty();
+    }
+    return true;
+}
+
+// Режет оставшуюся часть сегментов на куски (по одному на поток) и читает их
+// параллельно. Останавливается на сегменте, который читается без окна.
+void Cursor::fill_window(){
+    unsigned int width = ScanExecutor::shared().get_threads();
+    if(width == 0) width = 1;
+    unsigned int chunk_rows = batch_size * CHUNK_BATCHES;
+    unsigned int total = collection->segments.get_size();
+
+    chunks.clear();
+    window.clear();
+    window_pos = 0;
+    pending_pos = 0;
+
+    while(chunks.get_size() < width && segment < total && !finished){
+        const Segment& seg = collection->segments[segment];
+        if(!prepared){
+            bool readable = false;
+            try{
+                readable = prepare(seg);
+            }catch(const exception&){
+            }
+            if(!readable){
+                next_segment();
+                continue;
+            }
+        }
+        if(!use_window) break;
+
+        ScanChunk chunk;
+        chunk.segment = segment;
+        if(use_ordinals){
+            chunk.by_ordinals = true;
+            while(chunk.ordinals.get_size() < chunk_rows && ordinals_pos < ordinals.get_size()){
+                chunk.ordinals.push_back(ordinals[ordinals_pos++]);
+            }
+            if(!chunk.ordinals.empty()) chunks.push_back(chunk);
+            if(ordinals_pos >= ordinals.get_size()) next_segment();
+        }else{
+            unsigned int size = seg.size();
+            chunk.start = next_ordinal;
+            chunk.count = next_ordinal < size ? size - next_ordinal : 0;
+            if(chunk.count > chunk_rows) chunk.count = chunk_rows;
+            next_ordinal += chunk.count;
+            if(chunk.count > 0) chunks.push_back(chunk);
+            if(next_ordinal >= size) next_segment();
+        }
+    }
+
+    for(unsigned int i = 0; i < chunks.get_size(); i++) window.push_back(Vector<json>());
+    ScanExecutor::shared().run(chunks.get_size(), [&](unsigned int i){
+        try{
+            read_chunk(chunks[i], window[i]);
+        }catch(const exception&){
+            window[i].clear();
+        }
+    });
+}
+
+// Найденные документы куска с проекцией, не больше остатка limit
+void Cursor::read_chunk(const ScanChunk& chunk, Vector<json>& out) const{
+    const Segment& seg = collection->segments[chunk.segment];
+    unsigned int max_count = limit > 0 ? (unsigned int)limit - returned : 0;
+    const Vector<string>* read = partial ? &fields : nullptr;
+
+    if(seg.is_columnar()){
+        Vector<string> filter_fields;
+        filter.collect_fields(filter_fields);
+        Vector<unsigned int> matched;
+        auto match = [&](unsigned int ordinal, const json& document){
+            if(!filter.matches(document)) return true;
+            matched.push_back(ordinal);
+            return max_count == 0 || matched.get_size() < max_count;
+        };
+        if(chunk.by_ordinals) seg.for_each_at(chunk.ordinals, match, &filter_fields);
+        else seg.for_each(match, &filter_fields, chunk.start, nullptr, chunk.count);
+
+        seg.for_each_at(matched, [&](unsigned int, const json& document){
+            out.push_back(Collection::project(document, projection));
+            return true;
+        }, read);
+        return;
+    }
+
+    Prefilter bytes_filter(filter, seg.get_encoding());
+    const Prefilter* bytes = bytes_filter.empty() ? nullptr : &bytes_filter;
+    auto visit = [&](unsigned int, const json& document){
+        if(!filter.matches(document)) return true;
+        out.push_back(Collection::project(document, projection));
+        return max_count == 0 || out.get_size() < max_count;
+    };
+    if(chunk.by_ordinals) seg.for_each_at(chunk.ordinals, visit, read, bytes);
+    else seg.for_each(visit, read, chunk.start, bytes, chunk.count);
+}
+
+// Читает из текущего сегмента не больше want документов; true - сегмент исчерпан
+bool Cursor::read_segment(const Segment& seg, unsigned int want, Vector<json>& out){
+    unsigned int taken = 0;
+
+    auto visit = [&](unsigned int, const json& document){
+        if(!filter.matches(document)) return true;
+        out.push_back(Collection::project(document, projection));
+        taken++;
+        return taken < want;
+    };
+
+    if(use_ordinals){
+        // Номера читаются порциями по размеру пачки, чтобы остановиться на want
+        while(taken < want && ordinals_pos < ordinals.get_size()){
+            Vector<unsigned int> slice;
+            while(slice.get_size() < batch_size && ordinals_pos < ordinals.get_size()){
+                slice.push_back(ordinals[ordinals_pos++]);
+            }
+            unsigned int last = 0;
+            seg.for_each_at(slice, [&](unsigned int ordinal, const json& document){
+                last = ordinal;
+                return visit(ordinal, document);
+            }, partial ? &fields : nullptr, prefilter.empty() ? nullptr : &prefilter);
+            if(taken >= want){
+                // Дочитанные, но не выданные номера возвращаются в очередь
+                while(ordinals_pos > 0 && ordinals[ordinals_pos - 1] > last) ordinals_pos--;
+            }
+        }
+        returned += taken;
+        return ordinals_pos >= ordinals.get_size();
+    }
+
+    bool stopped = false;
+    seg.for_each([&](unsigned int ordinal, const json& document){
+        next_ordinal = ordinal + 1;
+        if(!visit(ordinal, document)){
+            stopped = true;
+            return false;
+        }
+        return true;
+    }, partial ? &fields : nullptr, next_ordinal, prefilter.empty() ? nullptr : &prefilter);
+    returned += taken;
+    return !stopped;
+}
+
+bool Cursor::next_batch(Vector<json>& out){
+    out.clear();
+    if(!finished && collection->get_layout_version() != layout_version){
+        finished = true;
+        throw runtime_error("сегменты коллекции перестроены во время чтения, повторите запрос");
+    }
+
+    while(out.get_size() < batch_size){
+        if(limit > 0 && returned >= (unsigned int)limit){
+            finished = true;
+            break;
+        }
+
+        unsigned int want = batch_size - out.get_size();
+        if(limit > 0 && (unsigned int)limit - returned < want){
+            want = (unsigned int)limit - returned;
+        }
+
+        if(window_pos < window.get_size()){
+            const Vector<json>& pending = window[window_pos];
+            unsigned int taken = 0;
+            while(taken < want && pending_pos < pending.get_size()){
+                out.push_back(pending[pending_pos++]);
+                taken++;
+            }
+            returned += taken;
+            if(pending_pos >= pending.get_size()){
+                window_pos++;
+                pending_pos = 0;
+            }
+            continue;
+        }
+        window.clear();
+        chunks.clear();
+
+        if(finished || segment >= collection->segments.get_size()){
+            finished = true;
+            break;
+        }
+
+        const Segment& seg = collection->segments[segment];
+        bool exhausted = true;
+        try{
+            if(!prepared && !prepare(seg)){
+                next_segment();
+                continue;
+            }
+            if(use_window){
+                fill_window();
+                continue;
+            }
+            exhausted = read_segment(seg, want, out);
+        }catch(const exception&){
+            exhausted = true;
+        }
+        if(exhausted) next_segment();
+    }
+
+    return !out.empty();
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <string>
+#include "../containers/vector.h"
+#include "../include/json.hpp"
+#include "filter.h"
+#include "prefilter.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+class Collection;
+class Segment;
+
+// Часть сегмента для параллельного чтения: записи [start, start + count)
+// или, если by_ordinals, номера кандидатов индекса из ordinals
+struct ScanChunk {
+    unsigned int segment;
+    unsigned int start;
+    unsigned int count;
+    bool by_ordinals;
+    Vector<unsigned int> ordinals;
+
+    ScanChunk() : segment(0), start(0), count(0), by_ordinals(false) {}
+};
+
+// Курсор find: выдаёт подходящие документы пачками по мере чтения сегментов,
+// не собирая весь результат в памяти. В памяти держится не больше одной пачки
+// и окна: найденных документов нескольких кусков сегментов (по числу потоков
+// сканирования), каждый не длиннее нескольких пачек записей.
+// Каждая пачка читается под блокировкой коллекции; между пачками её можно
+// отпустить. Вставки и удаления позицию курсора не сдвигают, а если сегменты
+// перестроены (см. Collection::layout_version), next_batch бросает исключение.
+class Cursor {
+private:
+    const Collection* collection;
+    Filter filter;
+    json projection;
+    // Поля, которые строятся при разборе записи (фильтр и проекция), если
+    // partial; иначе документ разбирается целиком
+    Vector<string> fields;
+    bool partial;
+    int limit;
+    unsigned int batch_size;
+    unsigned int returned;
+    unsigned long long layout_version;
+
+    unsigned int segment;
+    bool prepared;
+    bool finished;
+    bool pinned;
+    unsigned int pinned_segment;
+    unsigned int pinned_ordinal;
+
+    // Позиция чтения текущего сегмента: список номеров записей (ordinals)
+    // или последовательный проход с next_ordinal. Сегмент читается либо
+    // здесь же по пачкам, либо (use_window) кусками в окно.
+    bool use_window;
+    bool use_ordinals;
+    Vector<unsigned int> ordinals;
+    unsigned int ordinals_pos;
+    unsigned int next_ordinal;
+    // Отсев записей текущего сегмента по байтам (зависит от его кодирования)
+    Prefilter prefilter;
+
+    // Окно: window[i] - найденные документы куска chunks[i]; выдача идёт
+    // с window[window_pos], позиции pending_pos
+    Vector<ScanChunk> chunks;
+    Vector<Vector<json>> window;
+    unsigned int window_pos;
+    unsigned int pending_pos;
+
+    bool prepare(const Segment& segment);
+    void fill_window();
+    void read_chunk(const ScanChunk& chunk, Vector<json>& out) const;
+    void next_segment();
+    bool read_segment(const Segment& segment, unsigned int want, Vector<json>& out);
+
+public:
+    Cursor() : collection(nullptr), partial(false), limit(0), batch_size(0), returned(0), layout_version(0),
+               segment(0), prepared(false), finished(true), pinned(false), pinned_segment(0), pinned_ordinal(0),
+               use_window(false), use_ordinals(false), ordinals_pos(0), next_ordinal(0),
+               window_pos(0), pending_pos(0) {}
+    Cursor(const Collection* collection, const json& filter, const json& projection,
+           int limit, unsigned int batch_size);
+
+    // Заполняет out следующей пачкой; false, если документов больше нет
+    bool next_batch(Vector<json>& out);
+    bool is_finished() const { return finished; }
+    unsigned int get_returned() const { return returned; }
+};
@@ -0,0 +1,331 @@
+#include "date_histogram.h"
+#include "secondary_index.h"
+#include <stdexcept>
+#include <cstdio>
+#include <cmath>
+
+using namespace std;
+using json = nlohmann::json;
+
+static bool read_digits(const string& s, size_t pos, size_t count, int& out){
+    if(pos + count > s.size()) return false;
+    out = 0;
+    for(size_t i = pos; i < pos + count; i++){
+        if(s[i] < '0' || s[i] > '9') return false;
+        out = out * 10 + (s[i] - '0');
+    }
+    return true;
+}
+
+// Число дней от 1970-01-01 для даты григорианского календаря
+static long long days_from_civil(long long y, unsigned int m, unsigned int d){
+    y -= m <= 2;
+    long long era = (y >= 0 ? y : y - 399) / 400;
+    unsigned int yoe = (unsigned int)(y - era * 400);
+    unsigned int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    unsigned int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (long long)doe - 719468;
+}
+
+static void civil_from_days(long long z, long long& y, unsigned int& m, unsigned int& d){
+    z += 719468;
+    long long era = (z >= 0 ? z : z - 146096) / 146097;
+    unsigned int doe = (unsigned int)(z - era * 146097);
+    unsigned int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    unsigned int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    unsigned int mp = (5 * doy + 2) / 153;
+    d = doy - (153 * mp + 2) / 5 + 1;
+    m = mp < 10 ? mp + 3 : mp - 9;
+    y = (long long)yoe + era * 400 + (m <= 2);
+}
+
+static long long floor_div(long long a, long long b){
+    long long q = a / b;
+    if((a % b != 0) && ((a < 0) != (b < 0))) q--;
+    return q;
+}
+
+bool DateHistogram::parse_timestamp(const json& value, long long& seconds){
+    if(value.is_number_integer()){
+        seconds = value.get<long long>();
+        return true;
+    }
+    if(value.is_number_float()){
+        seconds = (long long)floor(value.get<double>());
+        return true;
+    }
+    if(!value.is_string()) return false;
+
+    const string& s = value.get_ref<const string&>();
+    int year = 0, month = 0, day = 0, hour = 0, minute = 0, second = 0;
+    if(!read_digits(s, 0, 4, year) || s.size() < 10 || s[4] != '-' || s[7] != '-' ||
+       !read_digits(s, 5, 2, month) || !read_digits(s, 8, 2, day)){
+        return false;
+    }
+
+    size_t pos = 10;
+    long long offset = 0;
+    if(pos < s.size()){
+        if(s[pos] != 'T' && s[pos] != ' ') return false;
+        pos++;
+        if(!read_digits(s, pos, 2, hour)) return false;
+        pos += 2;
+        // "153000" (формат генератора событий) или "15:30:00" (RFC 3339)
+        bool colons = pos < s.size() && s[pos] == ':';
+        if(colons) pos++;
+        if(!read_digits(s, pos, 2, minute)) return false;
+        pos += 2;
+        if(colons){
+            if(pos >= s.size() || s[pos] != ':') return false;
+            pos++;
+        }
+        if(!read_digits(s, pos, 2, second)) return false;
+        pos += 2;
+
+        if(pos < s.size() && s[pos] == '.'){
+            pos++;
+            while(pos < s.size() && s[pos] >= '0' && s[pos] <= '9') pos++;
+        }
+        if(pos < s.size() && s[pos] == 'Z'){
+            pos++;
+        }else if(pos < s.size() && (s[pos] == '+' || s[pos] == '-')){
+            int oh = 0, om = 0;
+            int sign = s[pos] == '-' ? -1 : 1;
+            pos++;
+            if(!read_digits(s, pos, 2, oh)) return false;
+            pos += 2;
+            if(pos < s.size() && s[pos] == ':') pos++;
+            if(!read_digits(s, pos, 2, om)) return false;
+            pos += 2;
+            offset = sign * (oh * 3600LL + om * 60LL);
+        }
+        if(pos != s.size()) return false;
+    }
+
+    if(month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60){
+        return false;
+    }
+    seconds = days_from_civil(year, month, day) * 86400LL + hour * 3600LL + minute * 60LL + second - offset;
+    return true;
+}
+
+string DateHistogram::format_timestamp(long long seconds){
+    long long days = floor_div(seconds, 86400);
+    long long rest = seconds - days * 86400;
+    long long y = 0;
+    unsigned int m = 0, d = 0;
+    civil_from_days(days, y, m, d);
+
+    // Запас под любой год long long, иначе snprintf предупреждает об усечении
+    char buf[128];
+    snprintf(buf, sizeof(buf), "%04lld-%02u-%02uT%02lld:%02lld:%02lldZ",
+             y, m, d, rest / 3600, rest / 60 % 60, rest % 60);
+    return buf;
+}
+
+long long DateHistogram::parse_interval(const string& text){
+    if(text.size() < 2) return 0;
+    long long count = 0;
+    for(size_t i = 0; i + 1 < text.size(); i++){
+        if(text[i] < '0' || text[i] > '9') return 0;
+        count = count * 10 + (text[i] - '0');
+        if(count > 1000000) return 0;
+    }
+    switch(text.back()){
+        case 's': return count;
+        case 'm': return count * 60;
+        case 'h': return count * 3600;
+        case 'd': return count * 86400;
+        default: return 0;
+    }
+}
+
+DateHistogram::DateHistogram(const json& spec)
+    : field("timestamp"), interval(0), has_from(false), has_to(false), from_seconds(0), to_seconds(0),
+      base(0), first_seen(0), last_seen(-1){
+    if(!spec.is_object()){
+        throw runtime_error("параметры date_histogram должны быть объектом");
+    }
+
+    if(spec.contains("field")){
+        if(!spec["field"].is_string() || spec["field"].get<string>().empty()){
+            throw runtime_error("поле field должно быть непустой строкой");
+        }
+        field = spec["field"].get<string>();
+    }
+    if(!spec.contains("interval") || !spec["interval"].is_string() ||
+       (interval = parse_interval(spec["interval"].get<string>())) <= 0){
+        throw runtime_error("поле interval обязательно: число и единица s, m, h или d (например, 5m)");
+    }
+    if(spec.contains("group_by") && !spec["group_by"].is_null()){
+        if(!spec["group_by"].is_string() || spec["group_by"].get<string>().empty()){
+            throw runtime_error("поле group_by должно быть непустой строкой");
+        }
+        group_field = spec["group_by"].get<string>();
+    }
+
+    if(spec.contains("from") && !spec["from"].is_null()){
+        if(!parse_timestamp(spec["from"], from_seconds)) throw runtime_error("некорректное время в поле from");
+        has_from = true;
+    }
+    if(spec.contains("to") && !spec["to"].is_null()){
+        if(!parse_timestamp(spec["to"], to_seconds)) throw runtime_error("некорректное время в поле to");
+        has_to = true;
+    }
+    if(has_from && has_to){
+        if(to_seconds <= from_seconds) throw runtime_error("время to должно быть позже from");
+        // Заданный диапазон выдаётся целиком, поэтому массив размечается сразу
+        cover(bucket_of(from_seconds), bucket_of(to_seconds - 1));
+    }
+}
+
+long long DateHistogram::bucket_of(long long seconds) const{
+    return floor_div(seconds, interval);
+}
+
+void DateHistogram::collect_fields(Vector<string>& fields) const{
+    fields.push_back(field);
+    if(!group_field.empty() && group_field != field) fields.push_back(group_field);
+}
+
+static runtime_error too_many_buckets(){
+    return runtime_error("гистограмма больше " + to_string(DateHistogram::MAX_BUCKETS) +
+                         " интервалов: увеличьте interval или задайте from/to");
+}
+
+// Расширяет массив до интервалов first..last. При росте добавляется запас
+// в размер текущего массива, чтобы расширения были редкими.
+void DateHistogram::cover(long long first, long long last){
+    long long size = totals.get_size();
+    long long lo = size > 0 && base < first ? base : first;
+    long long hi = size > 0 && base + size - 1 > last ? base + size - 1 : last;
+    if(size > 0 && lo == base && hi == base + size - 1) return;
+
+    if(hi - lo + 1 > MAX_BUCKETS) throw too_many_buckets();
+
+    if(size > 0){
+        long long slack = size;
+        if(hi - lo + 1 + slack > MAX_BUCKETS) slack = MAX_BUCKETS - (hi - lo + 1);
+        if(lo < base) lo -= slack;
+        else hi += slack;
+        if(has_from && lo < bucket_of(from_seconds)) lo = bucket_of(from_seconds);
+        if(has_to && hi > bucket_of(to_seconds - 1)) hi = bucket_of(to_seconds - 1);
+    }
+
+    auto moved = [&](const Vector<long long>& counts){
+        Vector<long long> result;
+        for(long long b = lo; b <= hi; b++){
+            long long i = b - base;
+            result.push_back(i >= 0 && i < size ? counts[(unsigned int)i] : 0);
+        }
+        return result;
+    };
+    totals = moved(totals);
+    for(unsigned int g = 0; g < group_counts.get_size(); g++){
+        group_counts[g] = moved(group_counts[g]);
+    }
+    base = lo;
+}
+
+void DateHistogram::reserve(const json& lo, const json& hi){
+    long long lo_seconds = 0, hi_seconds = 0;
+    if(!parse_timestamp(lo, lo_seconds) || !parse_timestamp(hi, hi_seconds)) return;
+    if(has_from && lo_seconds < from_seconds) lo_seconds = from_seconds;
+    if(has_to && hi_seconds >= to_seconds) hi_seconds = to_seconds - 1;
+    if(hi_seconds < lo_seconds) return;
+
+    long long first = bucket_of(lo_seconds);
+    long long last = bucket_of(hi_seconds);
+    // Разметка только подсказка: слишком широкий диапазон не ошибка, пока
+    // в него не попали документы
+    if(last - first + 1 > MAX_BUCKETS) return;
+    cover(first, last);
+}
+
+unsigned int DateHistogram::group_of(const json& value){
+    string key = SecondaryIndex::make_key(value);
+    unsigned int g = 0;
+    if(group_index.try_get(key, g)) return g;
+
+    g = group_values.get_size();
+    group_index.insert(key, g);
+    group_values.push_back(value);
+    Vector<long long> counts;
+    for(unsigned int i = 0; i < totals.get_size(); i++) counts.push_back(0);
+    group_counts.push_back(counts);
+    return g;
+}
+
+bool DateHistogram::aligned(long long step) const{
+    if(has_from && floor_div(from_seconds, step) * step != from_seconds) return false;
+    if(has_to && floor_div(to_seconds, step) * step != to_seconds) return false;
+    return true;
+}
+
+void DateHistogram::add(const json& document){
+    auto it = document.find(field);
+    long long seconds = 0;
+    if(it == document.end() || !parse_timestamp(*it, seconds)) return;
+
+    if(group_field.empty()){
+        add(seconds, nullptr, 1);
+        return;
+    }
+    auto g = document.find(group_field);
+    json missing;
+    add(seconds, g != document.end() ? &*g : &missing, 1);
+}
+
+void DateHistogram::add(long long seconds, const json* group, long long count){
+    if(has_from && seconds < from_seconds) return;
+    if(has_to && seconds >= to_seconds) return;
+
+    long long bucket = bucket_of(seconds);
+    if(totals.empty() || bucket < base || bucket >= base + (long long)totals.get_size()){
+        cover(bucket, bucket);
+    }
+    unsigned int slot = (unsigned int)(bucket - base);
+    totals[slot] += count;
+
+    if(last_seen < first_seen){
+        first_seen = last_seen = bucket;
+    }else{
+        if(bucket < first_seen) first_seen = bucket;
+        if(bucket > last_seen) last_seen = bucket;
+    }
+
+    if(!group_field.empty() && group){
+        group_counts[group_of(*group)][slot] += count;
+    }
+}
+
+json DateHistogram::finish() const{
+    json buckets = json::array();
+
+    long long first = has_from ? bucket_of(from_seconds) : first_seen;
+    long long last = has_to ? bucket_of(to_seconds - 1) : last_seen;
+    if(!(has_from && has_to) && last_seen < first_seen) return buckets;
+    // С одной границей пустые интервалы от неё до данных тоже выдаются
+    if(last - first + 1 > MAX_BUCKETS) throw too_many_buckets();
+
+    for(long long b = first; b <= last; b++){
+        long long i = b - base;
+        bool stored = i >= 0 && i < (long long)totals.get_size();
+
+        json bucket = json::object();
+        bucket["key"] = format_timestamp(b * interval);
+        bucket["count"] = stored ? totals[(unsigned int)i] : 0;
+        if(!group_field.empty()){
+            json groups = json::object();
+            for(unsigned int g = 0; stored && g < group_values.get_size(); g++){
+                long long n = group_counts[g][(unsigned int)i];
+                if(n == 0) continue;
+                const json& value = group_values[g];
+                groups[value.is_string() ? value.get<string>() : value.dump()] = n;
+            }
+            bucket["groups"] = groups;
+        }
+        buckets.push_back(bucket);
+    }
+    return buckets;
+}
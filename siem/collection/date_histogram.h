@@ -0,0 +1,72 @@
+#pragma once
+#include <string>
+#include "../containers/vector.h"
+#include "../containers/hash_map.h"
+#include "../include/json.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+// Гистограмма по времени: документы раскладываются по интервалам фиксированной
+// длины (1m, 5m, 1h, ...) поля времени, при group_by - ещё и по значениям поля.
+// Счётчики лежат плотным массивом по номеру интервала, поэтому документ
+// учитывается за одно сложение; диапазон массива задают from/to или минимумы
+// и максимумы сегментов (reserve), при выходе за него массив расширяется.
+class DateHistogram {
+private:
+    string field;
+    string group_field;
+    long long interval;
+
+    bool has_from;
+    bool has_to;
+    long long from_seconds;
+    long long to_seconds;
+
+    long long base;
+    long long first_seen;
+    long long last_seen;
+    Vector<long long> totals;
+
+    Vector<json> group_values;
+    HashMap<string, unsigned int> group_index;
+    Vector<Vector<long long>> group_counts;
+
+    long long bucket_of(long long seconds) const;
+    void cover(long long first, long long last);
+    unsigned int group_of(const json& value);
+
+public:
+    // Число интервалов, больше которого гистограмма не строится
+    static const long long MAX_BUCKETS = 100000;
+
+    // spec: {"field": "timestamp", "interval": "5m", "group_by": "severity",
+    //        "from": время, "to": время}; обязателен только interval
+    explicit DateHistogram(const json& spec);
+
+    // Время в секундах от эпохи: число, "2026-10-18T153000Z" или RFC 3339
+    static bool parse_timestamp(const json& value, long long& seconds);
+    static string format_timestamp(long long seconds);
+    // "30s", "1m", "5m", "1h", "1d" в секундах; 0 - строка некорректна
+    static long long parse_interval(const string& text);
+
+    const string& get_field() const { return field; }
+    const string& get_group_field() const { return group_field; }
+    long long get_interval() const { return interval; }
+    // Граница from/to в секундах; false - граница не задана
+    bool get_from(long long& seconds) const { seconds = from_seconds; return has_from; }
+    bool get_to(long long& seconds) const { seconds = to_seconds; return has_to; }
+    // Границы from/to (если заданы) кратны step секундам
+    bool aligned(long long step) const;
+    void collect_fields(Vector<string>& fields) const;
+
+    // Заранее размечает массив под диапазон времени (например, по зонам сегментов)
+    void reserve(const json& lo, const json& hi);
+    void add(const json& document);
+    // count документов со временем seconds и значением group_by *group
+    void add(long long seconds, const json* group, long long count);
+
+    // [{"key": начало интервала, "count": n, "groups": {значение: n}}, ...]
+    // подряд от первого до последнего интервала, включая пустые
+    json finish() const;
+};
@@ -0,0 +1,245 @@
+#include "field_parser.h"
+#include <stdexcept>
+#include <cstring>
+
+using namespace std;
+using json = nlohmann::json;
+
+// Обработчик SAX: строит документ как json_sax_dom_parser, но пропускает
+// значения ненужных полей корневого объекта вместе со всей их вложенностью
+class FieldSaxHandler {
+private:
+    json& root;
+    const Vector<std::string>& fields;
+    Vector<json*> stack;
+    unsigned int depth;
+    json* element;
+    bool skip_value;
+    unsigned int skip_depth;
+
+    bool wanted(const std::string& key) const{
+        for(unsigned int i = 0; i < fields.get_size(); i++){
+            if(fields[i] == key) return true;
+        }
+        return false;
+    }
+
+    // true - значение относится к пропускаемому полю
+    bool skipping_scalar(){
+        if(skip_depth > 0) return true;
+        if(skip_value){
+            skip_value = false;
+            return true;
+        }
+        return false;
+    }
+
+    bool skipping_container(){
+        if(skip_depth > 0){
+            skip_depth++;
+            return true;
+        }
+        if(skip_value){
+            skip_value = false;
+            skip_depth = 1;
+            return true;
+        }
+        return false;
+    }
+
+    json* put(json&& value){
+        if(depth == 0){
+            root = std::move(value);
+            return &root;
+        }
+        json* top = stack[depth - 1];
+        if(top->is_array()){
+            top->push_back(std::move(value));
+            return &top->back();
+        }
+        *element = std::move(value);
+        return element;
+    }
+
+    void push(json* container){
+        if(depth < stack.get_size()) stack[depth] = container;
+        else stack.push_back(container);
+        depth++;
+    }
+
+public:
+    FieldSaxHandler(json& root, const Vector<std::string>& fields)
+        : root(root), fields(fields), depth(0), element(nullptr), skip_value(false), skip_depth(0) {}
+
+    bool null(){
+        if(!skipping_scalar()) put(nullptr);
+        return true;
+    }
+    bool boolean(bool v){
+        if(!skipping_scalar()) put(v);
+        return true;
+    }
+    bool number_integer(json::number_integer_t v){
+        if(!skipping_scalar()) put(v);
+        return true;
+    }
+    bool number_unsigned(json::number_unsigned_t v){
+        if(!skipping_scalar()) put(v);
+        return true;
+    }
+    bool number_float(json::number_float_t v, const json::string_t&){
+        if(!skipping_scalar()) put(v);
+        return true;
+    }
+    bool string(json::string_t& v){
+        if(!skipping_scalar()) put(std::move(v));
+        return true;
+    }
+    bool binary(json::binary_t& v){
+        if(!skipping_scalar()) put(json(std::move(v)));
+        return true;
+    }
+
+    bool start_object(size_t){
+        if(skipping_container()) return true;
+        push(put(json::object()));
+        return true;
+    }
+    bool key(json::string_t& k){
+        if(skip_depth > 0) return true;
+        // Отбор полей только у корневого объекта
+        if(depth == 1 && !wanted(k)){
+            skip_value = true;
+            return true;
+        }
+        element = &(*stack[depth - 1])[k];
+        return true;
+    }
+    bool end_object(){
+        if(skip_depth > 0){
+            skip_depth--;
+            return true;
+        }
+        depth--;
+        return true;
+    }
+
+    bool start_array(size_t){
+        if(skipping_container()) return true;
+        push(put(json::array()));
+        return true;
+    }
+    bool end_array(){
+        return end_object();
+    }
+
+    bool parse_error(size_t, const std::string&, const nlohmann::detail::exception& e){
+        throw runtime_error(e.what());
+    }
+};
+
+static bool field_wanted(const Vector<string>& fields, const char* key, size_t len){
+    for(unsigned int i = 0; i < fields.get_size(); i++){
+        if(fields[i].size() == len && memcmp(fields[i].data(), key, len) == 0) return true;
+    }
+    return false;
+}
+
+static size_t skip_space(const string& s, size_t pos){
+    while(pos < s.size() && (s[pos] == ' ' || s[pos] == '\t' || s[pos] == '\n' || s[pos] == '\r')) pos++;
+    return pos;
+}
+
+// pos указывает на открывающую кавычку; возвращает позицию после закрывающей
+// или npos. Кавычка с нечётным числом обратных слешей перед ней экранирована.
+static size_t skip_string(const string& s, size_t pos){
+    pos++;
+    while(pos < s.size()){
+        const void* hit = memchr(s.data() + pos, '"', s.size() - pos);
+        if(!hit) return string::npos;
+        size_t quote = (size_t)((const char*)hit - s.data());
+        size_t slashes = 0;
+        while(quote - slashes > pos && s[quote - slashes - 1] == '\\') slashes++;
+        if(slashes % 2 == 0) return quote + 1;
+        pos = quote + 1;
+    }
+    return string::npos;
+}
+
+// Пропуск значения без разбора; npos - запись повреждена
+static size_t skip_value(const string& s, size_t pos){
+    if(pos >= s.size()) return string::npos;
+    if(s[pos] == '"') return skip_string(s, pos);
+    if(s[pos] == '{' || s[pos] == '['){
+        unsigned int depth = 0;
+        while(pos < s.size()){
+            char c = s[pos];
+            if(c == '"'){
+                pos = skip_string(s, pos);
+                if(pos == string::npos) return pos;
+                continue;
+            }
+            if(c == '{' || c == '[') depth++;
+            else if(c == '}' || c == ']'){
+                if(--depth == 0) return pos + 1;
+            }
+            pos++;
+        }
+        return string::npos;
+    }
+    while(pos < s.size() && s[pos] != ',' && s[pos] != '}' && s[pos] != ']' &&
+          s[pos] != ' ' && s[pos] != '\t' && s[pos] != '\n' && s[pos] != '\r') pos++;
+    return pos;
+}
+
+// Текстовая запись: корневой объект просматривается без разбора, ненужные
+// значения пропускаются поиском кавычек (memchr), нужные разбираются json::parse.
+// false - запись устроена иначе (не объект, экранированный ключ, ошибка),
+// тогда её разбирает SAX-путь.
+static bool scan_json_fields(const string& s, const Vector<string>& fields, json& document){
+    size_t pos = skip_space(s, 0);
+    if(pos >= s.size() || s[pos] != '{') return false;
+    document = json::object();
+    pos = skip_space(s, pos + 1);
+    if(pos < s.size() && s[pos] == '}') return skip_space(s, pos + 1) == s.size();
+
+    while(true){
+        if(pos >= s.size() || s[pos] != '"') return false;
+        size_t key_end = skip_string(s, pos);
+        if(key_end == string::npos) return false;
+        const char* key = s.data() + pos + 1;
+        size_t key_len = key_end - pos - 2;
+        if(memchr(key, '\\', key_len)) return false;
+
+        pos = skip_space(s, key_end);
+        if(pos >= s.size() || s[pos] != ':') return false;
+        size_t value_begin = skip_space(s, pos + 1);
+        size_t value_end = skip_value(s, value_begin);
+        if(value_end == string::npos || value_end == value_begin) return false;
+
+        if(field_wanted(fields, key, key_len)){
+            document[string(key, key_len)] = json::parse(s.begin() + (long)value_begin, s.begin() + (long)value_end);
+        }
+
+        pos = skip_space(s, value_end);
+        if(pos >= s.size()) return false;
+        if(s[pos] == '}') return skip_space(s, pos + 1) == s.size();
+        if(s[pos] != ',') return false;
+        pos = skip_space(s, pos + 1);
+    }
+}
+
+json parse_fields(const string& payload, json::input_format_t format, const Vector<string>& fields){
+    json document;
+    if(format == json::input_format_t::json){
+        try{
+            if(scan_json_fields(payload, fields, document)) return document;
+        }catch(const exception&){
+        }
+        document = json();
+    }
+
+    FieldSaxHandler handler(document, fields);
+    json::sax_parse(payload.begin(), payload.end(), &handler, format);
+    return document;
+}
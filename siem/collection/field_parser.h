@@ -0,0 +1,16 @@
+#pragma once
+#include <string>
+#include "../containers/vector.h"
+#include "../include/json.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+// Разбор записи с построением только полей верхнего уровня из fields.
+// Текстовая запись просматривается без разбора: значения остальных полей
+// (rawlog, command и т.п.) пропускаются по байтам. CBOR и MessagePack
+// разбираются через SAX-интерфейс json.hpp, ненужные значения в документ
+// не попадают и памяти под узлы не занимают.
+// Документ, который не является объектом, строится целиком.
+// Бросает исключение на некорректной записи, как json::parse.
+json parse_fields(const string& payload, json::input_format_t format, const Vector<string>& fields);
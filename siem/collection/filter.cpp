@@ -0,0 +1,334 @@
+#include "filter.h"
+#include "secondary_index.h"
+#include "text_index.h"
+#include "trigram_index.h"
+#include <stdexcept>
+
+using namespace std;
+using json = nlohmann::json;
+
+static FilterOp parse_operator(const string& op){
+    if(op == "$eq") return FilterOp::Eq;
+    if(op == "$ne") return FilterOp::Ne;
+    if(op == "$gt") return FilterOp::Gt;
+    if(op == "$lt") return FilterOp::Lt;
+    if(op == "$gte") return FilterOp::Gte;
+    if(op == "$lte") return FilterOp::Lte;
+    if(op == "$in") return FilterOp::In;
+    if(op == "$nin") return FilterOp::Nin;
+    if(op == "$text") return FilterOp::Text;
+    if(op == "$contains") return FilterOp::Contains;
+    if(op == "$regex") return FilterOp::Regex;
+    if(op == "$any_of_substrings") return FilterOp::AnyOfSubstrings;
+    throw runtime_error("неизвестный оператор фильтра: " + op);
+}
+
+Filter::Filter(const json& filter) : source(filter){
+    if(filter.is_null()){
+        source = json::object();
+    }else if(!filter.is_object()){
+        throw runtime_error("фильтр должен быть объектом");
+    }
+    root = compile_object(source);
+}
+
+FilterNode Filter::compile_object(const json& filter){
+    if(!filter.is_object()){
+        throw runtime_error("условие фильтра должно быть объектом");
+    }
+
+    FilterNode node;
+    node.op = FilterOp::And;
+    for(auto it = filter.begin(); it != filter.end(); ++it){
+        const string& key = it.key();
+        const json& condition = it.value();
+
+        if(key == "$and" || key == "$or"){
+            if(!condition.is_array()){
+                throw runtime_error("оператор " + key + " требует массив условий");
+            }
+            FilterNode group;
+            group.op = key == "$and" ? FilterOp::And : FilterOp::Or;
+            for(const auto& cond : condition){
+                group.children.push_back(compile_object(cond));
+            }
+            node.children.push_back(group);
+        }else if(key == "$not"){
+            FilterNode negation;
+            negation.op = FilterOp::Not;
+            negation.children.push_back(compile_object(condition));
+            node.children.push_back(negation);
+        }else if(condition.is_array()){
+            // Массив как значение поля не сравнивается (так было и до компиляции)
+            continue;
+        }else{
+            node.children.push_back(compile_field(key, condition));
+        }
+    }
+    return node;
+}
+
+// $options рядом с $regex или $any_of_substrings: поддерживается только "i"
+// (без учёта регистра)
+static bool ignore_case_option(const json& condition){
+    if(!condition.contains("$options")) return false;
+    if(!condition.contains("$regex") && !condition.contains("$any_of_substrings")){
+        throw runtime_error("$options допускается только вместе с $regex или $any_of_substrings");
+    }
+    const json& options = condition["$options"];
+    if(!options.is_string()){
+        throw runtime_error("$options должно быть строкой");
+    }
+    string flags = options.get<string>();
+    for(size_t i = 0; i < flags.size(); i++){
+        if(flags[i] != 'i') throw runtime_error(string("неизвестный флаг $options: ") + flags[i]);
+    }
+    return !flags.empty();
+}
+
+bool Filter::substring_literals(const json& condition, Vector<string>& literals, bool& ignore_case){
+    ignore_case = false;
+    if(!condition.is_object()) return false;
+    if(condition.contains("$contains") && condition["$contains"].is_string()){
+        literals.push_back(condition["$contains"].get<string>());
+    }
+    if(condition.contains("$regex") && condition["$regex"].is_string()){
+        try{
+            ignore_case = ignore_case_option(condition);
+        }catch(const exception&){
+            return false;
+        }
+        TrigramIndex::regex_literals(condition["$regex"].get<string>(), literals);
+    }
+    return !literals.empty();
+}
+
+bool Filter::any_substrings(const json& condition, Vector<string>& patterns){
+    if(!condition.is_object() || !condition.contains("$any_of_substrings")) return false;
+    const json& list = condition["$any_of_substrings"];
+    if(!list.is_array()) return false;
+    for(const auto& item : list){
+        if(!item.is_string()) return false;
+        patterns.push_back(item.get<string>());
+    }
+    return true;
+}
+
+FilterNode Filter::compile_field(const string& field, const json& condition){
+    FilterNode node;
+    node.op = FilterOp::Field;
+    node.field = field;
+
+    if(!condition.is_object()){
+        FilterNode eq;
+        eq.op = FilterOp::Eq;
+        eq.value = condition;
+        node.children.push_back(eq);
+        return node;
+    }
+
+    bool ignore_case = ignore_case_option(condition);
+
+    for(auto it = condition.begin(); it != condition.end(); ++it){
+        if(it.key() == "$options") continue;
+        FilterNode cond;
+        cond.op = parse_operator(it.key());
+        cond.value = it.value();
+
+        if(cond.op == FilterOp::In || cond.op == FilterOp::Nin){
+            if(!cond.value.is_array()){
+                throw runtime_error("оператор " + it.key() + " требует массив значений");
+            }
+            for(const auto& item : cond.value){
+                if(item.is_structured()) cond.values.push_back(item);
+                else cond.set.insert(SecondaryIndex::make_key(item), true);
+            }
+            cond.value = json();
+        }else if(cond.op == FilterOp::Text){
+            Vector<string> tokens;
+            bool any = false;
+            text_terms(cond.value, tokens, any);
+            for(unsigned int i = 0; i < tokens.get_size(); i++) cond.values.push_back(tokens[i]);
+            cond.value = any;
+        }else if(cond.op == FilterOp::Contains || cond.op == FilterOp::Regex){
+            if(!cond.value.is_string()){
+                throw runtime_error("оператор " + it.key() + " требует строку");
+            }
+            const string& text = cond.value.get_ref<const string&>();
+            Vector<string> literals;
+            if(cond.op == FilterOp::Contains){
+                literals.push_back(text);
+            }else{
+                cond.ignore_case = ignore_case;
+                try{
+                    auto flags = regex::ECMAScript | regex::optimize;
+                    if(ignore_case) flags |= regex::icase;
+                    cond.pattern = make_shared<regex>(text, flags);
+                }catch(const regex_error&){
+                    throw runtime_error("некорректное выражение $regex: " + text);
+                }
+                TrigramIndex::regex_literals(text, literals);
+            }
+            for(unsigned int i = 0; i < literals.get_size(); i++) cond.values.push_back(literals[i]);
+        }else if(cond.op == FilterOp::AnyOfSubstrings){
+            Vector<string> patterns;
+            if(!any_substrings(condition, patterns)){
+                throw runtime_error("оператор $any_of_substrings требует массив строк");
+            }
+            cond.ignore_case = ignore_case;
+            cond.automaton = AhoCorasick::compile(patterns, ignore_case);
+            cond.value = json();
+        }
+        node.children.push_back(cond);
+    }
+    return node;
+}
+
+static bool in_values(const FilterNode& node, const json& value){
+    if(!value.is_structured()){
+        if(node.set.size() > 0 && node.set.contains(SecondaryIndex::make_key(value))) return true;
+        return false;
+    }
+    for(unsigned int i = 0; i < node.values.get_size(); i++){
+        if(node.values[i] == value) return true;
+    }
+    return false;
+}
+
+void Filter::text_terms(const json& operand, Vector<string>& tokens, bool& any){
+    any = false;
+    json words = operand;
+    if(operand.is_object()){
+        if(operand.size() != 1 || (!operand.contains("$all") && !operand.contains("$any"))){
+            throw runtime_error("оператор $text принимает строку, {\"$all\": ...} или {\"$any\": ...}");
+        }
+        any = operand.contains("$any");
+        words = any ? operand["$any"] : operand["$all"];
+    }
+
+    if(words.is_string()){
+        TextIndex::tokenize(words.get<string>(), tokens);
+    }else if(words.is_array()){
+        for(const auto& word : words){
+            if(!word.is_string()) throw runtime_error("оператор $text требует строки");
+            TextIndex::tokenize(word.get<string>(), tokens);
+        }
+    }else{
+        throw runtime_error("оператор $text требует строку или массив строк");
+    }
+    if(tokens.empty()){
+        throw runtime_error("в запросе $text нет ни одного слова");
+    }
+}
+
+static bool text_matches(const FilterNode& node, const json& value){
+    if(!value.is_string()) return false;
+    Vector<string> tokens;
+    TextIndex::tokenize(value.get_ref<const string&>(), tokens);
+    bool any = node.value.get<bool>();
+
+    for(unsigned int q = 0; q < node.values.get_size(); q++){
+        const string& word = node.values[q].get_ref<const string&>();
+        bool found = false;
+        for(unsigned int i = 0; i < tokens.get_size(); i++){
+            if(tokens[i] == word){ found = true; break; }
+        }
+        if(found && any) return true;
+        if(!found && !any) return false;
+    }
+    return !any;
+}
+
+bool Filter::eval_condition(const FilterNode& node, const json& value){
+    switch(node.op){
+        case FilterOp::Eq: return value == node.value;
+        case FilterOp::Ne: return value != node.value;
+        case FilterOp::Gt: return value > node.value;
+        case FilterOp::Lt: return value < node.value;
+        case FilterOp::Gte: return value >= node.value;
+        case FilterOp::Lte: return value <= node.value;
+        case FilterOp::In: return in_values(node, value);
+        case FilterOp::Nin: return !in_values(node, value);
+        case FilterOp::Text: return text_matches(node, value);
+        case FilterOp::Contains:
+            return value.is_string() &&
+                   value.get_ref<const string&>().find(node.value.get_ref<const string&>()) != string::npos;
+        case FilterOp::Regex:
+            return value.is_string() && regex_search(value.get_ref<const string&>(), *node.pattern);
+        case FilterOp::AnyOfSubstrings:
+            return value.is_string() && node.automaton->search(value.get_ref<const string&>());
+        default: return false;
+    }
+}
+
+bool Filter::eval(const FilterNode& node, const json& document){
+    switch(node.op){
+        case FilterOp::And:
+            for(unsigned int i = 0; i < node.children.get_size(); i++){
+                if(!eval(node.children[i], document)) return false;
+            }
+            return true;
+        case FilterOp::Or:
+            for(unsigned int i = 0; i < node.children.get_size(); i++){
+                if(eval(node.children[i], document)) return true;
+            }
+            return false;
+        case FilterOp::Not:
+            return !eval(node.children[0], document);
+        case FilterOp::Field: {
+            if(!document.is_object()) return false;
+            auto it = document.find(node.field);
+            if(it == document.end()) return false;
+            for(unsigned int i = 0; i < node.children.get_size(); i++){
+                if(!eval_condition(node.children[i], *it)) return false;
+            }
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+void Filter::collect(const FilterNode& node, Vector<string>& fields){
+    if(node.op == FilterOp::Field){
+        for(unsigned int i = 0; i < fields.get_size(); i++){
+            if(fields[i] == node.field) return;
+        }
+        fields.push_back(node.field);
+        return;
+    }
+    for(unsigned int i = 0; i < node.children.get_size(); i++){
+        collect(node.children[i], fields);
+    }
+}
+
+void Filter::collect_equalities(const FilterNode& node, Vector<string>& fields, Vector<string>& values){
+    if(node.op == FilterOp::And){
+        for(unsigned int i = 0; i < node.children.get_size(); i++){
+            collect_equalities(node.children[i], fields, values);
+        }
+        return;
+    }
+    if(node.op != FilterOp::Field) return;
+    for(unsigned int i = 0; i < node.children.get_size(); i++){
+        const FilterNode& cond = node.children[i];
+        if(cond.op == FilterOp::Eq && cond.value.is_string()){
+            fields.push_back(node.field);
+            values.push_back(cond.value.get<string>());
+        }
+    }
+}
+
+void Filter::collect_substrings(const FilterNode& node, Vector<string>& literals){
+    if(node.op == FilterOp::And || node.op == FilterOp::Field){
+        for(unsigned int i = 0; i < node.children.get_size(); i++){
+            collect_substrings(node.children[i], literals);
+        }
+        return;
+    }
+    if((node.op == FilterOp::Contains || node.op == FilterOp::Regex) && !node.ignore_case){
+        for(unsigned int i = 0; i < node.values.get_size(); i++){
+            literals.push_back(node.values[i].get<string>());
+        }
+    }
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <string>
+#include <regex>
+#include <memory>
+#include "../containers/vector.h"
+#include "../containers/hash_map.h"
+#include "../include/json.hpp"
+#include "aho_corasick.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+enum class FilterOp {
+    And,
+    Or,
+    Not,
+    Field,
+    Eq,
+    Ne,
+    Gt,
+    Lt,
+    Gte,
+    Lte,
+    In,
+    Nin,
+    Text,
+    Contains,
+    Regex,
+    AnyOfSubstrings
+};
+
+// Узел скомпилированного фильтра. Field - условия на одно поле (все в children,
+// поле должно присутствовать), Eq..Nin - сравнение значения поля с value.
+// Для In/Nin скалярные значения лежат в хеш-множестве set (ключ SecondaryIndex::make_key),
+// массивы и объекты - в values. Text - слова запроса $text в values,
+// value = true, если достаточно любого из них ($any), иначе нужны все.
+// Contains - подстрока value; Regex - выражение pattern (ignore_case для
+// $options: "i"); для обоих в values обязательные подстроки (см. TrigramIndex).
+// AnyOfSubstrings - автомат automaton по списку подстрок (общий для запросов
+// с тем же списком).
+struct FilterNode {
+    FilterOp op;
+    string field;
+    json value;
+    HashMap<string, bool> set;
+    Vector<json> values;
+    Vector<FilterNode> children;
+    shared_ptr<regex> pattern;
+    shared_ptr<const AhoCorasick> automaton;
+    bool ignore_case;
+
+    FilterNode() : op(FilterOp::And), ignore_case(false) {}
+};
+
+// Фильтр запроса, разобранный один раз до сканирования. Проверка документа
+// идёт по дереву с готовыми кодами операций, без разбора JSON фильтра.
+// Некорректный фильтр (не массив в $and/$or/$in/$nin, неизвестный оператор)
+// отклоняется при компиляции исключением.
+class Filter {
+private:
+    json source;
+    FilterNode root;
+
+    static FilterNode compile_object(const json& filter);
+    static FilterNode compile_field(const string& field, const json& condition);
+    static bool eval(const FilterNode& node, const json& document);
+    static bool eval_condition(const FilterNode& node, const json& value);
+    static void collect(const FilterNode& node, Vector<string>& fields);
+    static void collect_equalities(const FilterNode& node, Vector<string>& fields, Vector<string>& values);
+    static void collect_substrings(const FilterNode& node, Vector<string>& literals);
+
+public:
+    Filter() : source(json::object()) {}
+    explicit Filter(const json& filter);
+
+    bool matches(const json& document) const { return eval(root, document); }
+    bool empty() const { return root.op == FilterOp::And && root.children.empty(); }
+    const json& get_source() const { return source; }
+    // Поля верхнего уровня, которые читает фильтр (без повторов)
+    void collect_fields(Vector<string>& fields) const { collect(root, fields); }
+    // Обязательные подстрока $contains и литералы $regex с учётом регистра
+    // (не под $or/$not), без привязки к полю
+    void required_substrings(Vector<string>& literals) const { collect_substrings(root, literals); }
+    // Подстроки, обязательные для условия поля с $contains или $regex
+    // (с $options); false - условие не из них или литералов нет.
+    // Для $any_of_substrings нужна хотя бы одна из подстрок, см. any_substrings
+    static bool substring_literals(const json& condition, Vector<string>& literals, bool& ignore_case);
+    // Подстроки $any_of_substrings; false - условия нет
+    static bool any_substrings(const json& condition, Vector<string>& patterns);
+    // Разбор операнда $text: "слова", {"$all": ...} или {"$any": ...}, где ... -
+    // строка или массив строк. Бросает исключение, если слов нет.
+    static void text_terms(const json& operand, Vector<string>& tokens, bool& any);
+    // Условия "поле равно строке", обязательные для любого подходящего документа
+    // (не под $or/$not): пары fields[i] == values[i]
+    void required_equalities(Vector<string>& fields, Vector<string>& values) const {
+        collect_equalities(root, fields, values);
+    }
+};
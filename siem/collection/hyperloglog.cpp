@@ -0,0 +1,105 @@
+#include "hyperloglog.h"
+#include "secondary_index.h"
+#include <cmath>
+#include <stdexcept>
+
+using namespace std;
+using json = nlohmann::json;
+
+// FNV-1a с перемешиванием splitmix64: младшие и старшие биты равномерны
+static unsigned long long hash_key(const string& key){
+    unsigned long long h = 14695981039346656037ULL;
+    for(size_t i = 0; i < key.size(); i++){
+        h ^= (unsigned char)key[i];
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+double HyperLogLog::standard_error(){
+    return 1.04 / sqrt((double)REGISTERS);
+}
+
+void HyperLogLog::add(const json& value){
+    if(registers.empty()) registers.assign(REGISTERS, '\0');
+
+    unsigned long long h = hash_key(SecondaryIndex::make_key(value));
+    unsigned int index = (unsigned int)(h >> (64 - PRECISION));
+    // Ранг - позиция первой единицы в оставшихся битах
+    unsigned long long rest = h << PRECISION;
+    unsigned char rank = 1;
+    while(rank <= 64 - PRECISION && !(rest & (1ULL << 63))){
+        rest <<= 1;
+        rank++;
+    }
+    if((unsigned char)registers[index] < rank) registers[index] = (char)rank;
+}
+
+void HyperLogLog::merge(const HyperLogLog& other){
+    if(other.registers.empty()) return;
+    if(registers.empty()){
+        registers = other.registers;
+        return;
+    }
+    for(unsigned int i = 0; i < REGISTERS; i++){
+        if((unsigned char)registers[i] < (unsigned char)other.registers[i]) registers[i] = other.registers[i];
+    }
+}
+
+unsigned long long HyperLogLog::estimate() const{
+    if(registers.empty()) return 0;
+
+    double m = (double)REGISTERS;
+    double sum = 0;
+    unsigned int zeros = 0;
+    for(unsigned int i = 0; i < REGISTERS; i++){
+        unsigned char r = (unsigned char)registers[i];
+        sum += ldexp(1.0, -(int)r);
+        if(r == 0) zeros++;
+    }
+
+    double alpha = 0.7213 / (1.0 + 1.079 / m);
+    double e = alpha * m * m / sum;
+    // На малых числах точнее линейный подсчёт по пустым регистрам
+    if(e <= 2.5 * m && zeros > 0){
+        e = m * log(m / (double)zeros);
+    }
+    return (unsigned long long)llround(e);
+}
+
+void DistinctSketches::add(const string& field, const json& value){
+    fields[field].add(value);
+}
+
+json HyperLogLog::save() const{
+    return json::binary(json::binary_t::container_type(registers.begin(), registers.end()));
+}
+
+void HyperLogLog::load(const json& state){
+    const json::binary_t& data = state.get_binary();
+    registers.assign(data.begin(), data.end());
+    if(!registers.empty() && registers.size() != REGISTERS){
+        throw runtime_error("некорректный размер скетча HyperLogLog");
+    }
+}
+
+json DistinctSketches::save() const{
+    json state = json::object();
+    for(auto it = fields.begin(); it != fields.end(); ++it){
+        KeyValue<string, HyperLogLog> field = *it;
+        state[field.key] = field.value.save();
+    }
+    return state;
+}
+
+void DistinctSketches::load(const json& state){
+    fields.clear();
+    for(auto it = state.begin(); it != state.end(); ++it){
+        fields[it.key()].load(it.value());
+    }
+}
@@ -0,0 +1,58 @@
+#include "prefilter.h"
+#include <string.h>
+
+using namespace std;
+using json = nlohmann::json;
+
+static string encode_literal(const string& text, SegmentEncoding encoding){
+    json value = text;
+    if(encoding == SegmentEncoding::Cbor){
+        vector<uint8_t> bytes = json::to_cbor(value);
+        return string(bytes.begin(), bytes.end());
+    }
+    if(encoding == SegmentEncoding::MsgPack){
+        vector<uint8_t> bytes = json::to_msgpack(value);
+        return string(bytes.begin(), bytes.end());
+    }
+    return value.dump(-1, ' ', false, json::error_handler_t::replace);
+}
+
+Prefilter::Prefilter(const Filter& filter, SegmentEncoding encoding){
+    Vector<string> fields;
+    Vector<string> values;
+    filter.required_equalities(fields, values);
+
+    string separator = encoding == SegmentEncoding::Json ? ":" : "";
+    for(unsigned int i = 0; i < fields.get_size(); i++){
+        needles.push_back(encode_literal(fields[i], encoding) + separator + encode_literal(values[i], encoding));
+    }
+
+    // Подстрока значения в JSON экранируется так же, как в составе всей строки,
+    // поэтому образец - экранированная подстрока без кавычек
+    Vector<string> literals;
+    filter.required_substrings(literals);
+    for(unsigned int i = 0; i < literals.get_size(); i++){
+        if(literals[i].empty()) continue;
+        if(encoding != SegmentEncoding::Json){
+            needles.push_back(literals[i]);
+            continue;
+        }
+        // Литерал с обрезанным символом UTF-8 в образец не превращается
+        string quoted;
+        try{
+            quoted = json(literals[i]).dump();
+        }catch(const exception&){
+            continue;
+        }
+        needles.push_back(quoted.substr(1, quoted.size() - 2));
+    }
+}
+
+// memmem из glibc сравнивает блоками, а не побайтово
+bool Prefilter::may_match(const string& record) const{
+    for(unsigned int i = 0; i < needles.get_size(); i++){
+        const string& needle = needles[i];
+        if(!memmem(record.data(), record.size(), needle.data(), needle.size())) return false;
+    }
+    return true;
+}
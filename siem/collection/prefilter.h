@@ -0,0 +1,25 @@
+#pragma once
+#include <string>
+#include "../containers/vector.h"
+#include "filter.h"
+#include "segment.h"
+
+using namespace std;
+
+// Отсев записей строкового сегмента по байтам до разбора. Для каждого условия
+// фильтра "поле равно строке" строится образец - ключ и значение в кодировании
+// сегмента подряд (записи пишутся компактно: "hostname":"web-17" в JSON,
+// заголовок и байты строк в CBOR/MessagePack). Образцы дают и подстроки
+// $contains/$regex (в JSON - в экранированном виде). Запись без любого из образцов
+// под фильтр не подходит; остальные записи проверяются фильтром как обычно.
+class Prefilter {
+private:
+    Vector<string> needles;
+
+public:
+    Prefilter() {}
+    Prefilter(const Filter& filter, SegmentEncoding encoding);
+
+    bool empty() const { return needles.empty(); }
+    bool may_match(const string& record) const;
+};
@@ -0,0 +1,96 @@
+#include "rollup.h"
+#include "secondary_index.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+Rollup::Rollup(const RollupOptions& options)
+    : options(options), interval(DateHistogram::parse_interval(options.interval)){}
+
+void Rollup::collect_fields(Vector<string>& fields) const{
+    fields.push_back(options.field);
+    if(!options.group_by.empty()) fields.push_back(options.group_by);
+}
+
+void Rollup::add(const json& document, long long delta){
+    auto it = document.find(options.field);
+    long long seconds = 0;
+    if(it == document.end() || !DateHistogram::parse_timestamp(*it, seconds)) return;
+
+    long long bucket = seconds / interval;
+    if(seconds % interval != 0 && seconds < 0) bucket--;
+
+    json group;
+    if(!options.group_by.empty()){
+        auto g = document.find(options.group_by);
+        if(g != document.end()) group = *g;
+    }
+
+    string key = to_string(bucket);
+    string group_key = SecondaryIndex::make_key(group);
+
+    if(delta < 0 && !buckets.contains(key)) return;
+    HashMap<string, RollupCell>& groups = buckets[key];
+
+    if(!groups.contains(group_key)){
+        if(delta < 0) return;
+        RollupCell cell;
+        cell.group = group;
+        groups.insert(group_key, cell);
+        cells++;
+    }
+    RollupCell& cell = groups[group_key];
+    cell.count += delta;
+    if(cell.count > 0) return;
+
+    groups.erase(group_key);
+    cells--;
+    if(groups.size() == 0) buckets.erase(key);
+}
+
+void Rollup::clear(){
+    buckets.clear();
+    cells = 0;
+}
+
+bool Rollup::can_answer(const DateHistogram& histogram) const{
+    if(histogram.get_field() != options.field) return false;
+    if(histogram.get_interval() % interval != 0) return false;
+    if(!histogram.aligned(interval)) return false;
+    const string& group = histogram.get_group_field();
+    return group.empty() || group == options.group_by;
+}
+
+void Rollup::answer_bucket(long long bucket, const HashMap<string, RollupCell>& groups,
+                           bool grouped, DateHistogram& histogram) const{
+    for(auto it = groups.begin(); it != groups.end(); ++it){
+        const RollupCell& cell = (*it).value;
+        histogram.add(bucket * interval, grouped ? &cell.group : nullptr, cell.count);
+    }
+}
+
+void Rollup::answer(DateHistogram& histogram) const{
+    bool grouped = !histogram.get_group_field().empty();
+    long long from = 0, to = 0;
+    bool has_from = histogram.get_from(from);
+    bool has_to = histogram.get_to(to);
+    // Границы выровнены по интервалу свёртки (см. can_answer)
+    long long first = has_from ? from / interval : 0;
+    long long last = has_to ? to / interval - 1 : 0;
+
+    if(has_from && has_to && last - first + 1 <= (long long)buckets.size()){
+        for(long long b = first; b <= last; b++){
+            const HashMap<string, RollupCell>* groups = buckets.get(to_string(b));
+            if(groups) answer_bucket(b, *groups, grouped, histogram);
+        }
+        return;
+    }
+
+    for(auto it = buckets.begin(); it != buckets.end(); ++it){
+        KeyValue<string, HashMap<string, RollupCell>> entry = *it;
+        long long b = stoll(entry.key);
+        if(has_from && b < first) continue;
+        if(has_to && b > last) continue;
+        answer_bucket(b, entry.value, grouped, histogram);
+    }
+}
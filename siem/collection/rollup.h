@@ -0,0 +1,52 @@
+#pragma once
+#include <string>
+#include "../containers/vector.h"
+#include "../containers/hash_map.h"
+#include "../include/json.hpp"
+#include "../schema/schema.h"
+#include "date_histogram.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+// Счётчик одного интервала времени для одного значения group_by
+struct RollupCell {
+    json group;
+    long long count;
+
+    RollupCell() : count(0) {}
+};
+
+// Свёртка коллекции из schema.json: число документов по интервалам поля
+// времени и значениям group_by. Ведётся при вставке и удалении, поэтому
+// гистограмма по ней строится за число ячеек, а не за число документов.
+class Rollup {
+private:
+    RollupOptions options;
+    long long interval;
+    // Номер интервала -> ключ значения group_by -> счётчик; ячейки с нулём
+    // удаляются, поэтому хранятся только непустые интервалы
+    HashMap<string, HashMap<string, RollupCell>> buckets;
+    unsigned int cells;
+
+    void answer_bucket(long long bucket, const HashMap<string, RollupCell>& groups,
+                       bool grouped, DateHistogram& histogram) const;
+
+public:
+    Rollup() : interval(0), cells(0) {}
+    explicit Rollup(const RollupOptions& options);
+
+    const RollupOptions& get_options() const { return options; }
+    unsigned int size() const { return cells; }
+
+    void collect_fields(Vector<string>& fields) const;
+    // delta = 1 при вставке документа, -1 при удалении
+    void add(const json& document, long long delta);
+    void clear();
+
+    // Свёртка даёт точный ответ: то же поле, интервал кратен интервалу
+    // свёртки, границы from/to выровнены по нему, group_by нет или совпадает
+    bool can_answer(const DateHistogram& histogram) const;
+    // Обходит только интервалы в пределах from/to (или все хранимые, если их меньше)
+    void answer(DateHistogram& histogram) const;
+};
@@ -0,0 +1,105 @@
+#include "scan_executor.h"
+
+using namespace std;
+
+unsigned int ScanExecutor::default_threads = 0;
+
+ScanExecutor::ScanExecutor(unsigned int threads)
+    : task(nullptr), next_task(0), task_count(0), unfinished(0), generation(0), stopping(false){
+    for(unsigned int i = 1; i < threads; i++){
+        workers.push_back(new thread(&ScanExecutor::worker_loop, this));
+    }
+}
+
+ScanExecutor::~ScanExecutor(){
+    {
+        lock_guard<mutex> lock(m);
+        stopping = true;
+    }
+    work_cv.notify_all();
+    for(unsigned int i = 0; i < workers.get_size(); i++){
+        workers[i]->join();
+        delete workers[i];
+    }
+}
+
+void ScanExecutor::execute(unsigned int index){
+    try{
+        (*task)(index);
+    }catch(...){
+        lock_guard<mutex> lock(m);
+        if(!error) error = current_exception();
+    }
+
+    lock_guard<mutex> lock(m);
+    if(--unfinished == 0) done_cv.notify_all();
+}
+
+void ScanExecutor::worker_loop(){
+    unsigned long long seen = 0;
+    while(true){
+        unsigned int index;
+        {
+            unique_lock<mutex> lock(m);
+            work_cv.wait(lock, [&](){
+                return stopping || (generation != seen && next_task < task_count);
+            });
+            if(stopping) return;
+            index = next_task++;
+            if(next_task >= task_count) seen = generation;
+        }
+        execute(index);
+    }
+}
+
+void ScanExecutor::run(unsigned int count, const function<void(unsigned int)>& fn){
+    if(count == 0) return;
+
+    lock_guard<mutex> run_lock(run_mutex);
+    if(workers.empty() || count == 1){
+        for(unsigned int i = 0; i < count; i++) fn(i);
+        return;
+    }
+
+    {
+        lock_guard<mutex> lock(m);
+        task = &fn;
+        next_task = 0;
+        task_count = count;
+        unfinished = count;
+        error = nullptr;
+        generation++;
+    }
+    work_cv.notify_all();
+
+    // Вызывающий поток тоже разбирает задачи
+    while(true){
+        unsigned int index;
+        {
+            lock_guard<mutex> lock(m);
+            if(next_task >= task_count) break;
+            index = next_task++;
+        }
+        execute(index);
+    }
+
+    unique_lock<mutex> lock(m);
+    done_cv.wait(lock, [&](){ return unfinished == 0; });
+    task = nullptr;
+    task_count = 0;
+    if(error){
+        exception_ptr e = error;
+        error = nullptr;
+        rethrow_exception(e);
+    }
+}
+
+void ScanExecutor::set_default_threads(unsigned int threads){
+    default_threads = threads;
+}
+
+ScanExecutor& ScanExecutor::shared(){
+    static ScanExecutor executor(default_threads > 0 ? default_threads
+                                 : (thread::hardware_concurrency() > 0 ? thread::hardware_concurrency() : 1));
+    return executor;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include "../containers/vector.h"
+
+using namespace std;
+
+// Пул потоков для параллельного чтения сегментов. run раздаёт номера задач
+// 0..count-1 потокам пула (и вызывающему потоку) и возвращается, когда все
+// задачи выполнены. Первое исключение из задачи пробрасывается вызывающему.
+class ScanExecutor {
+private:
+    Vector<thread*> workers;
+    mutex m;
+    mutex run_mutex;
+    condition_variable work_cv;
+    condition_variable done_cv;
+
+    const function<void(unsigned int)>* task;
+    unsigned int next_task;
+    unsigned int task_count;
+    unsigned int unfinished;
+    unsigned long long generation;
+    exception_ptr error;
+    bool stopping;
+
+    void worker_loop();
+    void execute(unsigned int index);
+
+    static unsigned int default_threads;
+
+public:
+    explicit ScanExecutor(unsigned int threads);
+    ~ScanExecutor();
+
+    ScanExecutor(const ScanExecutor&) = delete;
+    ScanExecutor& operator=(const ScanExecutor&) = delete;
+
+    void run(unsigned int count, const function<void(unsigned int)>& fn);
+    unsigned int get_threads() const { return workers.get_size() + 1; }
+
+    // Общий пул процесса; число потоков задаётся до первого обращения
+    static void set_default_threads(unsigned int threads);
+    static ScanExecutor& shared();
+};
@@ -0,0 +1,55 @@
+#include "secondary_index.h"
+#include <cmath>
+
+using namespace std;
+using json = nlohmann::json;
+
+// Ключ совпадает для значений, равных с точки зрения json ==: 5 и 5.0 дают "5"
+string SecondaryIndex::make_key(const json& value){
+    if(value.is_number_float()){
+        double d = value.get<double>();
+        if(std::floor(d) == d && std::fabs(d) < 9.0e15){
+            return json((long long)d).dump();
+        }
+    }
+    return value.dump(-1, ' ', false, json::error_handler_t::replace);
+}
+
+void SecondaryIndex::add(const string& field, const json& value, unsigned int ordinal){
+    fields[field][make_key(value)].push_back(ordinal);
+}
+
+void SecondaryIndex::lookup(const string& field, const json& value, Vector<unsigned int>& out) const{
+    const HashMap<string, Vector<unsigned int>>* values = fields.get(field);
+    if(!values) return;
+
+    const Vector<unsigned int>* postings = values->get(make_key(value));
+    if(postings) out = *postings;
+}
+
+json SecondaryIndex::save() const{
+    json state = json::object();
+    for(auto it = fields.begin(); it != fields.end(); ++it){
+        KeyValue<string, HashMap<string, Vector<unsigned int>>> field = *it;
+        json values = json::object();
+        for(auto v = field.value.begin(); v != field.value.end(); ++v){
+            KeyValue<string, Vector<unsigned int>> entry = *v;
+            json ordinals = json::array();
+            for(unsigned int i = 0; i < entry.value.get_size(); i++) ordinals.push_back(entry.value[i]);
+            values[entry.key] = ordinals;
+        }
+        state[field.key] = values;
+    }
+    return state;
+}
+
+void SecondaryIndex::load(const json& state){
+    fields.clear();
+    for(auto it = state.begin(); it != state.end(); ++it){
+        HashMap<string, Vector<unsigned int>>& values = fields[it.key()];
+        for(auto v = it.value().begin(); v != it.value().end(); ++v){
+            Vector<unsigned int>& ordinals = values[v.key()];
+            for(const auto& ordinal : v.value()) ordinals.push_back(ordinal.get<unsigned int>());
+        }
+    }
+}
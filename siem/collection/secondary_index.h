@@ -0,0 +1,26 @@
+#pragma once
+#include <string>
+#include "../containers/vector.h"
+#include "../containers/hash_map.h"
+#include "../include/json.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+// Вторичный индекс одного сегмента: поле -> значение -> порядковые номера записей.
+// Номера добавляются по возрастанию, поэтому списки всегда отсортированы.
+class SecondaryIndex {
+private:
+    HashMap<string, HashMap<string, Vector<unsigned int>>> fields;
+
+public:
+    static string make_key(const json& value);
+
+    void add(const string& field, const json& value, unsigned int ordinal);
+    void clear() { fields.clear(); }
+    void lookup(const string& field, const json& value, Vector<unsigned int>& out) const;
+
+    // Состояние для файла индексов сегмента: {поле: {ключ: [номера]}}
+    json save() const;
+    void load(const json& state);
+};
@@ -0,0 +1,699 @@
+#include "segment.h"
+#include "field_parser.h"
+#include "prefilter.h"
+#include <fstream>
+#include <filesystem>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+namespace fs = filesystem;
+using json = nlohmann::json;
+
+static const char SEGMENT_MAGIC[4] = {'S', 'S', 'E', 'G'};
+static const long long HEADER_SIZE = 5;
+static const char TOMBSTONE_MAGIC[4] = {'S', 'D', 'E', 'L'};
+
+static void write_u32(ostream& out, unsigned int v){
+    char b[4];
+    b[0] = (char)(v & 0xFF);
+    b[1] = (char)((v >> 8) & 0xFF);
+    b[2] = (char)((v >> 16) & 0xFF);
+    b[3] = (char)((v >> 24) & 0xFF);
+    out.write(b, 4);
+}
+
+static bool read_u32(istream& in, unsigned int& v){
+    unsigned char b[4];
+    if(!in.read((char*)b, 4)) return false;
+    v = (unsigned int)b[0] | ((unsigned int)b[1] << 8) |
+        ((unsigned int)b[2] << 16) | ((unsigned int)b[3] << 24);
+    return true;
+}
+
+static void fsync_file(const string& path){
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) return;
+    fsync(fd);
+    ::close(fd);
+}
+
+SegmentEncoding parse_segment_encoding(const string& s){
+    if(s == "json") return SegmentEncoding::Json;
+    if(s == "cbor") return SegmentEncoding::Cbor;
+    if(s == "msgpack") return SegmentEncoding::MsgPack;
+    throw runtime_error("неизвестное кодирование сегмента: " + s + " (json|cbor|msgpack)");
+}
+
+static string encode_document(const json& document, SegmentEncoding encoding){
+    if(encoding == SegmentEncoding::Cbor){
+        vector<uint8_t> bytes = json::to_cbor(document);
+        return string(bytes.begin(), bytes.end());
+    }
+    if(encoding == SegmentEncoding::MsgPack){
+        vector<uint8_t> bytes = json::to_msgpack(document);
+        return string(bytes.begin(), bytes.end());
+    }
+    return document.dump(-1, ' ', false, json::error_handler_t::replace);
+}
+
+static json decode_document(const string& payload, SegmentEncoding encoding){
+    if(encoding == SegmentEncoding::Cbor) return json::from_cbor(payload.begin(), payload.end());
+    if(encoding == SegmentEncoding::MsgPack) return json::from_msgpack(payload.begin(), payload.end());
+    return json::parse(payload);
+}
+
+// С fields строятся только перечисленные поля (см. parse_fields)
+static json decode_document(const string& payload, SegmentEncoding encoding, const Vector<string>* fields){
+    if(!fields) return decode_document(payload, encoding);
+    json::input_format_t format = encoding == SegmentEncoding::Cbor ? json::input_format_t::cbor
+                                : encoding == SegmentEncoding::MsgPack ? json::input_format_t::msgpack
+                                : json::input_format_t::json;
+    return parse_fields(payload, format, *fields);
+}
+
+Segment::Segment(int number, const string& path, SegmentEncoding encoding)
+    : number(number), path(path), encoding(encoding), columnar(false), rows(0), offsets_loaded(true),
+      offsets_mutex(make_shared<mutex>()), bytes(0), dead(0), indexes_saved(false) {}
+
+// Файл пометок об удалении N.del: заголовок [SDEL][u32 записей][u32+u32 байт]
+// и номера удалённых записей, по u32 на запись
+string Segment::get_tombstone_path() const{
+    return path.substr(0, path.find_last_of('.')) + ".del";
+}
+
+// Файл индексов N.idx (см. save_indexes), CBOR
+string Segment::get_index_path() const{
+    return path.substr(0, path.find_last_of('.')) + ".idx";
+}
+
+void Segment::drop_indexes() const{
+    indexes_saved = false;
+    error_code ec;
+    fs::remove(get_index_path(), ec);
+}
+
+void Segment::save_indexes(const json& config, const json& ids) const{
+    json state = {
+        {"config", config},
+        {"columnar", columnar},
+        {"rows", size()},
+        {"bytes", bytes},
+        {"ids", ids},
+        {"index", index.save()},
+        {"text", text.save()},
+        {"trigram", trigram.save()},
+        {"distinct", distinct.save()},
+        {"zones", zones.save()},
+        {"partition", partition}
+    };
+    vector<uint8_t> data = json::to_cbor(state);
+
+    string index_path = get_index_path();
+    string tmp_path = index_path + ".tmp";
+    {
+        ofstream out(tmp_path, ios::binary | ios::trunc);
+        if(!out.is_open()) return;
+        out.write((const char*)data.data(), (streamsize)data.size());
+        out.close();
+        if(!out) return;
+    }
+    fs::rename(tmp_path, index_path);
+    indexes_saved = true;
+}
+
+bool Segment::load_indexes(const json& config, json& ids){
+    ifstream in(get_index_path(), ios::binary);
+    if(!in.is_open()) return false;
+
+    try{
+        json state = json::from_cbor(in);
+        if(state.at("config") != config || state.at("columnar").get<bool>() != columnar ||
+           state.at("rows").get<unsigned int>() != size() || state.at("bytes").get<long long>() != bytes){
+            return false;
+        }
+        index.load(state.at("index"));
+        text.load(state.at("text"));
+        trigram.load(state.at("trigram"));
+        distinct.load(state.at("distinct"));
+        zones.load(state.at("zones"));
+        partition = state.at("partition").get<string>();
+        ids = move(state.at("ids"));
+        indexes_saved = true;
+    }catch(const exception&){
+        index.clear();
+        text.clear();
+        trigram.clear();
+        distinct.clear();
+        zones.clear();
+        return false;
+    }
+    return true;
+}
+
+void Segment::write_tombstone_header(ostream& out) const{
+    out.write(TOMBSTONE_MAGIC, 4);
+    write_u32(out, size());
+    write_u32(out, (unsigned int)(bytes & 0xFFFFFFFF));
+    write_u32(out, (unsigned int)(bytes >> 32));
+}
+
+// Номера в N.del относятся к той версии файла данных, для которой он записан.
+// Перезапись сегмента выбрасывает помеченные записи, поэтому новый файл всегда
+// короче; перед заменой файла заголовок N.del обновляется до текущего размера
+// (stamp_tombstones), и N.del, оставшийся после сбоя между заменой и его
+// удалением, не проходит проверку и удаляется. Дописывание в активный сегмент
+// только увеличивает размер и пометки не отменяет.
+void Segment::load_tombstones(){
+    deleted.clear();
+    dead = 0;
+
+    ifstream in(get_tombstone_path(), ios::binary);
+    if(!in.is_open()) return;
+
+    char magic[4];
+    bool stamped = in.read(magic, 4) && string(magic, 4) == string(TOMBSTONE_MAGIC, 4);
+    if(stamped){
+        unsigned int rows = 0, low = 0, high = 0;
+        bool valid = read_u32(in, rows) && read_u32(in, low) && read_u32(in, high);
+        long long stamped_bytes = (long long)low | ((long long)high << 32);
+        if(!valid || rows > size() || stamped_bytes > bytes){
+            in.close();
+            fs::remove(get_tombstone_path());
+            return;
+        }
+    }else{
+        in.clear();
+        in.seekg(0);
+    }
+
+    Vector<unsigned int> ordinals;
+    unsigned int ordinal = 0;
+    while(read_u32(in, ordinal)){
+        if(ordinal >= size() || is_deleted(ordinal)) continue;
+        while(deleted.get_size() <= ordinal) deleted.push_back(false);
+        deleted[ordinal] = true;
+        dead++;
+        ordinals.push_back(ordinal);
+    }
+    in.close();
+
+    // Файл прежнего формата без заголовка переписывается с заголовком
+    if(!stamped){
+        string tmp_path = get_tombstone_path() + ".tmp";
+        {
+            ofstream out(tmp_path, ios::binary | ios::trunc);
+            if(!out.is_open()) return;
+            write_tombstone_header(out);
+            for(unsigned int i = 0; i < ordinals.get_size(); i++) write_u32(out, ordinals[i]);
+            out.close();
+            if(!out) return;
+        }
+        fsync_file(tmp_path);
+        fs::rename(tmp_path, get_tombstone_path());
+    }
+}
+
+// Вызывается перед заменой файла данных (см. load_tombstones)
+void Segment::stamp_tombstones() const{
+    string tombstone_path = get_tombstone_path();
+    if(!fs::exists(tombstone_path)) return;
+    {
+        fstream out(tombstone_path, ios::binary | ios::in | ios::out);
+        if(!out.is_open()){
+            throw runtime_error("Не удалось открыть файл удалений " + tombstone_path);
+        }
+        write_tombstone_header(out);
+        out.close();
+        if(!out){
+            throw runtime_error("Ошибка записи в файл удалений " + tombstone_path);
+        }
+    }
+    fsync_file(tombstone_path);
+}
+
+void Segment::drop_tombstones(){
+    deleted.clear();
+    dead = 0;
+    fs::remove(get_tombstone_path());
+}
+
+void Segment::remove_files(){
+    fs::remove(path);
+    drop_tombstones();
+    drop_indexes();
+}
+
+void Segment::mark_deleted(const Vector<unsigned int>& ordinals){
+    error_code ec;
+    bool exists = fs::exists(get_tombstone_path(), ec);
+    ofstream out(get_tombstone_path(), ios::binary | ios::app);
+    if(!out.is_open()){
+        throw runtime_error("Не удалось открыть файл удалений " + get_tombstone_path());
+    }
+    if(!exists) write_tombstone_header(out);
+    for(unsigned int i = 0; i < ordinals.get_size(); i++){
+        unsigned int ordinal = ordinals[i];
+        if(ordinal >= size() || is_deleted(ordinal)) continue;
+        write_u32(out, ordinal);
+        while(deleted.get_size() <= ordinal) deleted.push_back(false);
+        deleted[ordinal] = true;
+        dead++;
+    }
+    out.close();
+    if(!out){
+        throw runtime_error("Ошибка записи в файл удалений " + get_tombstone_path());
+    }
+}
+
+void Segment::write_header(ostream& out) const{
+    out.write(SEGMENT_MAGIC, 4);
+    out.put((char)encoding);
+}
+
+void Segment::create(){
+    ofstream out(path, ios::binary | ios::trunc);
+    if(!out.is_open()){
+        throw runtime_error("Не удалось создать сегмент " + path);
+    }
+    write_header(out);
+    out.close();
+
+    columnar = false;
+    rows = 0;
+    offsets.clear();
+    offsets_loaded = true;
+    drop_tombstones();
+    drop_indexes();
+    index.clear();
+    zones.clear();
+    partition = "";
+    bytes = HEADER_SIZE;
+}
+
+// Записи [u32 длина][документ] от pos до конца файла; возвращает конец
+// последней целой записи, count - число целых записей
+long long Segment::scan_records(istream& in, long long pos, long long file_size, unsigned int& count) const{
+    count = 0;
+    in.clear();
+    in.seekg(pos);
+    while(pos < file_size){
+        unsigned int len = 0;
+        if(!read_u32(in, len)) break;
+        if(pos + 4 + (long long)len > file_size) break;
+        if(offsets_loaded) offsets.push_back(pos);
+        count++;
+        pos += 4 + (long long)len;
+        in.seekg(pos);
+    }
+    return pos;
+}
+
+void Segment::open(){
+    open(0, -1, SegmentEncoding::Json);
+}
+
+void Segment::open(unsigned int known_rows, long long known_bytes, SegmentEncoding known_encoding){
+    offsets.clear();
+    offsets_loaded = true;
+    rows = 0;
+
+    ifstream in(path, ios::binary);
+    if(!in.is_open()){
+        throw runtime_error("Не удалось открыть сегмент " + path);
+    }
+
+    char magic[4];
+    if(!in.read(magic, 4)){
+        throw runtime_error("Файл " + path + " не является сегментом коллекции");
+    }
+    if(string(magic, 4) == "SCOL"){
+        in.close();
+        columnar = true;
+        columns.open(path);
+        bytes = (long long)fs::file_size(path);
+        load_tombstones();
+        return;
+    }
+    if(string(magic, 4) != string(SEGMENT_MAGIC, 4)){
+        throw runtime_error("Файл " + path + " не является сегментом коллекции");
+    }
+    int code = in.get();
+    if(code != (int)SegmentEncoding::Json && code != (int)SegmentEncoding::Cbor &&
+       code != (int)SegmentEncoding::MsgPack){
+        throw runtime_error("Неизвестное кодирование записей в сегменте " + path);
+    }
+    encoding = (SegmentEncoding)code;
+    columnar = false;
+
+    long long file_size = (long long)fs::file_size(path);
+    long long pos = HEADER_SIZE;
+
+    // Описание из манифеста годится, если файл не короче и записи в нём
+    // помещаются; перезапись сегмента всегда меняет размер или кодирование
+    if(known_bytes >= HEADER_SIZE && known_bytes <= file_size && known_encoding == encoding &&
+       (long long)known_rows * 4 <= known_bytes - HEADER_SIZE){
+        offsets_loaded = false;
+        rows = known_rows;
+        pos = known_bytes;
+    }
+    unsigned int tail = 0;
+    pos = scan_records(in, pos, file_size, tail);
+    rows += tail;
+
+    // Обрывок в хвосте отрезается только по полному перебору записей
+    if(pos < file_size && !offsets_loaded){
+        offsets_loaded = true;
+        pos = scan_records(in, HEADER_SIZE, file_size, rows);
+    }
+    in.close();
+
+    // Недописанная запись в хвосте (сбой во время вставки) отбрасывается
+    if(pos < file_size){
+        fs::resize_file(path, (uintmax_t)pos);
+    }
+    bytes = pos;
+    load_tombstones();
+}
+
+void Segment::load_offsets() const{
+    if(columnar) return;
+    lock_guard<mutex> lock(*offsets_mutex);
+    if(offsets_loaded) return;
+
+    ifstream in(path, ios::binary);
+    if(!in.is_open()){
+        throw runtime_error("Не удалось открыть сегмент " + path);
+    }
+    offsets_loaded = true;
+    offsets.clear();
+    unsigned int count = 0;
+    long long end = scan_records(in, HEADER_SIZE, bytes, count);
+    if(count != rows || end != bytes){
+        offsets.clear();
+        offsets_loaded = false;
+        throw runtime_error("Записи сегмента " + path + " не совпадают с описанием в манифесте");
+    }
+}
+
+long long Segment::append(const json& document){
+    if(columnar){
+        throw runtime_error("Колоночный сегмент " + path + " запечатан для записи");
+    }
+    string payload = encode_document(document, encoding);
+
+    ofstream out(path, ios::binary | ios::app);
+    if(!out.is_open()){
+        throw runtime_error("Не удалось открыть сегмент для записи " + path);
+    }
+    write_u32(out, (unsigned int)payload.size());
+    out.write(payload.data(), (streamsize)payload.size());
+    out.close();
+    if(!out){
+        throw runtime_error("Ошибка записи в сегмент " + path);
+    }
+
+    long long offset = bytes;
+    if(offsets_loaded) offsets.push_back(offset);
+    rows++;
+    bytes += 4 + (long long)payload.size();
+    return offset;
+}
+
+void Segment::rewrite(const Vector<json>& documents){
+    string tmp_path = path + ".tmp";
+
+    if(columnar){
+        ColumnFile::write(tmp_path, columns.get_column_names(), documents);
+        fsync_file(tmp_path);
+        stamp_tombstones();
+        fs::rename(tmp_path, path);
+        columns.open(path);
+        bytes = (long long)fs::file_size(path);
+        drop_tombstones();
+        drop_indexes();
+        return;
+    }
+
+    Vector<long long> new_offsets;
+    long long pos = HEADER_SIZE;
+
+    {
+        ofstream out(tmp_path, ios::binary | ios::trunc);
+        if(!out.is_open()){
+            throw runtime_error("Не удалось открыть сегмент для записи " + tmp_path);
+        }
+        write_header(out);
+        for(unsigned int i = 0; i < documents.get_size(); i++){
+            string payload = encode_document(documents[i], encoding);
+            write_u32(out, (unsigned int)payload.size());
+            out.write(payload.data(), (streamsize)payload.size());
+            new_offsets.push_back(pos);
+            pos += 4 + (long long)payload.size();
+        }
+        out.close();
+        if(!out){
+            throw runtime_error("Ошибка записи в сегмент " + tmp_path);
+        }
+    }
+
+    fsync_file(tmp_path);
+    stamp_tombstones();
+    fs::rename(tmp_path, path);
+    offsets = new_offsets;
+    offsets_loaded = true;
+    rows = documents.get_size();
+    bytes = pos;
+    drop_tombstones();
+    drop_indexes();
+}
+
+// Переводит заполненный сегмент в колоночный файл column_path и удаляет N.seg.
+// Файл N.col появляется атомарно (rename), поэтому при сбое остаётся одна из копий.
+// Помеченные записи в N.col не попадают, и N.del, оставшийся после сбоя,
+// отбрасывается при открытии по заголовку (см. load_tombstones).
+void Segment::seal_columnar(const Vector<string>& column_names, const string& column_path){
+    if(columnar) return;
+
+    Vector<json> documents;
+    read_all(documents);
+
+    string tmp_path = column_path + ".tmp";
+    ColumnFile::write(tmp_path, column_names, documents);
+    fsync_file(tmp_path);
+    stamp_tombstones();
+    fs::rename(tmp_path, column_path);
+    fs::remove(path);
+    drop_tombstones();
+    drop_indexes();
+
+    path = column_path;
+    columnar = true;
+    columns.open(path);
+    offsets.clear();
+    offsets_loaded = true;
+    rows = 0;
+    bytes = (long long)fs::file_size(path);
+}
+
+void Segment::select_columns(const Vector<string>* fields, Vector<string>& out) const{
+    if(!fields){
+        out = columns.get_column_names();
+        out.push_back(ColumnFile::EXTRA_COLUMN);
+        return;
+    }
+
+    bool need_extra = false;
+    for(unsigned int i = 0; i < fields->get_size(); i++){
+        const string& field = (*fields)[i];
+        if(!columns.has_column(field) || field == ColumnFile::EXTRA_COLUMN){
+            need_extra = true;
+            continue;
+        }
+        bool seen = false;
+        for(unsigned int j = 0; j < out.get_size(); j++){
+            if(out[j] == field){ seen = true; break; }
+        }
+        if(!seen) out.push_back(field);
+    }
+    if(need_extra) out.push_back(ColumnFile::EXTRA_COLUMN);
+}
+
+void Segment::read_columns(const Vector<string>& names, unsigned int first, unsigned int count,
+                           Vector<Vector<json>>& values) const{
+    for(unsigned int c = 0; c < names.get_size(); c++){
+        values.push_back(Vector<json>());
+        columns.read_rows(names[c], first, count, values[values.get_size() - 1]);
+    }
+}
+
+void Segment::sync() const{
+    fsync_file(path);
+    if(dead > 0) fsync_file(get_tombstone_path());
+}
+
+void Segment::for_each(const function<bool(unsigned int, const json&)>& fn,
+                       const Vector<string>* fields, unsigned int start,
+                       const Prefilter* prefilter, unsigned int count) const{
+    unsigned int end = size();
+    if(count > 0 && start < end && count < end - start) end = start + count;
+    if(start >= end) return;
+
+    if(columnar){
+        Vector<string> names;
+        select_columns(fields, names);
+        Vector<Vector<json>> values;
+        read_columns(names, start, end - start, values);
+
+        for(unsigned int r = start; r < end; r++){
+            if(is_deleted(r)) continue;
+            json document = json::object();
+            for(unsigned int c = 0; c < names.get_size(); c++){
+                ColumnFile::assemble(document, names[c], values[c][r - start]);
+            }
+            if(!fn(r, document)) break;
+        }
+        return;
+    }
+
+    // С начала сегмента записи читаются подряд, смещения не нужны
+    if(start > 0) load_offsets();
+    ifstream in(path, ios::binary);
+    if(!in.is_open()) return;
+    in.seekg(start > 0 ? offsets[start] : HEADER_SIZE);
+
+    string payload;
+    for(unsigned int i = start; i < end; i++){
+        unsigned int len = 0;
+        if(!read_u32(in, len)) break;
+        if(is_deleted(i)){
+            in.seekg(len, ios::cur);
+            continue;
+        }
+        payload.resize(len);
+        if(!in.read(&payload[0], len)) break;
+        if(prefilter && !prefilter->may_match(payload)) continue;
+
+        json document;
+        try{
+            document = decode_document(payload, encoding, fields);
+        }catch(const exception&){
+            continue;
+        }
+        if(!fn(i, document)) break;
+    }
+}
+
+// Читает только записи с указанными номерами (по возрастанию), переходя к ним по смещениям
+void Segment::for_each_at(const Vector<unsigned int>& ordinals,
+                          const function<bool(unsigned int, const json&)>& fn,
+                          const Vector<string>* fields, const Prefilter* prefilter) const{
+    if(ordinals.empty()) return;
+
+    if(columnar){
+        Vector<string> names;
+        select_columns(fields, names);
+
+        // Номера идут по возрастанию; читается только диапазон между первым и
+        // последним, а немного строк в нём дешевле прочитать точечно
+        unsigned int first = ordinals[0];
+        if(first >= columns.get_rows()) return;
+        unsigned int last = ordinals[ordinals.get_size() - 1];
+        if(last >= columns.get_rows()) last = columns.get_rows() - 1;
+        if(last < first) last = first;
+        unsigned int span = last - first + 1;
+        if(ordinals.get_size() * 32 < span){
+            for(unsigned int i = 0; i < ordinals.get_size(); i++){
+                if(ordinals[i] >= columns.get_rows()) break;
+                if(is_deleted(ordinals[i])) continue;
+                json document = json::object();
+                for(unsigned int c = 0; c < names.get_size(); c++){
+                    ColumnFile::assemble(document, names[c], columns.read_value(names[c], ordinals[i]));
+                }
+                if(!fn(ordinals[i], document)) break;
+            }
+            return;
+        }
+
+        Vector<Vector<json>> values;
+        read_columns(names, first, span, values);
+        for(unsigned int i = 0; i < ordinals.get_size(); i++){
+            unsigned int r = ordinals[i];
+            if(r > last) break;
+            if(r < first || is_deleted(r)) continue;
+            json document = json::object();
+            for(unsigned int c = 0; c < names.get_size(); c++){
+                ColumnFile::assemble(document, names[c], values[c][r - first]);
+            }
+            if(!fn(r, document)) break;
+        }
+        return;
+    }
+
+    load_offsets();
+    ifstream in(path, ios::binary);
+    if(!in.is_open()) return;
+
+    string payload;
+    for(unsigned int i = 0; i < ordinals.get_size(); i++){
+        unsigned int ordinal = ordinals[i];
+        if(ordinal >= offsets.get_size()) break;
+        if(is_deleted(ordinal)) continue;
+        in.seekg(offsets[ordinal]);
+
+        unsigned int len = 0;
+        if(!read_u32(in, len)) break;
+        payload.resize(len);
+        if(!in.read(&payload[0], len)) break;
+        if(prefilter && !prefilter->may_match(payload)) continue;
+
+        json document;
+        try{
+            document = decode_document(payload, encoding, fields);
+        }catch(const exception&){
+            continue;
+        }
+        if(!fn(ordinal, document)) break;
+    }
+}
+
+void Segment::read_all(Vector<json>& out, Vector<unsigned int>* ordinals) const{
+    for_each([&](unsigned int ordinal, const json& document){
+        out.push_back(document);
+        if(ordinals) ordinals->push_back(ordinal);
+        return true;
+    });
+}
+
+json Segment::read_at(unsigned int ordinal) const{
+    if(is_deleted(ordinal)) return json();
+    if(columnar){
+        if(ordinal >= columns.get_rows()) return json();
+        Vector<string> names;
+        select_columns(nullptr, names);
+        json document = json::object();
+        for(unsigned int c = 0; c < names.get_size(); c++){
+            ColumnFile::assemble(document, names[c], columns.read_value(names[c], ordinal));
+        }
+        return document;
+    }
+
+    if(ordinal >= rows) return json();
+    load_offsets();
+
+    ifstream in(path, ios::binary);
+    if(!in.is_open()) return json();
+    in.seekg(offsets[ordinal]);
+
+    unsigned int len = 0;
+    if(!read_u32(in, len)) return json();
+    string payload(len, '\0');
+    if(!in.read(&payload[0], len)) return json();
+
+    try{
+        return decode_document(payload, encoding);
+    }catch(const exception&){
+        return json();
+    }
+}
@@ -0,0 +1,152 @@
+#pragma once
+#include <string>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include "../containers/vector.h"
+#include "../include/json.hpp"
+#include "secondary_index.h"
+#include "text_index.h"
+#include "trigram_index.h"
+#include "hyperloglog.h"
+#include "zone_map.h"
+#include "column_file.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+class Prefilter;
+
+// Кодирование записей в сегменте; хранится в байте заголовка файла
+enum class SegmentEncoding : unsigned char {
+    Json = 0,
+    Cbor = 1,
+    MsgPack = 2
+};
+
+SegmentEncoding parse_segment_encoding(const string& s);
+
+// Сегмент коллекции: файл N.seg из заголовка и записей вида [u32 длина][документ].
+// Вставка только дописывает запись в конец файла, поэтому стоит O(1) по вводу-выводу.
+// Запечатанный сегмент может быть переведён в колоночный файл N.col (см. ColumnFile);
+// тогда документы читаются только из нужных колонок, а дописывать в него нельзя.
+// Порядковые номера записей меняются только при перезаписи (rewrite, seal_columnar).
+class Segment {
+private:
+    int number;
+    string path;
+    SegmentEncoding encoding;
+    bool columnar;
+    ColumnFile columns;
+    // Число записей строкового сегмента и их смещения; смещения сегмента,
+    // открытого по манифесту, строятся при первом чтении по номеру (load_offsets)
+    unsigned int rows;
+    mutable Vector<long long> offsets;
+    mutable bool offsets_loaded;
+    // Куски одного сегмента читаются параллельно (см. Cursor::fill_window)
+    shared_ptr<mutex> offsets_mutex;
+    long long bytes;
+    Vector<bool> deleted;
+    unsigned int dead;
+    SecondaryIndex index;
+    TextIndex text;
+    TrigramIndex trigram;
+    DistinctSketches distinct;
+    ZoneMap zones;
+    string partition;
+    // Файл N.idx записан (или прочитан) и соответствует сегменту
+    mutable bool indexes_saved;
+
+    void write_header(ostream& out) const;
+    long long scan_records(istream& in, long long pos, long long file_size, unsigned int& count) const;
+    void load_offsets() const;
+    string get_tombstone_path() const;
+    string get_index_path() const;
+    void drop_indexes() const;
+    void write_tombstone_header(ostream& out) const;
+    void load_tombstones();
+    void stamp_tombstones() const;
+    void drop_tombstones();
+    void select_columns(const Vector<string>* fields, Vector<string>& out) const;
+    void read_columns(const Vector<string>& names, unsigned int first, unsigned int count,
+                      Vector<Vector<json>>& values) const;
+
+public:
+    Segment() : number(0), path(""), encoding(SegmentEncoding::Json), columnar(false), rows(0),
+                offsets_loaded(true), offsets_mutex(make_shared<mutex>()), bytes(0), dead(0),
+                indexes_saved(false) {}
+    Segment(int number, const string& path, SegmentEncoding encoding = SegmentEncoding::Json);
+
+    void create();
+    void open();
+    // Открытие по описанию из манифеста: первые known_rows записей занимают
+    // known_bytes байт файла в кодировании known_encoding. Если это так, перебираются
+    // только записи, дописанные после (и недописанная в хвосте); иначе как open()
+    void open(unsigned int known_rows, long long known_bytes, SegmentEncoding known_encoding);
+
+    long long append(const json& document);
+    void rewrite(const Vector<json>& documents);
+    void seal_columnar(const Vector<string>& column_names, const string& column_path);
+    void sync() const;
+    // Удаляет файлы сегмента (данные, N.del и N.idx); объект после этого не используется
+    void remove_files();
+
+    // Файл N.idx: индексы, зоны и партиция сегмента, в который больше не вставляют,
+    // чтобы открытие коллекции не перечитывало его записи. config - настройки
+    // индексов коллекции, ids - _id по номерам записей (null для удалённых).
+    // Перезапись сегмента удаляет файл.
+    void save_indexes(const json& config, const json& ids) const;
+    // false - файла нет, он от другой версии сегмента или других настроек
+    bool load_indexes(const json& config, json& ids);
+    bool has_saved_indexes() const { return indexes_saved; }
+
+    // Удаление помечает записи в N.del, не переписывая сегмент; помеченные
+    // записи пропускаются при чтении и исчезают при следующей перезаписи
+    void mark_deleted(const Vector<unsigned int>& ordinals);
+    bool is_deleted(unsigned int ordinal) const { return ordinal < deleted.get_size() && deleted[ordinal]; }
+    unsigned int dead_count() const { return dead; }
+    unsigned int live_size() const { return size() - dead; }
+
+    // fields ограничивает набор полей верхнего уровня, которые нужно прочитать:
+    // колоночный сегмент читает только их колонки, строковый строит только их
+    // при разборе записи; nullptr означает документ целиком.
+    // start - номер записи, с которой продолжить чтение, count - сколько записей
+    // (не документов) просмотреть, 0 - до конца сегмента.
+    // prefilter отсеивает записи строкового сегмента по байтам до разбора
+    void for_each(const function<bool(unsigned int, const json&)>& fn,
+                  const Vector<string>* fields = nullptr, unsigned int start = 0,
+                  const Prefilter* prefilter = nullptr, unsigned int count = 0) const;
+    void for_each_at(const Vector<unsigned int>& ordinals,
+                     const function<bool(unsigned int, const json&)>& fn,
+                     const Vector<string>* fields = nullptr,
+                     const Prefilter* prefilter = nullptr) const;
+    void read_all(Vector<json>& out, Vector<unsigned int>* ordinals = nullptr) const;
+    json read_at(unsigned int ordinal) const;
+
+    int get_number() const { return number; }
+    string get_path() const { return path; }
+    bool is_columnar() const { return columnar; }
+    SegmentEncoding get_encoding() const { return encoding; }
+    // Новое кодирование применяется при следующей перезаписи (rewrite)
+    void set_encoding(SegmentEncoding e) { encoding = e; }
+    unsigned int size() const { return columnar ? columns.get_rows() : rows; }
+    // -1 - смещение неизвестно (колоночный сегмент или смещения ещё не построены)
+    long long get_offset(unsigned int ordinal) const {
+        return columnar || !offsets_loaded ? -1 : offsets[ordinal];
+    }
+    long long get_bytes() const { return bytes; }
+
+    SecondaryIndex& get_index() { return index; }
+    const SecondaryIndex& get_index() const { return index; }
+    TextIndex& get_text_index() { return text; }
+    const TextIndex& get_text_index() const { return text; }
+    TrigramIndex& get_trigram_index() { return trigram; }
+    const TrigramIndex& get_trigram_index() const { return trigram; }
+    DistinctSketches& get_distinct() { return distinct; }
+    const DistinctSketches& get_distinct() const { return distinct; }
+    ZoneMap& get_zones() { return zones; }
+    const ZoneMap& get_zones() const { return zones; }
+
+    string get_partition() const { return partition; }
+    void set_partition(const string& p) { partition = p; }
+};
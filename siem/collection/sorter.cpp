@@ -0,0 +1,237 @@
+#include "sorter.h"
+#include <fstream>
+#include <filesystem>
+#include <atomic>
+#include <stdexcept>
+
+using namespace std;
+namespace fs = filesystem;
+using json = nlohmann::json;
+
+static atomic<unsigned long long> g_run_counter(0);
+
+Sorter::Sorter(const json& rules, unsigned int limit, const string& spill_dir, unsigned int run_size)
+    : rules(rules), limit(limit), run_size(run_size > 0 ? run_size : 1), spill_dir(spill_dir),
+      next_sequence(0) {}
+
+Sorter::~Sorter(){
+    remove_runs();
+}
+
+bool Sorter::less(const json& a, const json& b, const json& rules){
+    for(auto& [field, direction] : rules.items()){
+        auto ia = a.find(field);
+        auto ib = b.find(field);
+        bool has_a = ia != a.end();
+        bool has_b = ib != b.end();
+        if(!has_a && !has_b) continue;
+        if(!has_a) return false;
+        if(!has_b) return true;
+
+        if(*ia < *ib) return direction == 1;
+        if(*ib < *ia) return direction == -1;
+    }
+    return false;
+}
+
+// При равенстве по правилам раньше идёт документ, поступивший раньше
+bool Sorter::before(unsigned int a, unsigned int b) const{
+    if(less(buffer[a], buffer[b], rules)) return true;
+    if(less(buffer[b], buffer[a], rules)) return false;
+    return sequence[a] < sequence[b];
+}
+
+void Sorter::swap_entries(unsigned int a, unsigned int b){
+    buffer[a].swap(buffer[b]);
+    unsigned long long t = sequence[a];
+    sequence[a] = sequence[b];
+    sequence[b] = t;
+}
+
+// Куча для limit: на вершине худший из отобранных документов
+void Sorter::sift_up(unsigned int i){
+    while(i > 0){
+        unsigned int parent = (i - 1) / 2;
+        if(!before(parent, i)) break;
+        swap_entries(parent, i);
+        i = parent;
+    }
+}
+
+void Sorter::sift_down(unsigned int i){
+    unsigned int n = buffer.get_size();
+    while(true){
+        unsigned int worst = i;
+        unsigned int l = 2 * i + 1;
+        unsigned int r = 2 * i + 2;
+        if(l < n && before(worst, l)) worst = l;
+        if(r < n && before(worst, r)) worst = r;
+        if(worst == i) break;
+        swap_entries(i, worst);
+        i = worst;
+    }
+}
+
+void Sorter::add(const json& document){
+    if(limit > 0){
+        if(buffer.get_size() < limit){
+            buffer.push_back(document);
+            sequence.push_back(next_sequence++);
+            sift_up(buffer.get_size() - 1);
+            return;
+        }
+        // Новый документ поступил позже всех в куче, при равенстве он хуже вершины
+        if(!less(document, buffer[0], rules)){
+            next_sequence++;
+            return;
+        }
+        buffer[0] = document;
+        sequence[0] = next_sequence++;
+        sift_down(0);
+        return;
+    }
+
+    buffer.push_back(document);
+    sequence.push_back(next_sequence++);
+    if(buffer.get_size() >= run_size) spill();
+}
+
+// Сортировка слиянием номеров записей буфера, сами документы не копируются
+void Sorter::sorted_order(Vector<unsigned int>& order) const{
+    unsigned int n = buffer.get_size();
+    order.clear();
+    for(unsigned int i = 0; i < n; i++) order.push_back(i);
+
+    Vector<unsigned int> merged = order;
+    for(unsigned int width = 1; width < n; width *= 2){
+        for(unsigned int lo = 0; lo < n; lo += 2 * width){
+            unsigned int mid = lo + width < n ? lo + width : n;
+            unsigned int hi = lo + 2 * width < n ? lo + 2 * width : n;
+            unsigned int i = lo, j = mid, k = lo;
+            while(i < mid && j < hi){
+                if(before(order[j], order[i])) merged[k++] = order[j++];
+                else merged[k++] = order[i++];
+            }
+            while(i < mid) merged[k++] = order[i++];
+            while(j < hi) merged[k++] = order[j++];
+        }
+        order = merged;
+    }
+}
+
+static void write_record(ostream& out, const json& document){
+    vector<uint8_t> bytes = json::to_cbor(document);
+    unsigned int len = (unsigned int)bytes.size();
+    char b[4] = {(char)(len & 0xFF), (char)((len >> 8) & 0xFF),
+                 (char)((len >> 16) & 0xFF), (char)((len >> 24) & 0xFF)};
+    out.write(b, 4);
+    out.write((const char*)bytes.data(), (streamsize)bytes.size());
+}
+
+static bool read_record(istream& in, json& document){
+    unsigned char b[4];
+    if(!in.read((char*)b, 4)) return false;
+    unsigned int len = (unsigned int)b[0] | ((unsigned int)b[1] << 8) |
+                       ((unsigned int)b[2] << 16) | ((unsigned int)b[3] << 24);
+    string payload(len, '\0');
+    if(len > 0 && !in.read(&payload[0], len)) return false;
+    document = json::from_cbor(payload.begin(), payload.end());
+    return true;
+}
+
+// Отсортированный прогон уходит во временный файл, буфер освобождается
+void Sorter::spill(){
+    Vector<unsigned int> order;
+    sorted_order(order);
+
+    fs::create_directories(spill_dir);
+    string path = spill_dir + "/run_" + to_string(g_run_counter++) + ".tmp";
+    ofstream out(path, ios::binary | ios::trunc);
+    if(!out.is_open()){
+        throw runtime_error("Не удалось создать файл сортировки " + path);
+    }
+    runs.push_back(path);
+    for(unsigned int i = 0; i < order.get_size(); i++){
+        write_record(out, buffer[order[i]]);
+    }
+    out.close();
+    if(!out){
+        throw runtime_error("Ошибка записи файла сортировки " + path);
+    }
+
+    buffer.clear();
+    sequence.clear();
+}
+
+void Sorter::remove_runs(){
+    for(unsigned int i = 0; i < runs.get_size(); i++){
+        error_code ec;
+        fs::remove(runs[i], ec);
+    }
+    runs.clear();
+}
+
+void Sorter::finish(const function<bool(const json&)>& emit){
+    Vector<unsigned int> order;
+    sorted_order(order);
+
+    if(runs.empty()){
+        for(unsigned int i = 0; i < order.get_size(); i++){
+            if(!emit(buffer[order[i]])) break;
+        }
+        buffer.clear();
+        sequence.clear();
+        return;
+    }
+
+    // Слияние прогонов с остатком в памяти; остаток поступил последним,
+    // поэтому при равенстве берётся документ из более раннего прогона
+    unsigned int k = runs.get_size();
+    Vector<ifstream*> inputs;
+    Vector<json> heads;
+    Vector<bool> alive;
+    for(unsigned int r = 0; r < k; r++){
+        inputs.push_back(new ifstream(runs[r], ios::binary));
+        json head;
+        bool ok = inputs[r]->is_open() && read_record(*inputs[r], head);
+        heads.push_back(head);
+        alive.push_back(ok);
+    }
+
+    auto close_inputs = [&](){
+        for(unsigned int r = 0; r < k; r++) delete inputs[r];
+        inputs.clear();
+        remove_runs();
+        buffer.clear();
+        sequence.clear();
+    };
+
+    try{
+        unsigned int memory_pos = 0;
+        while(true){
+            int best = -1;
+            for(unsigned int r = 0; r < k; r++){
+                if(!alive[r]) continue;
+                if(best < 0 || less(heads[r], heads[(unsigned int)best], rules)) best = (int)r;
+            }
+            bool from_memory = memory_pos < order.get_size() &&
+                               (best < 0 || less(buffer[order[memory_pos]], heads[(unsigned int)best], rules));
+
+            if(from_memory){
+                if(!emit(buffer[order[memory_pos++]])) break;
+                continue;
+            }
+            if(best < 0) break;
+
+            unsigned int r = (unsigned int)best;
+            if(!emit(heads[r])) break;
+            json head;
+            alive[r] = read_record(*inputs[r], head);
+            heads[r] = head;
+        }
+    }catch(...){
+        close_inputs();
+        throw;
+    }
+    close_inputs();
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <string>
+#include <functional>
+#include "../containers/vector.h"
+#include "../include/json.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+// Сортировка результата find по правилам {"поле": 1 | -1}, равные документы
+// сохраняют порядок поступления. С limit держит кучу из limit лучших документов.
+// Без limit копит документы в памяти; каждые run_size документов отсортированный
+// прогон сбрасывается во временный файл в spill_dir, в конце прогоны сливаются.
+class Sorter {
+private:
+    json rules;
+    unsigned int limit;
+    unsigned int run_size;
+    string spill_dir;
+
+    Vector<json> buffer;
+    Vector<unsigned long long> sequence;
+    unsigned long long next_sequence;
+    Vector<string> runs;
+
+    bool before(unsigned int a, unsigned int b) const;
+    void swap_entries(unsigned int a, unsigned int b);
+    void sift_up(unsigned int i);
+    void sift_down(unsigned int i);
+    void sorted_order(Vector<unsigned int>& order) const;
+    void spill();
+    void remove_runs();
+
+public:
+    static const unsigned int DEFAULT_RUN_SIZE = 50000;
+
+    Sorter(const json& rules, unsigned int limit, const string& spill_dir,
+           unsigned int run_size = DEFAULT_RUN_SIZE);
+    ~Sorter();
+
+    Sorter(const Sorter&) = delete;
+    Sorter& operator=(const Sorter&) = delete;
+
+    // true, если a идёт раньше b; документ без поля идёт после документа с полем
+    static bool less(const json& a, const json& b, const json& rules);
+
+    void add(const json& document);
+    // Выдаёт документы по порядку; emit возвращает false, чтобы остановиться
+    void finish(const function<bool(const json&)>& emit);
+};
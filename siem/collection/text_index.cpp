@@ -0,0 +1,120 @@
+#include "text_index.h"
+
+using namespace std;
+
+static bool token_char(unsigned char c){
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+           c == '.' || c == '_' || c == '-' || c == '@' || c >= 0x80;
+}
+
+void TextIndex::tokenize(const string& text, Vector<string>& tokens){
+    size_t i = 0;
+    while(i < text.size()){
+        while(i < text.size() && !token_char((unsigned char)text[i])) i++;
+        size_t begin = i;
+        while(i < text.size() && token_char((unsigned char)text[i])) i++;
+        size_t end = i;
+
+        while(begin < end && (text[begin] == '.' || text[begin] == '-')) begin++;
+        while(end > begin && (text[end - 1] == '.' || text[end - 1] == '-')) end--;
+        if(begin == end) continue;
+
+        string token = text.substr(begin, end - begin);
+        for(size_t k = 0; k < token.size(); k++){
+            if(token[k] >= 'A' && token[k] <= 'Z') token[k] = (char)(token[k] - 'A' + 'a');
+        }
+        tokens.push_back(token);
+    }
+}
+
+void PostingList::add(unsigned int ordinal){
+    if(count > 0 && last == ordinal) return;
+    unsigned int v = count == 0 ? ordinal : ordinal - last;
+    while(v >= 0x80){
+        bytes.push_back((char)((v & 0x7F) | 0x80));
+        v >>= 7;
+    }
+    bytes.push_back((char)v);
+    last = ordinal;
+    count++;
+}
+
+void PostingList::decode(Vector<unsigned int>& out) const{
+    unsigned int value = 0;
+    unsigned int delta = 0;
+    int shift = 0;
+    bool first = true;
+    for(size_t i = 0; i < bytes.size(); i++){
+        unsigned char b = (unsigned char)bytes[i];
+        delta |= (unsigned int)(b & 0x7F) << shift;
+        if(b & 0x80){
+            shift += 7;
+            continue;
+        }
+        value = first ? delta : value + delta;
+        first = false;
+        out.push_back(value);
+        delta = 0;
+        shift = 0;
+    }
+}
+
+void TextIndex::add(const string& field, const string& text, unsigned int ordinal){
+    Vector<string> tokens;
+    tokenize(text, tokens);
+    if(tokens.empty()) return;
+
+    HashMap<string, PostingList>& words = fields[field];
+    for(unsigned int i = 0; i < tokens.get_size(); i++){
+        words[tokens[i]].add(ordinal);
+    }
+}
+
+unsigned int TextIndex::count(const string& field, const string& token) const{
+    const HashMap<string, PostingList>* words = fields.get(field);
+    if(!words) return 0;
+    const PostingList* list = words->get(token);
+    return list ? list->count : 0;
+}
+
+void TextIndex::lookup(const string& field, const string& token, Vector<unsigned int>& out) const{
+    const HashMap<string, PostingList>* words = fields.get(field);
+    if(!words) return;
+    const PostingList* list = words->get(token);
+    if(list) list->decode(out);
+}
+
+json PostingList::save() const{
+    return json::array({json::binary(json::binary_t::container_type(bytes.begin(), bytes.end())), last, count});
+}
+
+void PostingList::load(const json& state){
+    const json::binary_t& data = state.at(0).get_binary();
+    bytes.assign(data.begin(), data.end());
+    last = state.at(1).get<unsigned int>();
+    count = state.at(2).get<unsigned int>();
+}
+
+json save_postings(const HashMap<string, HashMap<string, PostingList>>& fields){
+    json state = json::object();
+    for(auto it = fields.begin(); it != fields.end(); ++it){
+        KeyValue<string, HashMap<string, PostingList>> field = *it;
+        json lists = json::object();
+        for(auto l = field.value.begin(); l != field.value.end(); ++l){
+            KeyValue<string, PostingList> entry = *l;
+            lists[entry.key] = entry.value.save();
+        }
+        state[field.key] = lists;
+    }
+    return state;
+}
+
+void load_postings(const json& state, HashMap<string, HashMap<string, PostingList>>& fields){
+    fields.clear();
+    for(auto it = state.begin(); it != state.end(); ++it){
+        HashMap<string, PostingList>& lists = fields[it.key()];
+        for(auto l = it.value().begin(); l != it.value().end(); ++l){
+            lists[l.key()].load(l.value());
+        }
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <string>
+#include "../containers/vector.h"
+#include "../containers/hash_map.h"
+#include "../include/json.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+// Сжатый список номеров записей: разности соседних номеров в varint
+struct PostingList {
+    string bytes;
+    unsigned int last;
+    unsigned int count;
+
+    PostingList() : last(0), count(0) {}
+
+    // Номера добавляются по возрастанию; повтор последнего номера пропускается
+    void add(unsigned int ordinal);
+    void decode(Vector<unsigned int>& out) const;
+
+    // [байты, последний номер, число номеров]
+    json save() const;
+    void load(const json& state);
+};
+
+// Состояние индексов поле -> ключ -> PostingList для файла индексов сегмента
+json save_postings(const HashMap<string, HashMap<string, PostingList>>& fields);
+void load_postings(const json& state, HashMap<string, HashMap<string, PostingList>>& fields);
+
+// Инвертированный индекс одного сегмента по словам строковых полей (rawlog, command):
+// поле -> слово -> номера записей. Номера добавляются по возрастанию, поэтому
+// списки отсортированы и хранятся разностями.
+class TextIndex {
+private:
+    HashMap<string, HashMap<string, PostingList>> fields;
+
+public:
+    // Слова строки: буквы, цифры и символы . _ - @ (IP-адреса, имена файлов,
+    // учётные записи), латиница в нижнем регистре; точки и дефисы по краям отбрасываются
+    static void tokenize(const string& text, Vector<string>& tokens);
+
+    void add(const string& field, const string& text, unsigned int ordinal);
+    void clear() { fields.clear(); }
+    // Число записей со словом (для выбора порядка пересечения)
+    unsigned int count(const string& field, const string& token) const;
+    void lookup(const string& field, const string& token, Vector<unsigned int>& out) const;
+
+    json save() const { return save_postings(fields); }
+    void load(const json& state) { load_postings(state, fields); }
+};
@@ -0,0 +1,113 @@
+#include "top_k.h"
+#include "secondary_index.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+void SpaceSaving::swap_entries(unsigned int a, unsigned int b){
+    TopKCounter tmp = heap[a];
+    heap[a] = heap[b];
+    heap[b] = tmp;
+    position.insert(heap[a].key, a);
+    position.insert(heap[b].key, b);
+}
+
+void SpaceSaving::sift_up(unsigned int i){
+    while(i > 0){
+        unsigned int parent = (i - 1) / 2;
+        if(!(heap[i].count < heap[parent].count)) break;
+        swap_entries(i, parent);
+        i = parent;
+    }
+}
+
+void SpaceSaving::sift_down(unsigned int i){
+    unsigned int n = heap.get_size();
+    while(true){
+        unsigned int smallest = i;
+        unsigned int l = 2 * i + 1, r = 2 * i + 2;
+        if(l < n && heap[l].count < heap[smallest].count) smallest = l;
+        if(r < n && heap[r].count < heap[smallest].count) smallest = r;
+        if(smallest == i) break;
+        swap_entries(i, smallest);
+        i = smallest;
+    }
+}
+
+void SpaceSaving::add(const json& value){
+    string key = SecondaryIndex::make_key(value);
+    unsigned int i = 0;
+    if(position.try_get(key, i)){
+        heap[i].count++;
+        sift_down(i);
+        return;
+    }
+    if(capacity == 0) return;
+
+    if(heap.get_size() < capacity){
+        TopKCounter counter;
+        counter.value = value;
+        counter.key = key;
+        counter.count = 1;
+        heap.push_back(counter);
+        position.insert(key, heap.get_size() - 1);
+        sift_up(heap.get_size() - 1);
+        return;
+    }
+
+    // Вытесняется минимальный счётчик (корень кучи)
+    position.erase(heap[0].key);
+    heap[0].error = heap[0].count;
+    heap[0].count++;
+    heap[0].value = value;
+    heap[0].key = key;
+    position.insert(key, 0);
+    sift_down(0);
+}
+
+void SpaceSaving::clear(){
+    heap.clear();
+    position.clear();
+}
+
+void SpaceSaving::top(unsigned int k, Vector<TopKCounter>& out) const{
+    // Частичный выбор: k проходов дешевле сортировки при k много меньше capacity
+    Vector<bool> taken;
+    for(unsigned int i = 0; i < heap.get_size(); i++) taken.push_back(false);
+
+    for(unsigned int n = 0; n < k && n < heap.get_size(); n++){
+        int best = -1;
+        for(unsigned int i = 0; i < heap.get_size(); i++){
+            if(taken[i] || heap[i].count <= 0) continue;
+            if(best < 0 || heap[i].count > heap[best].count) best = (int)i;
+        }
+        if(best < 0) break;
+        taken[best] = true;
+        out.push_back(heap[best]);
+    }
+}
+
+TopKSketch::TopKSketch(const TopKOptions& options)
+    : options(options), where(options.where), counters(options.capacity){}
+
+void TopKSketch::collect_fields(Vector<string>& fields) const{
+    fields.push_back(options.field);
+    where.collect_fields(fields);
+}
+
+bool TopKSketch::counts(const json& document) const{
+    auto it = document.find(options.field);
+    return it != document.end() && !it->is_null() && where.matches(document);
+}
+
+void TopKSketch::add(const json& document){
+    if(!counts(document)) return;
+    counters.add(document[options.field]);
+}
+
+bool TopKSketch::can_answer(const string& field, const json& filter, unsigned int k) const{
+    if(field != options.field) return false;
+    if(k == 0 || k * 10 > counters.get_capacity()) return false;
+    json normalized = filter.is_null() ? json::object() : filter;
+    return normalized == where.get_source();
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <string>
+#include "../containers/vector.h"
+#include "../containers/hash_map.h"
+#include "../include/json.hpp"
+#include "../schema/schema.h"
+#include "filter.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+// Отслеживаемое значение: count - оценка сверху, error - на сколько она может
+// превышать точное число (count - error <= точное <= count)
+struct TopKCounter {
+    json value;
+    string key;
+    long long count;
+    long long error;
+
+    TopKCounter() : count(0), error(0) {}
+};
+
+// Space-Saving: capacity счётчиков в куче по возрастанию count. Новое значение
+// при заполненной куче вытесняет минимальный счётчик и наследует его count как
+// ошибку. Любое значение, встречающееся чаще N / capacity раз, гарантированно
+// отслеживается. Счётчики только растут: вычитание ломает границы count - error,
+// поэтому удаление документа сбрасывает скетч (см. Collection::update_summaries).
+class SpaceSaving {
+private:
+    unsigned int capacity;
+    Vector<TopKCounter> heap;
+    HashMap<string, unsigned int> position;
+
+    void swap_entries(unsigned int a, unsigned int b);
+    void sift_up(unsigned int i);
+    void sift_down(unsigned int i);
+
+public:
+    static const unsigned int DEFAULT_CAPACITY = 1000;
+
+    explicit SpaceSaving(unsigned int capacity = DEFAULT_CAPACITY) : capacity(capacity) {}
+
+    unsigned int get_capacity() const { return capacity; }
+    void add(const json& value);
+    void clear();
+    // До k счётчиков по убыванию count
+    void top(unsigned int k, Vector<TopKCounter>& out) const;
+};
+
+// Частые значения поля из раздела topk схемы, при where - только среди
+// документов, подходящих под этот фильтр. Ведётся при вставке; после удаления
+// подсчитанного документа строится заново по живым документам.
+class TopKSketch {
+private:
+    TopKOptions options;
+    Filter where;
+    SpaceSaving counters;
+
+public:
+    TopKSketch() {}
+    explicit TopKSketch(const TopKOptions& options);
+
+    const TopKOptions& get_options() const { return options; }
+    void collect_fields(Vector<string>& fields) const;
+    // Документ попадает в скетч: поле задано и where выполняется
+    bool counts(const json& document) const;
+    void add(const json& document);
+    void clear() { counters.clear(); }
+
+    // Скетч отвечает на запрос по тому же полю и фильтру, если k заметно
+    // меньше числа счётчиков (иначе хвост ответа неточен)
+    bool can_answer(const string& field, const json& filter, unsigned int k) const;
+    void top(unsigned int k, Vector<TopKCounter>& out) const { counters.top(k, out); }
+};
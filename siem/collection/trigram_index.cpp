@@ -0,0 +1,200 @@
+#include "trigram_index.h"
+
+using namespace std;
+
+static const unsigned int MAX_GRAMS = 4;
+
+static char lower_ascii(char c){
+    return c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c;
+}
+
+void TrigramIndex::trigrams(const string& text, Vector<string>& out){
+    if(text.size() < 3) return;
+    string gram(3, '\0');
+    for(size_t i = 0; i + 3 <= text.size(); i++){
+        gram[0] = lower_ascii(text[i]);
+        gram[1] = lower_ascii(text[i + 1]);
+        gram[2] = lower_ascii(text[i + 2]);
+        out.push_back(gram);
+    }
+}
+
+static void finish_literal(string& literal, Vector<string>& out){
+    if(literal.size() >= 3) out.push_back(literal);
+    literal.clear();
+}
+
+static bool is_hex(char c){
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+// Длина аргумента буквенного экранирования \e, начинающегося с pos;
+// npos - экранирование не разобрано, и литералы выделять нельзя
+static size_t escape_argument(const string& pattern, size_t pos, char e){
+    size_t n = 0;
+    switch(e){
+    case 'd': case 'D': case 'w': case 'W': case 's': case 'S':
+    case 'b': case 'B': case 'n': case 'r': case 't': case 'f': case 'v':
+        return 0;
+    case 'x':
+        while(n < 2 && pos + n < pattern.size() && is_hex(pattern[pos + n])) n++;
+        return n;
+    case 'u':
+        if(pos < pattern.size() && pattern[pos] == '{'){
+            size_t close = pattern.find('}', pos);
+            return close == string::npos ? string::npos : close - pos + 1;
+        }
+        while(n < 4 && pos + n < pattern.size() && is_hex(pattern[pos + n])) n++;
+        return n;
+    case 'c':
+        return pos < pattern.size() ? 1 : 0;
+    case '0':
+        while(n < 2 && pos + n < pattern.size() && pattern[pos + n] >= '0' && pattern[pos + n] <= '7') n++;
+        return n;
+    default:
+        break;
+    }
+    if(e >= '1' && e <= '9'){
+        // Обратная ссылка \12
+        while(pos + n < pattern.size() && pattern[pos + n] >= '0' && pattern[pos + n] <= '9') n++;
+        return n;
+    }
+    return string::npos;
+}
+
+// Разбор без построения автомата: литералом считается цепочка обычных символов
+// вне групп и классов. Символ перед *, ? и {…} необязателен и из цепочки убирается;
+// + и прочие конструкции цепочку обрывают. Альтернатива | на верхнем уровне
+// означает, что обязательных подстрок нет.
+void TrigramIndex::regex_literals(const string& pattern, Vector<string>& out){
+    Vector<string> found;
+    string literal;
+    size_t i = 0;
+    while(i < pattern.size()){
+        char c = pattern[i];
+        if(c == '\\'){
+            if(i + 1 >= pattern.size()) return;
+            char e = pattern[i + 1];
+            bool alnum = (e >= 'a' && e <= 'z') || (e >= 'A' && e <= 'Z') || (e >= '0' && e <= '9');
+            i += 2;
+            if(!alnum){
+                literal.push_back(e);
+                continue;
+            }
+            // \d, \w, \s, \b, \1, \xHH и т.п. - не литерал; аргумент экранирования
+            // пропускается, чтобы не попасть в следующую цепочку
+            finish_literal(literal, found);
+            size_t skip = escape_argument(pattern, i, e);
+            if(skip == string::npos) return;
+            i += skip;
+            continue;
+        }
+        if(c == '|') return;
+        if(c == '*' || c == '?' || c == '{'){
+            if(!literal.empty()) literal.erase(literal.size() - 1);
+            finish_literal(literal, found);
+            if(c == '{'){
+                while(i < pattern.size() && pattern[i] != '}') i++;
+            }
+            i++;
+            continue;
+        }
+        if(c == '(' || c == '['){
+            finish_literal(literal, found);
+            char open = c;
+            char close = c == '(' ? ')' : ']';
+            int depth = 0;
+            while(i < pattern.size()){
+                if(pattern[i] == '\\'){ i += 2; continue; }
+                if(pattern[i] == open && (open == '(' || depth == 0)) depth++;
+                else if(pattern[i] == close){
+                    depth--;
+                    if(depth == 0) break;
+                }
+                i++;
+            }
+            i++;
+            // Квантификатор после группы относится к ней целиком
+            continue;
+        }
+        if(c == '.' || c == '^' || c == '$' || c == '+' || c == ')' || c == ']'){
+            finish_literal(literal, found);
+            i++;
+            continue;
+        }
+        literal.push_back(c);
+        i++;
+    }
+    finish_literal(literal, found);
+    for(unsigned int k = 0; k < found.get_size(); k++) out.push_back(found[k]);
+}
+
+void TrigramIndex::add(const string& field, const string& text, unsigned int ordinal){
+    Vector<string> grams;
+    trigrams(text, grams);
+    if(grams.empty()) return;
+
+    HashMap<string, PostingList>& lists = fields[field];
+    for(unsigned int i = 0; i < grams.get_size(); i++){
+        lists[grams[i]].add(ordinal);
+    }
+}
+
+static void intersect_postings(const Vector<unsigned int>& a, const Vector<unsigned int>& b, Vector<unsigned int>& out){
+    unsigned int i = 0, j = 0;
+    while(i < a.get_size() && j < b.get_size()){
+        if(a[i] < b[j]) i++;
+        else if(b[j] < a[i]) j++;
+        else { out.push_back(a[i]); i++; j++; }
+    }
+}
+
+bool TrigramIndex::candidates(const string& field, const Vector<string>& literals, Vector<unsigned int>& out) const{
+    Vector<string> grams;
+    for(unsigned int i = 0; i < literals.get_size(); i++){
+        trigrams(literals[i], grams);
+    }
+    if(grams.empty()) return false;
+
+    out.clear();
+    const HashMap<string, PostingList>* lists = fields.get(field);
+    if(!lists) return true;
+
+    // Пересекаются только MAX_GRAMS самых коротких списков: кандидатов это
+    // почти не добавляет, а длинные списки частых триграмм не распаковываются
+    Vector<const PostingList*> rarest;
+    for(unsigned int i = 0; i < grams.get_size(); i++){
+        const PostingList* list = lists->get(grams[i]);
+        if(!list) return true;
+
+        bool seen = false;
+        for(unsigned int j = 0; j < rarest.get_size(); j++){
+            if(rarest[j] == list){ seen = true; break; }
+        }
+        if(seen) continue;
+        if(rarest.get_size() < MAX_GRAMS){
+            rarest.push_back(list);
+            continue;
+        }
+        unsigned int longest = 0;
+        for(unsigned int j = 1; j < rarest.get_size(); j++){
+            if(rarest[j]->count > rarest[longest]->count) longest = j;
+        }
+        if(list->count < rarest[longest]->count) rarest[longest] = list;
+    }
+
+    unsigned int shortest = 0;
+    for(unsigned int j = 1; j < rarest.get_size(); j++){
+        if(rarest[j]->count < rarest[shortest]->count) shortest = j;
+    }
+    rarest[shortest]->decode(out);
+    for(unsigned int j = 0; j < rarest.get_size() && !out.empty(); j++){
+        if(j == shortest) continue;
+        Vector<unsigned int> postings;
+        rarest[j]->decode(postings);
+        Vector<unsigned int> narrowed;
+        intersect_postings(out, postings, narrowed);
+        out = narrowed;
+    }
+    return true;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <string>
+#include "../containers/vector.h"
+#include "../containers/hash_map.h"
+#include "text_index.h"
+
+using namespace std;
+
+// Индекс триграмм одного сегмента для $contains и $regex: поле -> три подряд
+// идущих байта значения (латиница в нижнем регистре) -> сжатые номера записей.
+// Запись с подстрокой s содержит все триграммы s, поэтому пересечение их
+// списков даёт кандидатов, которые затем проверяются фильтром.
+class TrigramIndex {
+private:
+    HashMap<string, HashMap<string, PostingList>> fields;
+
+public:
+    static void trigrams(const string& text, Vector<string>& out);
+    // Подстроки, без которых регулярное выражение не может совпасть
+    // (не короче трёх байт). Пусто - выражение индексом не сужается.
+    static void regex_literals(const string& pattern, Vector<string>& out);
+
+    void add(const string& field, const string& text, unsigned int ordinal);
+    void clear() { fields.clear(); }
+    // Кандидаты для записей, содержащих все literals; false - ни одного
+    // литерала длиной от трёх байт, индекс не применим
+    bool candidates(const string& field, const Vector<string>& literals, Vector<unsigned int>& out) const;
+
+    json save() const { return save_postings(fields); }
+    void load(const json& state) { load_postings(state, fields); }
+};
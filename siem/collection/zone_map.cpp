@@ -0,0 +1,259 @@
+#include "zone_map.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+void ZoneMap::update(const string& field, const json& value){
+    if(value.is_null()){
+        nulls[field]++;
+        return;
+    }
+
+    counts[field]++;
+
+    const json* lo = min_values.get(field);
+    if(!lo || value < *lo) min_values.insert(field, value);
+
+    const json* hi = max_values.get(field);
+    if(!hi || *hi < value) max_values.insert(field, value);
+}
+
+void ZoneMap::update_time(long long seconds){
+    if(time_count == 0 || seconds < time_min) time_min = seconds;
+    if(time_count == 0 || seconds > time_max) time_max = seconds;
+    time_count++;
+}
+
+void ZoneMap::clear(){
+    min_values.clear();
+    max_values.clear();
+    counts.clear();
+    nulls.clear();
+    time_min = 0;
+    time_max = 0;
+    time_count = 0;
+}
+
+void ZoneMap::set_time(long long lo, long long hi, unsigned int count){
+    time_min = count > 0 ? lo : 0;
+    time_max = count > 0 ? hi : 0;
+    time_count = count;
+}
+
+bool ZoneMap::time_range(long long& lo, long long& hi, unsigned int& count) const{
+    count = time_count;
+    if(time_count == 0) return false;
+    lo = time_min;
+    hi = time_max;
+    return true;
+}
+
+bool ZoneMap::range(const string& field, json& lo, json& hi) const{
+    const json* min_value = min_values.get(field);
+    const json* max_value = max_values.get(field);
+    if(!min_value || !max_value) return false;
+    lo = *min_value;
+    hi = *max_value;
+    return true;
+}
+
+bool ZoneMap::covers(const json& filter, const Vector<string>& fields, unsigned int documents) const{
+    if(!filter.is_object()) return false;
+    for(auto it = filter.begin(); it != filter.end(); ++it){
+        bool known = false;
+        for(unsigned int i = 0; i < fields.get_size(); i++){
+            if(fields[i] == it.key()){ known = true; break; }
+        }
+        if(!known || !it.value().is_object() || it.value().empty()) return false;
+
+        const json* lo = min_values.get(it.key());
+        const json* hi = max_values.get(it.key());
+        const unsigned int* count = counts.get(it.key());
+        if(!lo || !hi || !count || *count != documents) return false;
+
+        for(auto c = it.value().begin(); c != it.value().end(); ++c){
+            const json& v = c.value();
+            if(c.key() == "$gt"){
+                if(!(*lo > v)) return false;
+            }else if(c.key() == "$gte"){
+                if(*lo < v) return false;
+            }else if(c.key() == "$lt"){
+                if(!(*hi < v)) return false;
+            }else if(c.key() == "$lte"){
+                if(v < *hi) return false;
+            }else{
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool in_range(const json& value, const json& lo, const json& hi){
+    return !(value < lo) && !(hi < value);
+}
+
+// Подходит ли значение null под условие: сравнения те же, что в
+// Filter::eval_condition (null меньше любого другого значения)
+static bool null_may_match(const json& condition){
+    static const json null_value;
+    if(!condition.is_object()) return condition.is_null();
+
+    for(auto it = condition.begin(); it != condition.end(); ++it){
+        const string& op = it.key();
+        const json& v = it.value();
+
+        if(op == "$eq"){
+            if(null_value != v) return false;
+        }else if(op == "$ne"){
+            if(null_value == v) return false;
+        }else if(op == "$gt"){
+            if(!(null_value > v)) return false;
+        }else if(op == "$gte"){
+            if(!(null_value >= v)) return false;
+        }else if(op == "$lt"){
+            if(!(null_value < v)) return false;
+        }else if(op == "$lte"){
+            if(!(null_value <= v)) return false;
+        }else if(op == "$in" || op == "$nin"){
+            bool found = false;
+            if(v.is_array()){
+                for(const auto& item : v){
+                    if(item.is_null()){ found = true; break; }
+                }
+            }
+            if(found != (op == "$in")) return false;
+        }else if(op != "$options"){
+            // Текстовые условия требуют строку
+            return false;
+        }
+    }
+    return true;
+}
+
+// Условие на поле может выполниться хотя бы для одного документа сегмента.
+// Отсутствующее поле не проходит ни одно условие (см. check_operators).
+bool ZoneMap::field_may_match(const string& field, const json& condition) const{
+    if(condition.is_array()) return true;
+
+    const unsigned int* null_count = nulls.get(field);
+    if(null_count && *null_count > 0 && null_may_match(condition)) return true;
+
+    const json* lo = min_values.get(field);
+    const json* hi = max_values.get(field);
+    if(!lo || !hi) return false;
+
+    if(condition.is_primitive()){
+        return in_range(condition, *lo, *hi);
+    }
+    if(!condition.is_object()) return true;
+
+    for(auto it = condition.begin(); it != condition.end(); ++it){
+        const string& op = it.key();
+        const json& v = it.value();
+
+        if(op == "$eq"){
+            if(!in_range(v, *lo, *hi)) return false;
+        }else if(op == "$gt"){
+            if(!(*hi > v)) return false;
+        }else if(op == "$gte"){
+            if(*hi < v) return false;
+        }else if(op == "$lt"){
+            if(!(*lo < v)) return false;
+        }else if(op == "$lte"){
+            if(v < *lo) return false;
+        }else if(op == "$in" && v.is_array()){
+            bool any = false;
+            for(const auto& item : v){
+                if(in_range(item, *lo, *hi)){ any = true; break; }
+            }
+            if(!any) return false;
+        }
+    }
+    return true;
+}
+
+bool ZoneMap::may_match(const json& filter, const Vector<string>& fields) const{
+    if(!filter.is_object()) return true;
+
+    for(auto it = filter.begin(); it != filter.end(); ++it){
+        const string& key = it.key();
+        const json& condition = it.value();
+
+        if(key == "$and"){
+            if(!condition.is_array()) continue;
+            for(const auto& cond : condition){
+                if(!may_match(cond, fields)) return false;
+            }
+        }else if(key == "$or"){
+            if(!condition.is_array() || condition.empty()) continue;
+            bool any = false;
+            for(const auto& cond : condition){
+                if(may_match(cond, fields)){ any = true; break; }
+            }
+            if(!any) return false;
+        }else if(!key.empty() && key[0] != '$'){
+            bool tracked = false;
+            for(unsigned int i = 0; i < fields.get_size(); i++){
+                if(fields[i] == key){ tracked = true; break; }
+            }
+            if(tracked && !field_may_match(key, condition)) return false;
+        }
+    }
+    return true;
+}
+
+json ZoneMap::to_json() const{
+    json out = json::object();
+    auto it = min_values.begin();
+    auto end_it = min_values.end();
+    while(it != end_it){
+        auto kv = *it;
+        const json* hi = max_values.get(kv.key);
+        if(hi){
+            out[kv.key] = {{"min", kv.value}, {"max", *hi}};
+        }
+        ++it;
+    }
+    for(auto n = nulls.begin(); n != nulls.end(); ++n){
+        KeyValue<string, unsigned int> kv = *n;
+        out[kv.key]["nulls"] = kv.value;
+    }
+    return out;
+}
+
+json ZoneMap::save() const{
+    json fields = json::object();
+    for(auto it = min_values.begin(); it != min_values.end(); ++it){
+        KeyValue<string, json> kv = *it;
+        const json* hi = max_values.get(kv.key);
+        unsigned int count = 0;
+        counts.try_get(kv.key, count);
+        if(hi) fields[kv.key] = json::array({kv.value, *hi, count});
+    }
+    json null_fields = json::object();
+    for(auto it = nulls.begin(); it != nulls.end(); ++it){
+        KeyValue<string, unsigned int> kv = *it;
+        null_fields[kv.key] = kv.value;
+    }
+    return {{"fields", fields}, {"nulls", null_fields},
+            {"time", json::array({time_min, time_max, time_count})}};
+}
+
+void ZoneMap::load(const json& state){
+    clear();
+    const json& fields = state.at("fields");
+    for(auto it = fields.begin(); it != fields.end(); ++it){
+        min_values.insert(it.key(), it.value().at(0));
+        max_values.insert(it.key(), it.value().at(1));
+        counts.insert(it.key(), it.value().at(2).get<unsigned int>());
+    }
+    const json& null_fields = state.at("nulls");
+    for(auto it = null_fields.begin(); it != null_fields.end(); ++it){
+        nulls.insert(it.key(), it.value().get<unsigned int>());
+    }
+    const json& time = state.at("time");
+    time_min = time.at(0).get<long long>();
+    time_max = time.at(1).get<long long>();
+    time_count = time.at(2).get<unsigned int>();
+}
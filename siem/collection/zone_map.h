@@ -0,0 +1,51 @@
+#pragma once
+#include <string>
+#include "../containers/vector.h"
+#include "../containers/hash_map.h"
+#include "../include/json.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+// Минимумы и максимумы упорядоченных полей сегмента. По ним find
+// пропускает сегмент целиком, если условие диапазона заведомо не выполняется.
+class ZoneMap {
+private:
+    HashMap<string, json> min_values;
+    HashMap<string, json> max_values;
+    HashMap<string, unsigned int> counts;
+    // Число значений null: в min/max они не входят, но под условия подходят
+    HashMap<string, unsigned int> nulls;
+    // Время поля срока хранения в секундах: min/max выше сравнивают json
+    // и для меток времени в разных форматах не годятся
+    long long time_min;
+    long long time_max;
+    unsigned int time_count;
+
+    bool field_may_match(const string& field, const json& condition) const;
+
+public:
+    ZoneMap() : time_min(0), time_max(0), time_count(0) {}
+
+    void update(const string& field, const json& value);
+    void update_time(long long seconds);
+    void clear();
+
+    bool may_match(const json& filter, const Vector<string>& fields) const;
+    // Минимум и максимум поля в сегменте; false - поле в сегменте не встречалось
+    bool range(const string& field, json& lo, json& hi) const;
+    // Фильтр заведомо выполняется для всех documents документов сегмента: он состоит
+    // только из условий диапазона по полям fields, и минимум с максимумом в них попадают
+    bool covers(const json& filter, const Vector<string>& fields, unsigned int documents) const;
+
+    // Границы времени и число записей, для которых оно известно; false - ни одной
+    bool time_range(long long& lo, long long& hi, unsigned int& count) const;
+    // Заменяет границы времени (после удаления части записей по сроку)
+    void set_time(long long lo, long long hi, unsigned int count);
+
+    json to_json() const;
+    // Полное состояние (вместе с числом значений и временем срока хранения)
+    // для файла индексов сегмента
+    json save() const;
+    void load(const json& state);
+};
@@ -146,6 +146,58 @@ bool HashMap<K, V>::contains(const K& key) const {
     return false;
 }
 
+template<typename K, typename V>
+bool HashMap<K, V>::try_get(const K& key, V& out) const {
+    unsigned int index = hash(key);
+    Node* current = buckets[index];
+
+    while (current) {
+        if (current->key == key) {
+            out = current->value;
+            return true;
+        }
+        current = current->next;
+    }
+    return false;
+}
+
+template<typename K, typename V>
+const V* HashMap<K, V>::get(const K& key) const {
+    unsigned int index = hash(key);
+    Node* current = buckets[index];
+
+    while (current) {
+        if (current->key == key) {
+            return &current->value;
+        }
+        current = current->next;
+    }
+    return nullptr;
+}
+
+template<typename K, typename V>
+bool HashMap<K, V>::erase(const K& key) {
+    unsigned int index = hash(key);
+    Node* current = buckets[index];
+    Node* prev = nullptr;
+
+    while (current) {
+        if (current->key == key) {
+            if (prev) {
+                prev->next = current->next;
+            } else {
+                buckets[index] = current->next;
+            }
+            delete current;
+            item_count--;
+            return true;
+        }
+        prev = current;
+        current = current->next;
+    }
+    return false;
+}
+
 template<typename K, typename V>
 V& HashMap<K, V>::operator[](const K& key) {
     unsigned int index = hash(key);
@@ -303,11 +355,22 @@ typename HashMap<K, V>::ConstIterator HashMap<K, V>::end() const {
 }
 
 template class HashMap<string, int>;
+template class HashMap<string, unsigned int>;
 template class HashMap<string, string>;
 template class HashMap<string, double>;
 template class HashMap<string, bool>;
 template class HashMap<string, nlohmann::json>;
 template class HashMap<string, Collection>;
+template class HashMap<string, DocRef>;
+template class HashMap<string, CollectionOptions>;
+template class HashMap<string, Vector<unsigned int>>;
+template class HashMap<string, HashMap<string, Vector<unsigned int>>>;
+template class HashMap<string, PostingList>;
+template class HashMap<string, HashMap<string, PostingList>>;
+template class HashMap<string, shared_ptr<const AhoCorasick>>;
+template class HashMap<string, HyperLogLog>;
+template class HashMap<string, RollupCell>;
+template class HashMap<string, HashMap<string, RollupCell>>;
 template class HashMap<int, bool>;
 template class HashMap<double, bool>;
 template class HashMap<string, Database*>;
@@ -64,6 +64,9 @@ public:
     
     void insert(const K& key, const V& value);
     bool contains(const K& key) const;
+    bool erase(const K& key);
+    bool try_get(const K& key, V& out) const;
+    const V* get(const K& key) const;
     V& operator[](const K& key);
     unsigned int count(const K& key) const;
     void clear();
@@ -1,13 +1,42 @@
 #include "vector.h"
 #include "../database/database.h"
+#include "../collection/aggregate.h"
 #include "../include/json.hpp"
 #include <thread>
+#include <fstream>
 
 using json = nlohmann::json;
 
 template<typename T>
 Vector<T>::Vector() : data(nullptr), capacity(0), size(0) {}
 
+template<typename T>
+Vector<T>::Vector(const Vector& other) : data(nullptr), capacity(other.size), size(other.size) {
+    if (capacity > 0) {
+        data = new T[capacity];
+        for (unsigned int i = 0; i < size; i++) {
+            data[i] = other.data[i];
+        }
+    }
+}
+
+template<typename T>
+Vector<T>& Vector<T>::operator=(const Vector& other) {
+    if (this != &other) {
+        delete[] data;
+        data = nullptr;
+        capacity = other.size;
+        size = other.size;
+        if (capacity > 0) {
+            data = new T[capacity];
+            for (unsigned int i = 0; i < size; i++) {
+                data[i] = other.data[i];
+            }
+        }
+    }
+    return *this;
+}
+
 template<typename T>
 Vector<T>::~Vector() {
     delete[] data;
@@ -61,9 +90,32 @@ void Vector<T>::clear() {
 }
 
 template class Vector<int>;
+template class Vector<unsigned int>;
 template class Vector<string>;
 template class Vector<double>;
 template class Vector<bool>;
 template class Vector<json>;
+template class Vector<Vector<json>>;
+template class Vector<Vector<unsigned int>>;
+template class Vector<Vector<string>>;
+template class Vector<ColumnInfo>;
+template class Vector<FilterNode>;
+template class Vector<long long>;
+template class Vector<unsigned long long>;
+template class Vector<Vector<long long>>;
+template class Vector<Segment>;
+template class Vector<WalRecord>;
 template class Vector<Database*>;
 template class Vector<thread*>;
+template class Vector<json*>;
+template class Vector<const PostingList*>;
+template class Vector<ifstream*>;
+template class Vector<Accumulator>;
+template class Vector<GroupState>;
+template class Vector<RollupOptions>;
+template class Vector<Rollup>;
+template class Vector<HyperLogLog>;
+template class Vector<TopKOptions>;
+template class Vector<TopKCounter>;
+template class Vector<TopKSketch>;
+template class Vector<ScanChunk>;
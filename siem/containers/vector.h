@@ -12,6 +12,8 @@ private:
 
 public:
     Vector();
+    Vector(const Vector& other);
+    Vector& operator=(const Vector& other);
     ~Vector();
     void push_back(const T& value);
     T& operator[](unsigned int index);
@@ -1,11 +1,17 @@
 #include "database.h"
 #include <filesystem>
+#include <fstream>
+#include <iostream>
 #include <stdexcept>
 
 using namespace std;
 namespace fs = filesystem;
 
-Database::Database(const string& schema_file, const string& db_name, const string& data_root){
+// После какого размера журнал сбрасывается в сегменты и очищается
+static const long long WAL_CHECKPOINT_BYTES = 64LL * 1024 * 1024;
+
+Database::Database(const string& schema_file, const string& db_name, const string& data_root)
+    : wal(nullptr), io_mutex(nullptr), applied_lsn(0), next_reservation(0){
     if(schema_file.empty()) throw runtime_error("Пустой путь schema.json");
     if(db_name.empty()) throw runtime_error("Пустое имя базы данных");
     if(data_root.empty()) throw runtime_error("Пустая папка data-root");
@@ -26,13 +32,183 @@ Database::Database(const string& schema_file, const string& db_name, const strin
             throw runtime_error("Пустое имя коллекции в schema.json");
         }
 
-        Collection coll(collection_name, base_path, schema.tuples_limit, collection_structure);
+        Collection coll(collection_name, base_path, schema.tuples_limit, collection_structure,
+                        schema.options[collection_name]);
         collections.insert(collection_name, coll);
 
         ++it;
     }
 }
 
+Database::~Database(){
+    delete wal;
+}
+
+long long Database::read_checkpoint_lsn() const{
+    ifstream in(base_path + "wal.checkpoint");
+    long long lsn = 0;
+    if(in.is_open() && (in >> lsn)) return lsn;
+    return 0;
+}
+
+// Поднимает журнал базы: докатывает записи после последней контрольной точки
+// и запускает поток групповой фиксации. Повторная вставка существующего _id
+// при докатке пропускается, поэтому докатка идемпотентна.
+void Database::enable_wal(WalAckMode ack_mode, int commit_window_ms, mutex& io_mutex_ref){
+    if(wal) return;
+
+    io_mutex = &io_mutex_ref;
+    wal = new WriteAheadLog(base_path + "wal.log", ack_mode, commit_window_ms);
+
+    applied_lsn = wal->replay(read_checkpoint_lsn(), [&](const WalRecord& record){
+        try{
+            if(record.op == WalOp::Delete) get_collection(record.collection).delete_many(record.document);
+            else get_collection(record.collection).insert(record.document);
+        }catch(const exception&){
+        }
+    });
+
+    checkpoint();
+    wal->truncate();
+
+    wal->start([this](Vector<WalRecord>& batch){ apply_wal_batch(batch); });
+}
+
+bool Database::pending_key(const string& collection, const json& document, string& key){
+    if(!document.is_object() || !document.contains("_id") || !document["_id"].is_string()) return false;
+    key = collection + '\0' + document["_id"].get<string>();
+    return true;
+}
+
+void Database::apply_wal_batch(Vector<WalRecord>& batch){
+    lock_guard<mutex> lock(*io_mutex);
+
+    for(unsigned int i = 0; i < batch.get_size(); i++){
+        string key;
+        if(batch[i].op == WalOp::Insert && pending_key(batch[i].collection, batch[i].document, key)){
+            pending_ids.erase(key);
+        }
+        // Запись не попала в журнал (см. WriteAheadLog::start)
+        if(!batch[i].error.empty()) continue;
+        try{
+            Collection& collection = get_collection(batch[i].collection);
+            if(batch[i].op == WalOp::Delete) batch[i].result = collection.delete_many(batch[i].document);
+            else collection.insert(batch[i].document);
+        }catch(const exception& e){
+            batch[i].error = e.what();
+        }
+        applied_lsn = batch[i].lsn;
+    }
+
+    if(wal->get_bytes() >= WAL_CHECKPOINT_BYTES){
+        checkpoint();
+        wal->truncate();
+    }
+}
+
+// С журналом вызывается без io_mutex. _id резервируется до постановки в
+// журнал: повторная вставка того же _id отклоняется сразу, даже если первая
+// ещё не применена (в режимах buffer и write клиенту уже ответили успехом)
+void Database::insert(const string& collection, const json& document){
+    if(wal){
+        string key;
+        int reservation = 0;
+        bool reserved = pending_key(collection, document, key);
+        if(reserved){
+            lock_guard<mutex> lock(*io_mutex);
+            if(pending_ids.contains(key) ||
+               get_collection(collection).contains_id(document["_id"].get<string>())){
+                throw runtime_error("Документ с _id уже существует");
+            }
+            reservation = ++next_reservation;
+            pending_ids.insert(key, reservation);
+        }
+        try{
+            wal->submit(collection, document);
+        }catch(const exception&){
+            // Если резервирование уже снято применением пачки, его могла
+            // занять следующая вставка того же _id
+            if(reserved){
+                lock_guard<mutex> lock(*io_mutex);
+                int current = 0;
+                if(pending_ids.try_get(key, current) && current == reservation) pending_ids.erase(key);
+            }
+            throw;
+        }
+        return;
+    }
+    get_collection(collection).insert(document);
+}
+
+// Удаление проходит через журнал, как и вставка: при докатке оно повторяется
+// в том же порядке относительно вставок, и контрольная точка ему не нужна.
+// С журналом вызывается без io_mutex (его берёт поток журнала).
+int Database::delete_many(const string& collection, const json& filter){
+    if(wal){
+        // Некорректный фильтр отклоняется до записи в журнал
+        get_collection(collection);
+        Filter compiled(filter);
+        return wal->submit(collection, filter, WalOp::Delete);
+    }
+    return get_collection(collection).delete_many(filter);
+}
+
+// Сбрасывает сегменты на диск и запоминает, до какого LSN журнал уже применён.
+// Вызывается под io_mutex.
+void Database::checkpoint(){
+    Vector<string> names = get_collection_names();
+    for(unsigned int i = 0; i < names.get_size(); i++){
+        get_collection(names[i]).sync();
+    }
+
+    if(!wal) return;
+
+    string path = base_path + "wal.checkpoint";
+    string tmp_path = path + ".tmp";
+    {
+        ofstream out(tmp_path, ios::trunc);
+        out << applied_lsn;
+        out.close();
+        if(!out){
+            cerr << "не удалось записать контрольную точку журнала " << path << "\n";
+            return;
+        }
+    }
+    fs::rename(tmp_path, path);
+}
+
+// Шаг фоновой компактации: запечатывает или перезаписывает не больше одного
+// сегмента базы. Сначала запечатываются сегменты, в которые больше не вставляют,
+// затем переписываются те, где доля удалённых записей достигла dead_ratio.
+// Вызывается под io_mutex.
+int Database::compact(double dead_ratio){
+    Vector<string> names = get_collection_names();
+    for(unsigned int i = 0; i < names.get_size(); i++){
+        int sealed = get_collection(names[i]).seal_segments(1);
+        if(sealed > 0) return sealed;
+    }
+    for(unsigned int i = 0; i < names.get_size(); i++){
+        int compacted = get_collection(names[i]).compact(dead_ratio, 1);
+        if(compacted > 0) return compacted;
+    }
+    return 0;
+}
+
+// Шаг удаления по сроку хранения: не больше одного сегмента базы на момент
+// now (секунды Unix), см. Collection::expire. Вызывается под io_mutex.
+int Database::expire(long long now){
+    Vector<string> names = get_collection_names();
+    for(unsigned int i = 0; i < names.get_size(); i++){
+        int expired = get_collection(names[i]).expire(now, 1);
+        if(expired == 0) continue;
+        // Вставки устаревших документов могут ещё лежать в журнале после
+        // контрольной точки: без новой точки докатка вернула бы их
+        if(wal) checkpoint();
+        return expired;
+    }
+    return 0;
+}
+
 Collection& Database::get_collection(const string& name){
     if(!collections.contains(name)){
         throw runtime_error("Коллекция " + name + " не найдена");
@@ -42,8 +218,8 @@ Collection& Database::get_collection(const string& name){
 
 Vector<string> Database::get_collection_names() const{
     Vector<string> names;
-    auto it = collections.begin();
-    auto end_it = collections.end();
+    auto it = schema.structure.begin();
+    auto end_it = schema.structure.end();
     while(it != end_it){
         auto kv = *it;
         names.push_back(kv.key);
@@ -1,9 +1,11 @@
 #pragma once
 #include <string>
+#include <mutex>
 #include "../containers/vector.h"
 #include "../containers/hash_map.h"
 #include "../schema/schema.h"
 #include "../collection/collection.h"
+#include "wal.h"
 
 using namespace std;
 
@@ -13,8 +15,33 @@ private:
     string base_path;
     HashMap<string, Collection> collections;
 
+    WriteAheadLog* wal;
+    mutex* io_mutex;
+    long long applied_lsn;
+    // _id вставок, поставленных в журнал, но ещё не применённых (под io_mutex):
+    // ключ - коллекция и _id, значение - номер резервирования
+    HashMap<string, int> pending_ids;
+    int next_reservation;
+
+    long long read_checkpoint_lsn() const;
+    void apply_wal_batch(Vector<WalRecord>& batch);
+    static bool pending_key(const string& collection, const json& document, string& key);
+
 public:
     Database(const string& schema_file, const string& db_name, const string& data_root);
+    ~Database();
+
+    Database(const Database&) = delete;
+    Database& operator=(const Database&) = delete;
+
+    void enable_wal(WalAckMode ack_mode, int commit_window_ms, mutex& io_mutex);
+    void insert(const string& collection, const json& document);
+    int delete_many(const string& collection, const json& filter);
+    void checkpoint();
+    int compact(double dead_ratio);
+    int expire(long long now);
+    bool wal_enabled() const { return wal != nullptr; }
+
     Collection& get_collection(const string& name);
     Vector<string> get_collection_names() const;
     string get_base_path() const { return base_path; }
@@ -0,0 +1,283 @@
+#include "wal.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+using json = nlohmann::json;
+
+static void append_u32(string& buf, unsigned int v){
+    buf.push_back((char)(v & 0xFF));
+    buf.push_back((char)((v >> 8) & 0xFF));
+    buf.push_back((char)((v >> 16) & 0xFF));
+    buf.push_back((char)((v >> 24) & 0xFF));
+}
+
+static bool read_u32(istream& in, unsigned int& v){
+    unsigned char b[4];
+    if(!in.read((char*)b, 4)) return false;
+    v = (unsigned int)b[0] | ((unsigned int)b[1] << 8) |
+        ((unsigned int)b[2] << 16) | ((unsigned int)b[3] << 24);
+    return true;
+}
+
+static void write_all(int fd, const string& buf){
+    size_t total = 0;
+    while(total < buf.size()){
+        ssize_t n = ::write(fd, buf.data() + total, buf.size() - total);
+        if(n < 0){
+            if(errno == EINTR) continue;
+            throw runtime_error(string("ошибка записи в журнал: ") + strerror(errno));
+        }
+        total += (size_t)n;
+    }
+}
+
+WalAckMode parse_wal_ack_mode(const string& s){
+    if(s == "buffer") return WalAckMode::Buffer;
+    if(s == "write") return WalAckMode::Write;
+    if(s == "fsync") return WalAckMode::Fsync;
+    throw runtime_error("неизвестный режим подтверждения: " + s + " (buffer|write|fsync)");
+}
+
+WriteAheadLog::WriteAheadLog(const string& path, WalAckMode ack_mode, int commit_window_ms)
+    : path(path), fd(-1), ack_mode(ack_mode), commit_window_ms(commit_window_ms), bytes(0),
+      next_lsn(1), written_lsn(0), applied_lsn(0), stopping(false), stopped(false){
+
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(fd < 0){
+        throw runtime_error("не удалось открыть журнал " + path + ": " + strerror(errno));
+    }
+    bytes = (long long)lseek(fd, 0, SEEK_END);
+}
+
+WriteAheadLog::~WriteAheadLog(){
+    {
+        lock_guard<mutex> lock(m);
+        stopping = true;
+    }
+    pending_cv.notify_all();
+    if(committer.joinable()) committer.join();
+    {
+        lock_guard<mutex> lock(m);
+        stopped = true;
+    }
+    done_cv.notify_all();
+    if(fd >= 0) ::close(fd);
+}
+
+long long WriteAheadLog::replay(long long after_lsn, const function<void(const WalRecord&)>& fn){
+    long long last_lsn = after_lsn;
+
+    ifstream in(path, ios::binary);
+    string payload;
+    while(in.is_open()){
+        unsigned int len = 0;
+        if(!read_u32(in, len)) break;
+        payload.resize(len);
+        if(!in.read(&payload[0], len)) break;
+
+        WalRecord record;
+        try{
+            json j = json::parse(payload);
+            record.lsn = j.at("lsn").get<long long>();
+            record.op = j.value("op", string("insert")) == "delete" ? WalOp::Delete : WalOp::Insert;
+            record.collection = j.at("c").get<string>();
+            record.document = j.at("d");
+        }catch(const exception&){
+            break;
+        }
+
+        if(record.lsn > last_lsn) last_lsn = record.lsn;
+        if(record.lsn > after_lsn) fn(record);
+    }
+
+    lock_guard<mutex> lock(m);
+    next_lsn = last_lsn + 1;
+    written_lsn = last_lsn;
+    applied_lsn = last_lsn;
+    return last_lsn;
+}
+
+void WriteAheadLog::start(const function<void(Vector<WalRecord>&)>& apply_fn){
+    apply = apply_fn;
+    committer = thread([this](){ run(); });
+}
+
+int WriteAheadLog::submit(const string& collection, const json& document, WalOp op){
+    unique_lock<mutex> lock(m);
+    if(!broken.empty()) throw runtime_error("журнал недоступен: " + broken);
+    if(stopping) throw runtime_error("журнал остановлен");
+
+    WalRecord record;
+    record.lsn = next_lsn++;
+    record.op = op;
+    record.collection = collection;
+    record.document = document;
+    pending.push_back(record);
+    long long lsn = record.lsn;
+    pending_cv.notify_one();
+
+    if(op == WalOp::Insert && ack_mode == WalAckMode::Buffer) return 1;
+
+    // Поток фиксации дописывает очередь и при остановке, поэтому ожидание
+    // прерывается только после его завершения
+    string key = to_string(lsn);
+    bool write_ack = op == WalOp::Insert && ack_mode == WalAckMode::Write;
+    if(write_ack){
+        done_cv.wait(lock, [&](){ return written_lsn >= lsn || errors.contains(key) || stopped; });
+    }else{
+        done_cv.wait(lock, [&](){ return applied_lsn >= lsn || stopped; });
+    }
+    if(errors.contains(key)){
+        string error = errors[key];
+        errors.erase(key);
+        throw runtime_error(error);
+    }
+    if((write_ack ? written_lsn : applied_lsn) < lsn){
+        throw runtime_error("журнал остановлен до записи операции");
+    }
+    int result = 1;
+    if(op == WalOp::Delete){
+        result = 0;
+        results.try_get(key, result);
+        results.erase(key);
+    }
+    return result;
+}
+
+// Запись подтверждена клиенту до применения: вставка в режимах buffer и write
+bool WriteAheadLog::acknowledged_early(const WalRecord& record) const{
+    return record.op == WalOp::Insert && ack_mode != WalAckMode::Fsync;
+}
+
+void WriteAheadLog::truncate(){
+    if(ftruncate(fd, 0) != 0){
+        cerr << "не удалось очистить журнал " << path << ": " << strerror(errno) << "\n";
+        return;
+    }
+    bytes = 0;
+}
+
+void WriteAheadLog::run(){
+    while(true){
+        Vector<WalRecord> batch;
+        {
+            unique_lock<mutex> lock(m);
+            pending_cv.wait(lock, [&](){ return stopping || !pending.empty(); });
+            if(pending.empty()) return;
+
+            // Окно фиксации: даём остальным вставкам попасть в ту же пачку
+            if(commit_window_ms > 0 && !stopping){
+                pending_cv.wait_for(lock, chrono::milliseconds(commit_window_ms),
+                                    [&](){ return stopping; });
+            }
+            batch = pending;
+            pending.clear();
+        }
+
+        string buf;
+        for(unsigned int i = 0; i < batch.get_size(); i++){
+            json j = {{"lsn", batch[i].lsn}, {"c", batch[i].collection}, {"d", batch[i].document}};
+            if(batch[i].op == WalOp::Delete) j["op"] = "delete";
+            string payload = j.dump(-1, ' ', false, json::error_handler_t::replace);
+            append_u32(buf, (unsigned int)payload.size());
+            buf += payload;
+        }
+
+        long long last_lsn = batch[batch.get_size() - 1].lsn;
+        long long previous_bytes = bytes;
+        string failure;
+        bool written = false;
+        // Есть ли в пачке записи, уже подтверждённые клиенту (к моменту
+        // записи в журнал - вставки в режиме buffer, после неё - и в write)
+        bool acknowledged = false;
+        for(unsigned int i = 0; i < batch.get_size(); i++){
+            if(batch[i].op == WalOp::Insert && ack_mode == WalAckMode::Buffer) acknowledged = true;
+        }
+        {
+            lock_guard<mutex> lock(m);
+            failure = broken;
+        }
+        if(failure.empty()){
+            try{
+                write_all(fd, buf);
+                bytes += (long long)buf.size();
+                written = true;
+            }catch(const exception& e){
+                // Недописанная запись в конце журнала остановила бы докатку
+                // и на всех следующих пачках, поэтому журнал откатывается
+                failure = e.what();
+                rollback(previous_bytes, failure);
+            }
+        }
+
+        if(written){
+            {
+                lock_guard<mutex> lock(m);
+                written_lsn = last_lsn;
+            }
+            for(unsigned int i = 0; i < batch.get_size(); i++){
+                if(acknowledged_early(batch[i])) acknowledged = true;
+            }
+            if(ack_mode == WalAckMode::Write) done_cv.notify_all();
+            if(fdatasync(fd) != 0){
+                failure = string("ошибка fsync журнала: ") + strerror(errno);
+                // После ошибки fsync содержимое журнала на диске не гарантировано
+                lock_guard<mutex> lock(m);
+                broken = failure;
+            }
+        }
+
+        // Подтверждённые клиенту вставки применяются и при ошибке fsync;
+        // неподтверждённые откатываются и возвращаются с ошибкой
+        if(failure.empty() || (written && acknowledged)){
+            apply(batch);
+        }else{
+            if(written) rollback(previous_bytes, failure);
+            for(unsigned int i = 0; i < batch.get_size(); i++){
+                batch[i].error = failure;
+            }
+            apply(batch);
+        }
+
+        {
+            lock_guard<mutex> lock(m);
+            for(unsigned int i = 0; i < batch.get_size(); i++){
+                if(batch[i].error.empty()){
+                    if(batch[i].op == WalOp::Delete) results.insert(to_string(batch[i].lsn), batch[i].result);
+                    continue;
+                }
+                if(!acknowledged_early(batch[i])){
+                    errors.insert(to_string(batch[i].lsn), batch[i].error);
+                }else{
+                    cerr << "журнал: вставка в " << batch[i].collection
+                         << " не применена: " << batch[i].error << "\n";
+                }
+            }
+            if(!failure.empty() && written && acknowledged){
+                cerr << "журнал: " << failure << "\n";
+            }
+            applied_lsn = last_lsn;
+        }
+        done_cv.notify_all();
+    }
+}
+
+// Обрезает журнал до size после неудачной записи; если не вышло,
+// журнал переводится в состояние отказа
+bool WriteAheadLog::rollback(long long size, string& failure){
+    if(ftruncate(fd, (off_t)size) == 0){
+        bytes = size;
+        return true;
+    }
+    failure += string("; не удалось откатить журнал: ") + strerror(errno);
+    lock_guard<mutex> lock(m);
+    broken = failure;
+    return false;
+}
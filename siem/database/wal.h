@@ -0,0 +1,95 @@
+#pragma once
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "../containers/vector.h"
+#include "../containers/hash_map.h"
+#include "../include/json.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+// Когда подтверждать вставку клиенту
+enum class WalAckMode {
+    Buffer,  // сразу после постановки в очередь
+    Write,   // после записи пачки в журнал
+    Fsync    // после fsync журнала и применения к коллекции
+};
+
+// Операция записи журнала: вставка документа или delete_many по фильтру
+enum class WalOp {
+    Insert,
+    Delete
+};
+
+struct WalRecord {
+    long long lsn;
+    WalOp op;
+    string collection;
+    // Документ вставки или фильтр удаления
+    json document;
+    string error;
+    // Результат применения: число удалённых документов
+    int result;
+
+    WalRecord() : lsn(0), op(WalOp::Insert), result(0) {}
+};
+
+// Журнал упреждающей записи базы с групповой фиксацией: все вставки и удаления,
+// накопленные за окно фиксации, пишутся одним write и одним fsync.
+class WriteAheadLog {
+private:
+    string path;
+    int fd;
+    WalAckMode ack_mode;
+    int commit_window_ms;
+    long long bytes;
+
+    long long next_lsn;
+    long long written_lsn;
+    long long applied_lsn;
+    Vector<WalRecord> pending;
+    // Ошибки и результаты записей по LSN, которых ждёт submit
+    // (вставки в режимах write и fsync, удаления всегда)
+    HashMap<string, string> errors;
+    HashMap<string, int> results;
+    // Причина, по которой журнал больше не принимает записи: не удалось
+    // откатить частично записанную пачку или fsync завершился ошибкой
+    string broken;
+
+    function<void(Vector<WalRecord>&)> apply;
+    thread committer;
+    bool stopping;
+    // Поток фиксации завершён: записи, которых ждёт submit, уже не будут записаны
+    bool stopped;
+    mutex m;
+    condition_variable pending_cv;
+    condition_variable done_cv;
+
+    void run();
+    bool acknowledged_early(const WalRecord& record) const;
+    bool rollback(long long size, string& failure);
+
+public:
+    WriteAheadLog(const string& path, WalAckMode ack_mode, int commit_window_ms);
+    ~WriteAheadLog();
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    long long replay(long long after_lsn, const function<void(const WalRecord&)>& fn);
+    // apply получает каждую пачку; записи с непустым error в журнал не попали
+    // и не применяются, apply только освобождает связанное с ними состояние
+    void start(const function<void(Vector<WalRecord>&)>& apply_fn);
+    // Удаление ждёт применения при любом режиме подтверждения и возвращает
+    // число удалённых документов
+    int submit(const string& collection, const json& document, WalOp op = WalOp::Insert);
+    void truncate();
+
+    long long get_bytes() const { return bytes; }
+    WalAckMode get_ack_mode() const { return ack_mode; }
+};
+
+WalAckMode parse_wal_ack_mode(const string& s);
@@ -180,6 +180,7 @@ static void usage(){
     cout << "  INSERT <collection> key=value,key=value,...\n";
     cout << "  FIND <collection> <field> <op> <value>\n";
     cout << "  DELETE <collection> <field> <op> <value>\n";
+    cout << "  AGGREGATE <collection> <pipeline JSON>\n";
     cout << "  exit\n";
 }
 
@@ -219,7 +220,7 @@ int main(int argc, char** argv){
     }
 
     cout << "Подключено к " << host << ":" << port << " (database=" << database << ")\n";
-    cout << "REPL: INSERT/FIND/DELETE или exit\n";
+    cout << "REPL: INSERT/FIND/DELETE/AGGREGATE или exit\n";
 
     for(;;){
         cout << "> ";
@@ -255,6 +256,18 @@ int main(int argc, char** argv){
                    {"collection", collection},
                    {"operation", "delete"},
                    {"query", q}};
+        }else if(cmd == "AGGREGATE"){
+            json pipeline;
+            try{
+                pipeline = json::parse(trim(line.substr(pos)));
+            }catch(const exception&){
+                cout << "Ошибка: pipeline должен быть JSON-массивом\n";
+                continue;
+            }
+            req = {{"database", database},
+                   {"collection", collection},
+                   {"operation", "aggregate"},
+                   {"pipeline", pipeline}};
         }else{
             cout << "Неизвестная команда\n";
             continue;
@@ -8,12 +8,14 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <chrono>
 #include <cctype>
 #include <functional>
 
 #include "../include/json.hpp"
 #include "../database/database.h"
 #include "../collection/collection.h"
+#include "../collection/scan_executor.h"
 #include "../containers/queue.h"
 #include "../containers/hash_map.h"
 #include "../containers/vector.h"
@@ -21,10 +23,12 @@
 using namespace std;
 using json = nlohmann::json;
 
+// MSG_NOSIGNAL: клиент, закрывший соединение посреди ответа, не должен
+// завершать сервер сигналом SIGPIPE
 static bool send_all(int fd, const string& s){
     size_t total = 0;
     while(total < s.size()){
-        ssize_t sent = send(fd, s.data() + total, s.size() - total, 0);
+        ssize_t sent = send(fd, s.data() + total, s.size() - total, MSG_NOSIGNAL);
         if(sent <= 0) return false;
         total += (size_t)sent;
     }
@@ -45,7 +49,7 @@ static bool read_line(int fd, string& out){
     return true;
 }
 
-static json ok(const string& msg, const json& data, int count){
+static json ok(const string& msg, const json& data, long long count){
     return {{"status","success"},{"message",msg},{"data",data},{"count",count}};
 }
 
@@ -53,6 +57,127 @@ static json err(const string& msg){
     return {{"status","error"},{"message",msg},{"data",json::array()},{"count",0}};
 }
 
+// Ответ find пишется пачками по мере чтения курсора: сначала начало объекта
+// и массива data, затем документы через запятую, в конце count и status.
+// Так память сервера не зависит от числа найденных документов.
+static const unsigned int STREAM_BATCH = 256;
+
+// Копит документы ответа и отправляет их порциями по STREAM_BATCH.
+// Если задан io_lock, на время отправки блокировка отпускается: медленный
+// клиент не держит вставки и фоновые задачи
+class DocumentStream {
+private:
+    const function<bool(const string&)>& write;
+    unique_lock<mutex>* io_lock;
+    string chunk;
+    unsigned int pending;
+    long long count;
+    bool first;
+
+    bool send(const string& text){
+        if(!io_lock) return write(text);
+        io_lock->unlock();
+        bool written = false;
+        try{
+            written = write(text);
+        }catch(...){
+            io_lock->lock();
+            throw;
+        }
+        io_lock->lock();
+        return written;
+    }
+
+public:
+    DocumentStream(const function<bool(const string&)>& write, unique_lock<mutex>* io_lock)
+        : write(write), io_lock(io_lock), pending(0), count(0), first(true) {}
+
+    bool begin(const string& message){
+        return send("{\"message\":" + json(message).dump() + ",\"data\":[");
+    }
+
+    bool add(const json& document){
+        if(!first) chunk += ",";
+        first = false;
+        chunk += document.dump(-1, ' ', false, json::error_handler_t::replace);
+        count++;
+        if(++pending < STREAM_BATCH) return true;
+        return flush();
+    }
+
+    bool flush(){
+        pending = 0;
+        if(chunk.empty()) return true;
+        string text;
+        text.swap(chunk);
+        return send(text);
+    }
+
+    bool end(){
+        if(!flush()) return false;
+        return send("],\"count\":" + to_string(count) + ",\"status\":\"success\"}");
+    }
+
+    // Ошибка после начала ответа: уже отправленные документы остаются в data,
+    // ответ закрывается со status error
+    bool fail(const string& error){
+        if(!flush()) return false;
+        return send("],\"count\":" + to_string(count) + ",\"status\":\"error\",\"error\":" +
+                    json(error).dump(-1, ' ', false, json::error_handler_t::replace) + "}");
+    }
+};
+
+// Пачки читаются под io_lock, отправляются без него. Пока поток открыт,
+// фоновые задачи не перестраивают сегменты коллекции (Collection::open_stream)
+static bool stream_documents(const Collection& coll, Cursor& cursor, const string& message,
+                             unique_lock<mutex>& io_lock, const function<bool(const string&)>& write){
+    DocumentStream out(write, &io_lock);
+    coll.open_stream();
+    bool written = false;
+    try{
+        if(out.begin(message)){
+            Vector<json> batch;
+            written = true;
+            try{
+                while(written && cursor.next_batch(batch)){
+                    for(unsigned int i = 0; i < batch.get_size() && written; i++){
+                        written = out.add(batch[i]);
+                    }
+                }
+                if(written) written = out.end();
+            }catch(const exception& e){
+                written = written && out.fail(e.what());
+            }
+        }
+    }catch(...){
+        coll.close_stream();
+        throw;
+    }
+    coll.close_stream();
+    return written;
+}
+
+// Отсортированный find: документы идут из сортировщика по одному. Коллекция
+// читается целиком до первого документа ответа, поэтому io_lock отпускается
+// только на время отправки уже отсортированных документов
+static bool stream_sorted(const Collection& coll, const json& query, const json& sort, int limit,
+                          const string& message, unique_lock<mutex>& io_lock,
+                          const function<bool(const string&)>& write){
+    DocumentStream out(write, &io_lock);
+    if(!out.begin(message)) return false;
+
+    bool written = true;
+    try{
+        coll.find_sorted(query, json::object(), sort, limit, [&](const json& document){
+            written = out.add(document);
+            return written;
+        });
+    }catch(const exception& e){
+        return written && out.fail(e.what());
+    }
+    return written && out.end();
+}
+
 static string trim(string s){
     size_t l = 0;
     while(l < s.size() && isspace((unsigned char)s[l])) l++;
@@ -70,8 +195,22 @@ static int g_port = 8080;
 static string g_schema_path = "schema.json";
 static string g_data_root = "data";
 
+static bool g_wal_enabled = true;
+static WalAckMode g_wal_ack = WalAckMode::Fsync;
+static int g_commit_window_ms = 2;
+
+static double g_compact_ratio = 0.3;
+static int g_compact_interval_ms = 1000;
+static int g_retention_interval_ms = 60000;
+
+static int g_scan_threads = 0;
+
 static void usage(){
-    cout << "использование: db_server [--port 8080] [--schema путь_к_schema.json] [--data-root папка_данных]\n";
+    cout << "использование: db_server [--port 8080] [--schema путь_к_schema.json] [--data-root папка_данных]\n"
+         << "                 [--wal-ack buffer|write|fsync] [--commit-window-ms 2] [--no-wal]\n"
+         << "                 [--compact-ratio 0.3] [--compact-interval-ms 1000]\n"
+         << "                 [--retention-interval-ms 60000]\n"
+         << "                 [--scan-threads N (0 - по числу ядер)]\n";
 }
 
 static void parse_args(int argc, char** argv){
@@ -80,6 +219,13 @@ static void parse_args(int argc, char** argv){
         if(a == "--port" && i + 1 < argc) g_port = stoi(argv[++i]);
         else if(a == "--schema" && i + 1 < argc) g_schema_path = argv[++i];
         else if(a == "--data-root" && i + 1 < argc) g_data_root = argv[++i];
+        else if(a == "--wal-ack" && i + 1 < argc) g_wal_ack = parse_wal_ack_mode(argv[++i]);
+        else if(a == "--commit-window-ms" && i + 1 < argc) g_commit_window_ms = stoi(argv[++i]);
+        else if(a == "--no-wal") g_wal_enabled = false;
+        else if(a == "--compact-ratio" && i + 1 < argc) g_compact_ratio = stod(argv[++i]);
+        else if(a == "--compact-interval-ms" && i + 1 < argc) g_compact_interval_ms = stoi(argv[++i]);
+        else if(a == "--retention-interval-ms" && i + 1 < argc) g_retention_interval_ms = stoi(argv[++i]);
+        else if(a == "--scan-threads" && i + 1 < argc) g_scan_threads = stoi(argv[++i]);
         else if(a == "--help" || a == "-h"){ usage(); exit(0); }
         else{
             cerr << "неизвестный аргумент: " << a << "\n";
@@ -93,6 +239,12 @@ static void parse_args(int argc, char** argv){
 
     if(g_schema_path.empty()) throw runtime_error("пустой путь к schema.json");
     if(g_data_root.empty()) throw runtime_error("пустая папка data-root");
+    if(g_commit_window_ms < 0) throw runtime_error("отрицательное окно фиксации");
+    if(g_compact_ratio <= 0 || g_compact_ratio > 1) throw runtime_error("compact-ratio должно быть в (0, 1]");
+    if(g_compact_interval_ms <= 0) throw runtime_error("compact-interval-ms должно быть больше нуля");
+    if(g_retention_interval_ms <= 0) throw runtime_error("retention-interval-ms должно быть больше нуля");
+    if(g_scan_threads < 0) throw runtime_error("отрицательное число потоков сканирования");
+    ScanExecutor::set_default_threads((unsigned int)g_scan_threads);
 }
 
 static Database& get_db_by_name(const string& dbname){
@@ -105,12 +257,76 @@ static Database& get_db_by_name(const string& dbname){
     }
 
     Database* db = new Database(g_schema_path, dbname, g_data_root);
+    if(g_wal_enabled){
+        db->enable_wal(g_wal_ack, g_commit_window_ms, g_io_mutex);
+    }
     g_dbs.insert(dbname, db);
     g_db_ptrs.push_back(db);
     return *db;
 }
 
-static json process_request(const string& line){
+// Фоновая компактация: заполненные сегменты запечатываются здесь, а не при
+// вставке; удаления только помечают записи, и этот поток по одному сегменту
+// переписывает те, где удалённых накопилось много.
+// Блокировка берётся на каждый сегмент отдельно, запросы идут между ними.
+static void compactor_loop(){
+    while(true){
+        this_thread::sleep_for(chrono::milliseconds(g_compact_interval_ms));
+
+        Vector<Database*> dbs;
+        {
+            lock_guard<mutex> lock(g_dbs_mutex);
+            dbs = g_db_ptrs;
+        }
+
+        for(unsigned int i = 0; i < dbs.get_size(); i++){
+            while(true){
+                int compacted = 0;
+                try{
+                    lock_guard<mutex> io_lock(g_io_mutex);
+                    compacted = dbs[i]->compact(g_compact_ratio);
+                }catch(const exception& e){
+                    cerr << "ошибка компактации: " << e.what() << "\n";
+                }
+                if(compacted == 0) break;
+            }
+        }
+    }
+}
+
+// Фоновое удаление по сроку хранения (retention в schema.json): устаревшие
+// сегменты удаляются целиком, в сегменте на границе срока помечаются записи.
+// Как и при компактации, блокировка берётся на каждый сегмент отдельно.
+static void retention_loop(){
+    while(true){
+        this_thread::sleep_for(chrono::milliseconds(g_retention_interval_ms));
+
+        Vector<Database*> dbs;
+        {
+            lock_guard<mutex> lock(g_dbs_mutex);
+            dbs = g_db_ptrs;
+        }
+
+        long long now = chrono::duration_cast<chrono::seconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
+        for(unsigned int i = 0; i < dbs.get_size(); i++){
+            while(true){
+                int expired = 0;
+                try{
+                    lock_guard<mutex> io_lock(g_io_mutex);
+                    expired = dbs[i]->expire(now);
+                }catch(const exception& e){
+                    cerr << "ошибка удаления по сроку хранения: " << e.what() << "\n";
+                }
+                if(expired == 0) break;
+            }
+        }
+    }
+}
+
+// stream - куда писать ответ find по частям; если задан и операция find,
+// ответ уже отправлен через него, и возвращается null
+static json process_request(const string& line, const function<bool(const string&)>* stream = nullptr){
     json req;
     try{
         req = json::parse(line);
@@ -138,7 +354,7 @@ static json process_request(const string& line){
 
     json query = req.value("query", json::object());
 
-    lock_guard<mutex> io_lock(g_io_mutex);
+    unique_lock<mutex> io_lock(g_io_mutex);
 
     Database* dbp = nullptr;
     Collection* collp = nullptr;
@@ -152,13 +368,59 @@ static json process_request(const string& line){
     Collection& coll = *collp;
 
     if(operation == "find"){
-        auto docs = coll.find(query, json::object(), json::object(), 0);
+        json sort = req.value("sort", json::object());
+        if(!sort.is_object()) return err("поле sort должно быть объектом");
+        for(auto it = sort.begin(); it != sort.end(); ++it){
+            if(it.value() != 1 && it.value() != -1){
+                return err("направление сортировки поля " + it.key() + " должно быть 1 или -1");
+            }
+        }
+        json limit_field = req.value("limit", json(0));
+        if(!limit_field.is_number_integer() || limit_field.get<long long>() < 0){
+            return err("поле limit должно быть неотрицательным целым");
+        }
+        int limit = limit_field.get<int>();
+
+        // count_only: в ответе только count, документы не строятся и не передаются
+        json count_only = req.value("count_only", json(false));
+        if(!count_only.is_boolean()) return err("поле count_only должно быть true или false");
+        if(count_only.get<bool>()){
+            long long total = 0;
+            try{
+                total = coll.count(query);
+            }catch(const exception& e){
+                return err(string("ошибка фильтра: ") + e.what());
+            }
+            if(limit > 0 && total > limit) total = limit;
+            return ok("документы подсчитаны", json::array(), total);
+        }
+
+        Cursor cursor;
+        try{
+            // Проверка фильтра до начала ответа
+            cursor = coll.find_cursor(query, json::object(), limit, STREAM_BATCH);
+        }catch(const exception& e){
+            return err(string("ошибка фильтра: ") + e.what());
+        }
+
+        if(stream){
+            if(sort.empty()) stream_documents(coll, cursor, "документы получены", io_lock, *stream);
+            else stream_sorted(coll, query, sort, limit, "документы получены", io_lock, *stream);
+            return json();
+        }
+
+        Vector<json> docs;
+        try{
+            docs = coll.find(query, json::object(), sort, limit);
+        }catch(const exception& e){
+            return err(e.what());
+        }
 
         json data = json::array();
         for(unsigned int i = 0; i < docs.get_size(); i++){
             data.push_back(docs[i]);
         }
-        return ok("документы получены", data, (int)docs.get_size());
+        return ok("документы получены", data, docs.get_size());
     }
 
     if(operation == "insert"){
@@ -178,14 +440,26 @@ static json process_request(const string& line){
 
         string id = doc["_id"].get<string>();
 
+        if(coll.contains_id(id)){
+            return err("ошибка вставки: Документ с _id уже существует");
+        }
+
+        // Ожидание групповой фиксации идёт без g_io_mutex: его берёт поток журнала.
+        // Повтор _id, ещё не применённого журналом, отклоняет Database::insert
+        if(dbp->wal_enabled()) io_lock.unlock();
         try{
-            coll.insert(doc);
+            dbp->insert(collection, doc);
         }catch(const exception& e){
             return err(string("ошибка вставки: ") + e.what());
         }
 
-        json chk = coll.find_one({{"_id", id}}, json::object(), json::object());
-        if(chk.empty()){
+        // В режимах buffer и write документ может быть ещё не применён к коллекции
+        if(dbp->wal_enabled() && g_wal_ack != WalAckMode::Fsync){
+            return ok("документ добавлен", json::array(), 1);
+        }
+
+        if(!io_lock.owns_lock()) io_lock.lock();
+        if(!coll.contains_id(id)){
             return err("insert выполнен, но документ не найден после сохранения");
         }
 
@@ -193,10 +467,77 @@ static json process_request(const string& line){
     }
 
     if(operation == "delete"){
-        int deleted = coll.delete_many(query);
+        int deleted = 0;
+        // Удаление пишется в журнал и применяется потоком журнала, как вставка
+        if(dbp->wal_enabled()) io_lock.unlock();
+        try{
+            deleted = dbp->delete_many(collection, query);
+        }catch(const exception& e){
+            return err(string("ошибка удаления: ") + e.what());
+        }
         return ok("удаление выполнено", json::array(), deleted);
     }
 
+    if(operation == "count"){
+        long long total = 0;
+        try{
+            total = coll.count(query);
+        }catch(const exception& e){
+            return err(string("ошибка подсчёта: ") + e.what());
+        }
+        return ok("документы подсчитаны", json::array(), total);
+    }
+
+    if(operation == "aggregate"){
+        if(!req.contains("pipeline")){
+            return err("для aggregate поле pipeline обязательно");
+        }
+        Vector<json> rows;
+        try{
+            rows = coll.aggregate(req["pipeline"]);
+        }catch(const exception& e){
+            return err(string("ошибка агрегации: ") + e.what());
+        }
+
+        json data = json::array();
+        for(unsigned int i = 0; i < rows.get_size(); i++){
+            data.push_back(rows[i]);
+        }
+        return ok("агрегация выполнена", data, rows.get_size());
+    }
+
+    if(operation == "date_histogram"){
+        json spec = json::object();
+        const char* keys[] = {"field", "interval", "group_by", "from", "to"};
+        for(const char* key : keys){
+            if(req.contains(key)) spec[key] = req[key];
+        }
+        json buckets;
+        try{
+            buckets = coll.date_histogram(query, spec);
+        }catch(const exception& e){
+            return err(string("ошибка гистограммы: ") + e.what());
+        }
+        return ok("гистограмма построена", buckets, buckets.size());
+    }
+
+    if(operation == "topk"){
+        if(!req.contains("field") || !req["field"].is_string() || req["field"].get<string>().empty()){
+            return err("для topk поле field обязательно");
+        }
+        json k_field = req.value("k", json(10));
+        if(!k_field.is_number_integer() || k_field.get<long long>() <= 0 || k_field.get<long long>() > 10000){
+            return err("поле k должно быть целым от 1 до 10000");
+        }
+        json top;
+        try{
+            top = coll.top_values(query, req["field"].get<string>(), k_field.get<unsigned int>());
+        }catch(const exception& e){
+            return err(string("ошибка topk: ") + e.what());
+        }
+        return ok("частые значения получены", top, top.size());
+    }
+
     return err("неизвестная операция");
 }
 
@@ -229,6 +570,47 @@ static bool send_http_response(int fd, const json& response, int status_code = 2
     return send_all(fd, http_response);
 }
 
+// Ответ с телом неизвестной длины: Transfer-Encoding: chunked, кусок на пачку
+static bool send_http_stream_head(int fd, int status_code = 200) {
+    string head = "HTTP/1.1 " + to_string(status_code) + " OK\r\n";
+    head += "Content-Type: application/json\r\n";
+    head += "Transfer-Encoding: chunked\r\n";
+    head += "Connection: close\r\n";
+    head += "Access-Control-Allow-Origin: *\r\n";
+    head += "\r\n";
+    return send_all(fd, head);
+}
+
+static bool send_http_chunk(int fd, const string& data) {
+    if(data.empty()) return true;
+    char size[20];
+    snprintf(size, sizeof(size), "%zx\r\n", data.size());
+    return send_all(fd, string(size) + data + "\r\n");
+}
+
+static bool send_http_stream_end(int fd) {
+    return send_all(fd, "0\r\n\r\n");
+}
+
+// Запрос по HTTP: ответ find идёт по частям, остальные операции - одним телом
+static void serve_http_request(int fd, const string& body_line) {
+    bool streamed = false;
+    function<bool(const string&)> write = [&](const string& chunk){
+        if(!streamed){
+            streamed = true;
+            if(!send_http_stream_head(fd)) return false;
+        }
+        return send_http_chunk(fd, chunk);
+    };
+
+    json resp = process_request(body_line, &write);
+    if(streamed){
+        send_http_stream_end(fd);
+    }else{
+        send_http_response(fd, resp);
+    }
+}
+
 static void handle_client(int client_fd){
     for(;;){
         string line;
@@ -241,23 +623,28 @@ static void handle_client(int client_fd){
             while(true) {
                 string header;
                 if(!read_line(client_fd, header)) break;
-                if(header.empty()) break; 
+                if(!header.empty() && header.back() == '\r') header.pop_back();
+                if(header.empty()) break;
             }
             
 
             if(line.find("GET /api/events") == 0) {
                 try {
+                    unique_lock<mutex> io_lock(g_io_mutex);
                     Database& db = get_db_by_name("siem");
                     Collection& coll = db.get_collection("events");
-                    auto docs = coll.find(json::object(), json::object(), json::object(), 0);
-                    
-                    json data = json::array();
-                    for(unsigned int i = 0; i < docs.get_size(); i++){
-                        data.push_back(docs[i]);
+
+                    io_lock.unlock();
+                    bool head_sent = send_http_stream_head(client_fd);
+                    io_lock.lock();
+                    if(head_sent){
+                        Cursor cursor = coll.find_cursor(json::object(), json::object(), 0, STREAM_BATCH);
+                        bool sent = stream_documents(coll, cursor, "события получены", io_lock, [&](const string& chunk){
+                            return send_http_chunk(client_fd, chunk);
+                        });
+                        io_lock.unlock();
+                        if(sent) send_http_stream_end(client_fd);
                     }
-                    
-                    json resp = ok("события получены", data, (int)docs.get_size());
-                    send_http_response(client_fd, resp);
                 } catch(const exception& e) {
                     json resp = err(e.what());
                     send_http_response(client_fd, resp, 500);
@@ -268,24 +655,28 @@ static void handle_client(int client_fd){
                 // Читаем тело запроса
                 string body_line;
                 if(read_line(client_fd, body_line)) {
-                    json resp = process_request(body_line);
-                    send_http_response(client_fd, resp);
+                    serve_http_request(client_fd, body_line);
                 }
             }
            
             else {
                 string body_line;
                 if(read_line(client_fd, body_line)) {
-                    json resp = process_request(body_line);
-                    send_http_response(client_fd, resp);
+                    serve_http_request(client_fd, body_line);
                 }
             }
         }
         else {
           
-            json resp = process_request(line);
-            string reply = resp.dump() + "\n";
-            if(!send_all(client_fd, reply)) break;
+            bool sent = true;
+            function<bool(const string&)> write = [&](const string& chunk){
+                sent = sent && send_all(client_fd, chunk);
+                return sent;
+            };
+
+            json resp = process_request(line, &write);
+            string reply = resp.is_null() ? "\n" : resp.dump() + "\n";
+            if(!sent || !send_all(client_fd, reply)) break;
         }
     }
     close(client_fd);
@@ -326,6 +717,11 @@ int main(int argc, char** argv){
         return 1;
     }
 
+    thread compactor(compactor_loop);
+    compactor.detach();
+    thread retention(retention_loop);
+    retention.detach();
+
     Queue<int> q;
     mutex q_m;
     condition_variable q_cv;
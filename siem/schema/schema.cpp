@@ -1,4 +1,6 @@
 #include "schema.h"
+#include "../collection/date_histogram.h"
+#include "../collection/filter.h"
 #include <fstream>
 #include <stdexcept>
 #include <string>
@@ -20,6 +22,41 @@ static int j_get_int(const json& j, const string& k){
     return j[k].get<int>();
 }
 
+// Раздел вида {"коллекция": ["поле", ...]}. kind - что строится по полю (для
+// сообщений об ошибках); strings_only - только по строковым полям structure
+static void load_field_lists(const json& j, const string& section, Schema& schema,
+                             Vector<string> CollectionOptions::*target,
+                             const string& kind, bool strings_only){
+    if(!j.contains(section)) return;
+    if(!j[section].is_object()){
+        throw runtime_error("schema.json: поле " + section + " должно быть объектом");
+    }
+    auto section_obj = j[section];
+    for(auto it = section_obj.begin(); it != section_obj.end(); ++it){
+        string collection = it.key();
+        if(!schema.structure.contains(collection)){
+            throw runtime_error("schema.json: " + section + " для неизвестной коллекции " + collection);
+        }
+        if(!it.value().is_array()){
+            throw runtime_error("schema.json: " + section + "." + collection + " должно быть массивом");
+        }
+        json fields = schema.structure[collection];
+        for(const auto& field : it.value()){
+            if(!field.is_string()){
+                throw runtime_error("schema.json: " + section + "." + collection + " должно содержать строки");
+            }
+            string field_name = field.get<string>();
+            if(strings_only && (!fields.contains(field_name) || fields[field_name] != "str")){
+                throw runtime_error("schema.json: " + kind + " по нестроковому полю " + collection + "." + field_name);
+            }
+            if(!strings_only && (field_name == "_id" || !fields.contains(field_name))){
+                throw runtime_error("schema.json: " + kind + " по неизвестному полю " + collection + "." + field_name);
+            }
+            (schema.options[collection].*target).push_back(field_name);
+        }
+    }
+}
+
 Schema load_schema(const string& filename){
     ifstream file(filename);
     if(!file.is_open()){
@@ -44,6 +81,195 @@ Schema load_schema(const string& filename){
     auto structure_obj = j["structure"];
     for(auto it = structure_obj.begin(); it != structure_obj.end(); ++it){
         schema.structure.insert(it.key(), it.value());
+        schema.options.insert(it.key(), CollectionOptions());
+    }
+
+    load_field_lists(j, "indexes", schema, &CollectionOptions::indexes, "индекс", false);
+
+    // Полнотекстовый индекс ($text) и индекс триграмм ($contains, $regex)
+    // строятся только по строковым полям
+    load_field_lists(j, "text", schema, &CollectionOptions::text_fields, "индекс text", true);
+    load_field_lists(j, "trigram", schema, &CollectionOptions::trigram_fields, "индекс trigram", true);
+    // Скетчи HyperLogLog для $approx_distinct
+    load_field_lists(j, "distinct", schema, &CollectionOptions::distinct_fields, "скетч distinct", true);
+
+    if(j.contains("partitions")){
+        if(!j["partitions"].is_object()){
+            throw runtime_error("schema.json: поле partitions должно быть объектом");
+        }
+        auto partitions_obj = j["partitions"];
+        for(auto it = partitions_obj.begin(); it != partitions_obj.end(); ++it){
+            string collection = it.key();
+            if(!schema.structure.contains(collection)){
+                throw runtime_error("schema.json: partitions для неизвестной коллекции " + collection);
+            }
+            if(!it.value().is_object()){
+                throw runtime_error("schema.json: partitions." + collection + " должно быть объектом");
+            }
+            string field = j_get_string(it.value(), "field");
+            string interval = j_get_string(it.value(), "interval");
+
+            json fields = schema.structure[collection];
+            if(!fields.contains(field) || fields[field] != "timestamp"){
+                throw runtime_error("schema.json: партиционировать можно только по полю timestamp: " + collection + "." + field);
+            }
+            if(interval != "day" && interval != "hour"){
+                throw runtime_error("schema.json: partitions." + collection + ".interval должно быть day или hour");
+            }
+            schema.options[collection].partition_field = field;
+            schema.options[collection].partition_interval = interval;
+        }
+    }
+
+    if(j.contains("storage")){
+        if(!j["storage"].is_object()){
+            throw runtime_error("schema.json: поле storage должно быть объектом");
+        }
+        auto storage_obj = j["storage"];
+        for(auto it = storage_obj.begin(); it != storage_obj.end(); ++it){
+            string collection = it.key();
+            if(!schema.structure.contains(collection)){
+                throw runtime_error("schema.json: storage для неизвестной коллекции " + collection);
+            }
+            if(!it.value().is_object()){
+                throw runtime_error("schema.json: storage." + collection + " должно быть объектом");
+            }
+            if(it.value().contains("sealed")){
+                string sealed = j_get_string(it.value(), "sealed");
+                if(sealed != "row" && sealed != "columnar"){
+                    throw runtime_error("schema.json: storage." + collection + ".sealed должно быть row или columnar");
+                }
+                schema.options[collection].sealed_format = sealed;
+            }
+            if(it.value().contains("encoding")){
+                string encoding = j_get_string(it.value(), "encoding");
+                if(encoding != "json" && encoding != "cbor" && encoding != "msgpack"){
+                    throw runtime_error("schema.json: storage." + collection + ".encoding должно быть json, cbor или msgpack");
+                }
+                schema.options[collection].encoding = encoding;
+            }
+        }
+    }
+
+    if(j.contains("retention")){
+        if(!j["retention"].is_object()){
+            throw runtime_error("schema.json: поле retention должно быть объектом");
+        }
+        auto retention_obj = j["retention"];
+        for(auto it = retention_obj.begin(); it != retention_obj.end(); ++it){
+            string collection = it.key();
+            if(!schema.structure.contains(collection)){
+                throw runtime_error("schema.json: retention для неизвестной коллекции " + collection);
+            }
+            if(!it.value().is_object()){
+                throw runtime_error("schema.json: retention." + collection + " должно быть объектом");
+            }
+            string field = it.value().contains("field") ? j_get_string(it.value(), "field") : "timestamp";
+            string period = j_get_string(it.value(), "period");
+
+            json fields = schema.structure[collection];
+            if(!fields.contains(field) || fields[field] != "timestamp"){
+                throw runtime_error("schema.json: retention." + collection + ": поле " + field + " должно иметь тип timestamp");
+            }
+            long long seconds = DateHistogram::parse_interval(period);
+            if(seconds <= 0){
+                throw runtime_error("schema.json: retention." + collection + ": некорректный period " + period);
+            }
+            schema.options[collection].retention_field = field;
+            schema.options[collection].retention_seconds = seconds;
+        }
+    }
+
+    if(j.contains("rollups")){
+        if(!j["rollups"].is_object()){
+            throw runtime_error("schema.json: поле rollups должно быть объектом");
+        }
+        auto rollups_obj = j["rollups"];
+        for(auto it = rollups_obj.begin(); it != rollups_obj.end(); ++it){
+            string collection = it.key();
+            if(!schema.structure.contains(collection)){
+                throw runtime_error("schema.json: rollups для неизвестной коллекции " + collection);
+            }
+            if(!it.value().is_array()){
+                throw runtime_error("schema.json: rollups." + collection + " должно быть массивом");
+            }
+            json fields = schema.structure[collection];
+            Vector<RollupOptions>& rollups = schema.options[collection].rollups;
+            for(const auto& item : it.value()){
+                if(!item.is_object()){
+                    throw runtime_error("schema.json: rollups." + collection + " должно содержать объекты");
+                }
+                RollupOptions rollup;
+                rollup.name = j_get_string(item, "name");
+                rollup.field = item.contains("field") ? j_get_string(item, "field") : "timestamp";
+                rollup.interval = j_get_string(item, "interval");
+                if(item.contains("group_by")) rollup.group_by = j_get_string(item, "group_by");
+
+                string prefix = "schema.json: rollups." + collection + "." + rollup.name;
+                for(unsigned int r = 0; r < rollups.get_size(); r++){
+                    if(rollups[r].name == rollup.name) throw runtime_error(prefix + " объявлен дважды");
+                }
+                if(!fields.contains(rollup.field) || fields[rollup.field] != "timestamp"){
+                    throw runtime_error(prefix + ": поле " + rollup.field + " должно иметь тип timestamp");
+                }
+                if(DateHistogram::parse_interval(rollup.interval) <= 0){
+                    throw runtime_error(prefix + ": некорректный interval " + rollup.interval);
+                }
+                if(!rollup.group_by.empty() && !fields.contains(rollup.group_by)){
+                    throw runtime_error(prefix + ": неизвестное поле group_by " + rollup.group_by);
+                }
+                rollups.push_back(rollup);
+            }
+        }
+    }
+
+    // Частые значения: имя поля или {"field": ..., "where": фильтр, "capacity": N}
+    if(j.contains("topk")){
+        if(!j["topk"].is_object()){
+            throw runtime_error("schema.json: поле topk должно быть объектом");
+        }
+        auto topk_obj = j["topk"];
+        for(auto it = topk_obj.begin(); it != topk_obj.end(); ++it){
+            string collection = it.key();
+            if(!schema.structure.contains(collection)){
+                throw runtime_error("schema.json: topk для неизвестной коллекции " + collection);
+            }
+            if(!it.value().is_array()){
+                throw runtime_error("schema.json: topk." + collection + " должно быть массивом");
+            }
+            json fields = schema.structure[collection];
+            for(const auto& item : it.value()){
+                TopKOptions topk;
+                if(item.is_string()){
+                    topk.field = item.get<string>();
+                }else if(item.is_object()){
+                    topk.field = j_get_string(item, "field");
+                    if(item.contains("where")){
+                        try{
+                            Filter check(item["where"]);
+                        }catch(const exception& e){
+                            throw runtime_error("schema.json: topk." + collection + "." + topk.field +
+                                                ".where: " + e.what());
+                        }
+                        topk.where = item["where"].is_null() ? json::object() : item["where"];
+                    }
+                    if(item.contains("capacity")){
+                        int capacity = j_get_int(item, "capacity");
+                        if(capacity < 10 || capacity > 100000){
+                            throw runtime_error("schema.json: topk." + collection + "." + topk.field +
+                                                ".capacity должно быть от 10 до 100000");
+                        }
+                        topk.capacity = (unsigned int)capacity;
+                    }
+                }else{
+                    throw runtime_error("schema.json: topk." + collection + " должно содержать строки или объекты");
+                }
+                if(!fields.contains(topk.field)){
+                    throw runtime_error("schema.json: topk по неизвестному полю " + collection + "." + topk.field);
+                }
+                schema.options[collection].topk.push_back(topk);
+            }
+        }
     }
 
     return schema;
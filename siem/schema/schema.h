@@ -6,18 +6,59 @@
 
 using namespace std;
 
+// Счётчик документов по интервалам поля времени (и значениям group_by),
+// который коллекция ведёт при вставке и удалении (см. Rollup)
+struct RollupOptions {
+    string name;
+    string field;
+    string interval;
+    string group_by;
+};
+
+// Частые значения поля (см. TopKSketch): where - фильтр документов,
+// capacity - число счётчиков Space-Saving
+struct TopKOptions {
+    string field;
+    nlohmann::json where;
+    unsigned int capacity;
+
+    TopKOptions() : where(nlohmann::json::object()), capacity(1000) {}
+};
+
+// Настройки хранения коллекции, заданные в schema.json помимо structure
+struct CollectionOptions {
+    Vector<string> indexes;
+    Vector<string> text_fields;
+    Vector<string> trigram_fields;
+    Vector<string> distinct_fields;
+    Vector<RollupOptions> rollups;
+    Vector<TopKOptions> topk;
+    string partition_field;
+    string partition_interval;
+    string sealed_format;
+    string encoding;
+    // Срок хранения: документы, у которых retention_field старше
+    // retention_seconds, удаляются фоновым заданием (0 - без срока)
+    string retention_field;
+    long long retention_seconds;
+
+    CollectionOptions() : retention_seconds(0) {}
+};
+
 struct Schema {
     string name;
     int tuples_limit;
     HashMap<string, nlohmann::json> structure;
+    HashMap<string, CollectionOptions> options;
     
     Schema() : tuples_limit(1000) {}
-    Schema(const Schema& other) : name(other.name), tuples_limit(other.tuples_limit), structure(other.structure) {}
+    Schema(const Schema& other) : name(other.name), tuples_limit(other.tuples_limit), structure(other.structure), options(other.options) {}
     Schema& operator=(const Schema& other) {
         if (this != &other) {
             name = other.name;
             tuples_limit = other.tuples_limit;
             structure = other.structure;
+            options = other.options;
         }
         return *this;
     }
@@ -0,0 +1,23 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <filesystem>
+
+// Проверки тестов: провал печатает место и выражение, но тест продолжается;
+// main возвращает число провалов (0 - тест пройден)
+static int g_failures = 0;
+
+#define CHECK(expr) do{ \
+    if(!(expr)){ \
+        std::cerr << __FILE__ << ":" << __LINE__ << ": не выполнено " << #expr << "\n"; \
+        g_failures++; \
+    } \
+}while(0)
+
+// Пустой каталог для данных теста (с завершающим /)
+static std::string test_dir(const std::string& name){
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / ("siem_test_" + name);
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    return dir.string() + "/";
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "check.h"
+#include "collection/collection.h"
+
+// Ответы count и find коллекции по каждому фильтру из filters совпадают
+// с перебором documents через Filter::matches: индексы, зоны, префильтр
+// и колоночное чтение не должны терять подходящие документы
+static void check_against_scan(const Collection& c, const Vector<json>& documents,
+                               const json& filters, const std::string& label){
+    for(const auto& filter : filters){
+        Filter compiled(filter);
+        long long expected = 0;
+        for(unsigned int i = 0; i < documents.get_size(); i++){
+            if(compiled.matches(documents[i])) expected++;
+        }
+        long long counted = c.count(filter);
+        long long found = (long long)c.find(filter).get_size();
+        if(counted != expected || found != expected){
+            std::cerr << label << " " << filter.dump() << ": ожидалось " << expected
+                      << ", count " << counted << ", find " << found << "\n";
+        }
+        CHECK(counted == expected);
+        CHECK(found == expected);
+    }
+}
@@ -0,0 +1,106 @@
+// Поиск многих подстрок автоматом Ахо-Корасик: ответ search совпадает
+// с поиском каждого образца по отдельности (с учётом и без учёта регистра),
+// а $any_of_substrings в коллекции отвечает так же, как перебор документов.
+#include "scan_check.h"
+#include "collection/aho_corasick.h"
+#include <random>
+#include <algorithm>
+
+using namespace std;
+namespace fs = filesystem;
+
+static string lower(string s){
+    transform(s.begin(), s.end(), s.begin(), [](unsigned char ch){ return (char)tolower(ch); });
+    return s;
+}
+
+static bool naive_search(const Vector<string>& patterns, const string& text, bool ignore_case){
+    string haystack = ignore_case ? lower(text) : text;
+    for(unsigned int i = 0; i < patterns.get_size(); i++){
+        string needle = ignore_case ? lower(patterns[i]) : patterns[i];
+        if(haystack.find(needle) != string::npos) return true;
+    }
+    return false;
+}
+
+// Случайные строки из маленького алфавита, чтобы образцы пересекались
+// и ссылки по неудаче шли далеко
+static string random_string(mt19937& rng, unsigned int max_length){
+    static const char alphabet[] = "abAB.\\\"\x01\xC3\xBC";
+    string s;
+    unsigned int length = rng() % (max_length + 1);
+    for(unsigned int i = 0; i < length; i++) s.push_back(alphabet[rng() % (sizeof(alphabet) - 1)]);
+    return s;
+}
+
+static void check_automaton(){
+    mt19937 rng(18);
+    for(int round = 0; round < 300; round++){
+        Vector<string> patterns;
+        unsigned int count = 1 + rng() % 8;
+        for(unsigned int i = 0; i < count; i++){
+            string pattern = random_string(rng, 5);
+            if(pattern.empty()) pattern = "a";
+            patterns.push_back(pattern);
+        }
+        for(int ignore_case = 0; ignore_case < 2; ignore_case++){
+            auto automaton = AhoCorasick::compile(patterns, ignore_case);
+            for(int t = 0; t < 20; t++){
+                string text = random_string(rng, 24);
+                bool expected = naive_search(patterns, text, ignore_case);
+                CHECK(automaton->search(text) == expected);
+            }
+        }
+    }
+}
+
+static const char* MESSAGES[] = {
+    "cmd.exe /c whoami",
+    "CMD.EXE /C NET USER",
+    "C:\\Windows\\System32\\svchost.exe",
+    "connect to 10.0.0.15 port 443",
+    "quote \"admin\" here",
+    "unicode ünïcode ÜNÏCODE",
+    "evil.example.com resolved",
+    "EVIL.EXAMPLE.COM resolved",
+    "nothing to see",
+    ""
+};
+
+static json filters(){
+    return json::array({
+        {{"msg", {{"$any_of_substrings", json::array({"whoami", "\\System32", "\"admin"})}}}},
+        {{"msg", {{"$any_of_substrings", json::array({"WHOAMI", "\\SYSTEM32", "ÜNÏ"})}, {"$options", "i"}}}},
+        {{"msg", {{"$any_of_substrings", json::array({"evil.example.com", "10.0.0.15"})}}}},
+        {{"msg", {{"$any_of_substrings", json::array({"evil.example.com"})}, {"$options", "i"}}}},
+        {{"msg", {{"$any_of_substrings", json::array({"absent", "also absent"})}}}},
+        {{"msg", {{"$any_of_substrings", json::array({"e"})}}}, {"host", "h1"}},
+        {{"$or", json::array({{{"msg", {{"$any_of_substrings", json::array({"443"})}}}},
+                              {{"host", "h2"}}})}}
+    });
+}
+
+int main(){
+    check_automaton();
+
+    const char* formats[] = {"row", "columnar"};
+    for(const char* sealed : formats){
+        string root = test_dir(string("aho_corasick_") + sealed);
+        CollectionOptions options;
+        options.sealed_format = sealed;
+        options.trigram_fields.push_back("msg");
+
+        Collection c("ev", root, 25, {{"msg", "str"}, {"host", "str"}}, options);
+        Vector<json> documents;
+        int n = sizeof(MESSAGES) / sizeof(MESSAGES[0]);
+        for(int i = 0; i < 200; i++){
+            json document = {{"_id", "a" + to_string(i)}, {"msg", MESSAGES[i % n]}, {"host", "h" + to_string(i % 3)}};
+            documents.push_back(document);
+            c.insert(document);
+        }
+        c.seal_segments(100);
+        check_against_scan(c, documents, filters(), sealed);
+        fs::remove_all(root);
+    }
+    return g_failures;
+}
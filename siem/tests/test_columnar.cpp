@@ -0,0 +1,163 @@
+// Колоночные сегменты N.col: запечатывание заполненных сегментов, документы
+// с полями вне structure, вложенными значениями и пропусками, чтение
+// отдельных колонок (проекция и фильтр) и удаления до и после запечатывания.
+#include "check.h"
+#include "collection/collection.h"
+#include "collection/column_file.h"
+#include <fstream>
+
+using namespace std;
+namespace fs = filesystem;
+
+static const int DOCUMENTS = 300;
+
+static json make_document(int i){
+    json document = {
+        {"_id", "c" + to_string(i)},
+        {"host", "web-" + to_string(i % 7)},
+        {"port", i},
+        {"score", i * 0.25},
+        {"msg", "user \"admin\" \\ ünïcode " + to_string(i)},
+        {"tags", json::array({"a", i % 2 ? "b" : "c"})},
+        {"nested", {{"k", i}, {"flag", i % 3 == 0}}}
+    };
+    if(i % 5 == 0) document["extra"] = {{"note", "x" + to_string(i)}};
+    if(i % 11 == 0) document.erase("host");
+    if(i % 13 == 0) document["port"] = nullptr;
+    if(i % 17 == 0) document["score"] = "not a number";
+    return document;
+}
+
+static json structure(){
+    return {{"host", "str"}, {"port", "int"}, {"score", "float"}, {"msg", "str"}};
+}
+
+static bool deleted_before_seal(int i){ return i % 10 == 3; }
+static bool deleted_after_seal(int i){ return i % 10 == 4; }
+
+static void check_contents(const Collection& c, bool sealed_deletes, const string& step){
+    bool ok = true;
+    long long expected = 0;
+    long long expected_host = 0;
+    for(int i = 0; i < DOCUMENTS; i++){
+        bool gone = deleted_before_seal(i) || (sealed_deletes && deleted_after_seal(i));
+        string id = "c" + to_string(i);
+        json found = c.find_one({{"_id", id}}, json::object(), json::object());
+        if(gone){
+            ok = ok && found.is_null();
+            continue;
+        }
+        expected++;
+        if(i % 7 == 2 && i % 11 != 0) expected_host++;
+        json document = make_document(i);
+        ok = ok && found == document;
+
+        // Проекция читает только свои колонки (и колонку прочих полей)
+        json projected = c.find_one({{"_id", id}}, json::array({"port", "extra"}), json::object());
+        json expected_projection = {{"port", document["port"]}};
+        if(document.contains("extra")) expected_projection["extra"] = document["extra"];
+        ok = ok && projected == expected_projection;
+    }
+    if(!ok) cerr << "шаг: " << step << "\n";
+    CHECK(ok);
+    CHECK(c.count(json::object()) == expected);
+    CHECK(c.count({{"host", "web-2"}}) == expected_host);
+    CHECK(c.count({{"nested.flag", true}}) == (long long)c.find({{"nested.flag", true}}).get_size());
+}
+
+int main(){
+    string root = test_dir("columnar");
+    string dir = root + "ev/";
+    CollectionOptions options;
+    options.sealed_format = "columnar";
+    options.indexes.push_back("host");
+
+    {
+        Collection c("ev", root, 40, structure(), options);
+        for(int i = 0; i < DOCUMENTS; i++) c.insert(make_document(i));
+        for(int i = 0; i < DOCUMENTS; i++){
+            if(deleted_before_seal(i)) c.delete_one({{"_id", "c" + to_string(i)}});
+        }
+
+        // Запечатывание выбрасывает помеченные записи и сдвигает номера
+        while(c.seal_segments(100) > 0){}
+        check_contents(c, false, "запечатывание");
+        for(int i = 0; i < DOCUMENTS; i++){
+            if(deleted_after_seal(i)) c.delete_one({{"_id", "c" + to_string(i)}});
+        }
+        check_contents(c, true, "удаление после запечатывания");
+        c.sync();
+    }
+
+    int columns = 0;
+    int rows = 0;
+    for(const auto& entry : fs::directory_iterator(dir)){
+        if(entry.path().extension() == ".col") columns++;
+        if(entry.path().extension() == ".seg") rows++;
+    }
+    CHECK(columns == DOCUMENTS / 40);
+    CHECK(rows == 1);
+
+    {
+        Collection c("ev", root, 40, structure(), options);
+        check_contents(c, true, "открытие");
+    }
+
+    // Незнакомая версия формата не читается как текущая
+    string copy = root + "unknown_version.col";
+    fs::copy_file(dir + "1.col", copy);
+    {
+        fstream file(copy, ios::binary | ios::in | ios::out);
+        file.seekp(4);
+        file.put((char)99);
+    }
+    bool rejected = false;
+    try{
+        ColumnFile column;
+        column.open(copy);
+    }catch(const runtime_error&){
+        rejected = true;
+    }
+    CHECK(rejected);
+    fs::remove_all(root);
+
+    // Сбой после появления N.col, но до удаления N.del и записи манифеста:
+    // пометки относятся к номерам N.seg и не должны применяться к N.col
+    root = test_dir("columnar_crash");
+    dir = root + "ev/";
+    string saved = root + "saved/";
+    fs::create_directories(saved);
+    {
+        // Удаления идут вперемешку со вставками: N.del заводится, когда
+        // в сегменте ещё мало записей
+        Collection c("ev", root, 40, structure(), options);
+        for(int i = 0; i < DOCUMENTS; i++){
+            c.insert(make_document(i));
+            if(deleted_before_seal(i)) c.delete_one({{"_id", "c" + to_string(i)}});
+        }
+    }
+    // Жёсткая ссылка видит N.del таким, каким он был перед удалением
+    for(const auto& entry : fs::directory_iterator(dir)){
+        if(entry.path().extension() == ".del"){
+            fs::create_hard_link(entry.path(), saved + entry.path().filename().string());
+        }
+        if(entry.path().filename() == "manifest.json"){
+            fs::copy_file(entry.path(), saved + entry.path().filename().string());
+        }
+    }
+    {
+        Collection c("ev", root, 40, structure(), options);
+        while(c.seal_segments(100) > 0){}
+    }
+    for(const auto& entry : fs::directory_iterator(saved)){
+        string target = dir + entry.path().filename().string();
+        fs::remove(target);
+        fs::copy_file(entry.path(), target);
+    }
+    {
+        Collection c("ev", root, 40, structure(), options);
+        check_contents(c, false, "сбой при запечатывании");
+    }
+    fs::remove_all(root);
+    return g_failures;
+}
@@ -0,0 +1,197 @@
+// Удаления пометками N.del и компактация: помеченные записи не видны
+// запросам до и после открытия, компактация переписывает сегменты без них,
+// и после неё коллекция открывается с тем же содержимым.
+#include "check.h"
+#include "collection/collection.h"
+#include <fstream>
+#include <iterator>
+
+using namespace std;
+namespace fs = filesystem;
+
+static const int DOCUMENTS = 400;
+
+static json make_document(int i){
+    json document = {
+        {"_id", "d" + to_string(i)},
+        {"host", "web-" + to_string(i % 7)},
+        {"port", i},
+        {"msg", "user \"admin\" \\ ünïcode " + to_string(i)},
+        {"nested", {{"k", i}}}
+    };
+    if(i % 5 == 0) document["extra"] = {{"note", "x" + to_string(i)}};
+    return document;
+}
+
+static json structure(){
+    return {{"host", "str"}, {"port", "int"}, {"msg", "str"}};
+}
+
+static bool deleted_first(int i){ return i % 10 == 3; }
+static bool deleted_second(int i){ return i % 10 == 4 || (i >= 100 && i < 150); }
+
+static void check_contents(const Collection& c, bool second_delete, const string& step){
+    long long expected = 0;
+    long long expected_host = 0;
+    bool ok = true;
+    for(int i = 0; i < DOCUMENTS; i++){
+        bool gone = deleted_first(i) || (second_delete && deleted_second(i));
+        json found = c.find_one({{"_id", "d" + to_string(i)}}, json::object(), json::object());
+        if(gone){
+            ok = ok && found.is_null() && !c.contains_id("d" + to_string(i));
+            continue;
+        }
+        expected++;
+        if(i % 7 == 3) expected_host++;
+        ok = ok && found == make_document(i);
+    }
+    if(!ok) cerr << "шаг: " << step << "\n";
+    CHECK(ok);
+    CHECK(c.count(json::object()) == expected);
+    CHECK((long long)c.find(json::object()).get_size() == expected);
+    CHECK(c.count({{"host", "web-3"}}) == expected_host);
+}
+
+static void run(const string& encoding, const string& sealed){
+    string label = encoding + "/" + sealed;
+    string root = test_dir("compaction_" + encoding + "_" + sealed);
+
+    CollectionOptions options;
+    options.encoding = encoding;
+    options.sealed_format = sealed;
+    options.indexes.push_back("host");
+
+    {
+        Collection c("ev", root, 50, structure(), options);
+        for(int i = 0; i < DOCUMENTS; i++) c.insert(make_document(i));
+        CHECK(c.delete_many({{"port", {{"$in", json::array()}}}}) == 0);
+        for(int i = 0; i < DOCUMENTS; i++){
+            if(deleted_first(i)) CHECK(c.delete_one({{"_id", "d" + to_string(i)}}) == 1);
+        }
+        CHECK(c.delete_one({{"_id", "d3"}}) == 0);
+        check_contents(c, false, label + " удаление");
+        while(c.seal_segments(100) > 0){}
+        CHECK(c.delete_many({{"port", {{"$gte", 100}, {"$lt", 150}}}}) == 45);
+        for(int i = 0; i < DOCUMENTS; i++){
+            if(deleted_second(i) && !(i >= 100 && i < 150)) c.delete_one({{"_id", "d" + to_string(i)}});
+        }
+        check_contents(c, true, label + " удаление после запечатывания");
+    }
+    {
+        Collection c("ev", root, 50, structure(), options);
+        check_contents(c, true, label + " открытие с пометками");
+
+        // Удалённые _id можно вставить снова, пока пометки не выброшены
+        c.insert(make_document(3));
+        CHECK(c.delete_one({{"_id", "d3"}}) == 1);
+
+        int rewritten = 0;
+        int step = 0;
+        while((step = c.compact(0.0, 100)) > 0) rewritten += step;
+        CHECK(rewritten > 0);
+        CHECK(c.compact(0.0, 100) == 0);
+        check_contents(c, true, label + " компактация");
+    }
+    bool tombstones = false;
+    for(const auto& entry : fs::directory_iterator(root + "ev/")){
+        if(entry.path().extension() == ".del") tombstones = true;
+    }
+    CHECK(!tombstones);
+    {
+        Collection c("ev", root, 50, structure(), options);
+        check_contents(c, true, label + " открытие после компактации");
+    }
+    fs::remove_all(root);
+}
+
+// Копия манифеста и жёсткие ссылки на N.del: ссылка видит файл таким,
+// каким он был в момент удаления
+static void save_files(const string& from, const string& to){
+    for(const auto& entry : fs::directory_iterator(from)){
+        string target = to + entry.path().filename().string();
+        if(entry.path().extension() == ".del") fs::create_hard_link(entry.path(), target);
+        if(entry.path().filename() == "manifest.json") fs::copy_file(entry.path(), target);
+    }
+}
+
+static void restore_files(const string& from, const string& to){
+    for(const auto& entry : fs::directory_iterator(from)){
+        string target = to + entry.path().filename().string();
+        fs::remove(target);
+        fs::copy_file(entry.path(), target);
+    }
+}
+
+// Сбой между заменой файла сегмента и удалением его N.del: рядом с
+// перенумерованным файлом остаются прежние пометки и манифест, и при
+// открытии они не должны удалить живые документы
+static void crash_during_compaction(const string& encoding, const string& sealed){
+    string label = encoding + "/" + sealed;
+    string root = test_dir("compaction_crash_" + encoding + "_" + sealed);
+    string dir = root + "ev/";
+    string saved = root + "saved/";
+    fs::create_directories(saved);
+
+    CollectionOptions options;
+    options.encoding = encoding;
+    options.sealed_format = sealed;
+    options.indexes.push_back("host");
+    {
+        // Часть удалений идёт вперемешку со вставками: N.del заводится,
+        // когда в сегменте ещё мало записей
+        Collection c("ev", root, 50, structure(), options);
+        for(int i = 0; i < DOCUMENTS; i++){
+            c.insert(make_document(i));
+            if(deleted_first(i)) c.delete_one({{"_id", "d" + to_string(i)}});
+        }
+        while(c.seal_segments(100) > 0){}
+        for(int i = 0; i < DOCUMENTS; i++){
+            if(deleted_second(i)) c.delete_one({{"_id", "d" + to_string(i)}});
+        }
+    }
+
+    // N.del без заголовка (прежний формат) читается как раньше
+    for(const auto& entry : fs::directory_iterator(dir)){
+        if(entry.path().extension() != ".del") continue;
+        string path = entry.path().string();
+        ifstream in(path, ios::binary);
+        string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        in.close();
+        ofstream out(path, ios::binary | ios::trunc);
+        out << data.substr(16);
+    }
+    {
+        Collection c("ev", root, 50, structure(), options);
+        check_contents(c, true, label + " N.del без заголовка");
+    }
+
+    save_files(dir, saved);
+    {
+        Collection c("ev", root, 50, structure(), options);
+        while(c.compact(0.0, 100) > 0){}
+    }
+    restore_files(saved, dir);
+    {
+        Collection c("ev", root, 50, structure(), options);
+        check_contents(c, true, label + " сбой при компактации");
+        c.delete_one({{"_id", "d0"}});
+    }
+    {
+        Collection c("ev", root, 50, structure(), options);
+        CHECK(c.count({{"_id", "d0"}}) == 0);
+        CHECK(c.count({{"_id", "d1"}}) == 1);
+    }
+    fs::remove_all(root);
+}
+
+int main(){
+    const char* encodings[] = {"json", "cbor", "msgpack"};
+    const char* formats[] = {"row", "columnar"};
+    for(const char* encoding : encodings){
+        for(const char* sealed : formats){
+            run(encoding, sealed);
+            crash_during_compaction(encoding, sealed);
+        }
+    }
+    return g_failures;
+}
@@ -0,0 +1,102 @@
+// Кодирование записей строковых сегментов: JSON, CBOR и MessagePack.
+// Документы читаются обратно без изменений, кодирование берётся из байта
+// заголовка сегмента, а convert_encoding перекодирует сегменты, записанные
+// в другом кодировании, с сохранением удалений.
+#include "check.h"
+#include "collection/collection.h"
+#include <fstream>
+
+using namespace std;
+namespace fs = filesystem;
+
+static const int DOCUMENTS = 150;
+
+static json make_document(int i){
+    json document = {
+        {"_id", "e" + to_string(i)},
+        {"host", "web-" + to_string(i % 7)},
+        {"port", i},
+        {"negative", -i},
+        {"big", 4000000000LL + i},
+        {"score", i * 0.25},
+        {"msg", "user \"admin\" \\ path C:\\tmp ünïcode\n" + to_string(i)},
+        {"tags", json::array({"a", i % 2 ? "b" : "c", nullptr, true})},
+        {"nested", {{"k", i}, {"empty", json::object()}, {"none", json::array()}}}
+    };
+    if(i % 13 == 0) document["port"] = nullptr;
+    return document;
+}
+
+static bool deleted(int i){ return i % 10 == 3; }
+
+static void check_contents(const Collection& c, const string& step){
+    bool ok = true;
+    long long expected = 0;
+    for(int i = 0; i < DOCUMENTS; i++){
+        json found = c.find_one({{"_id", "e" + to_string(i)}}, json::object(), json::object());
+        if(deleted(i)){
+            ok = ok && found.is_null();
+            continue;
+        }
+        expected++;
+        ok = ok && found == make_document(i);
+    }
+    if(!ok) cerr << "шаг: " << step << "\n";
+    CHECK(ok);
+    CHECK(c.count(json::object()) == expected);
+    CHECK(c.count({{"host", "web-3"}}) == (long long)c.find({{"host", "web-3"}}).get_size());
+}
+
+// Байт кодирования в заголовке каждого сегмента
+static void check_headers(const string& dir, SegmentEncoding encoding){
+    for(const auto& entry : fs::directory_iterator(dir)){
+        if(entry.path().extension() != ".seg") continue;
+        ifstream in(entry.path(), ios::binary);
+        char header[5] = {0};
+        in.read(header, 5);
+        CHECK(string(header, 4) == "SSEG");
+        CHECK(header[4] == (char)encoding);
+    }
+}
+
+static CollectionOptions encoded(const string& encoding){
+    CollectionOptions options;
+    options.encoding = encoding;
+    options.indexes.push_back("host");
+    return options;
+}
+
+int main(){
+    json structure = {{"host", "str"}, {"port", "int"}, {"msg", "str"}};
+    const char* encodings[] = {"json", "cbor", "msgpack"};
+    for(const char* encoding : encodings){
+        string root = test_dir(string("encoding_") + encoding);
+        string dir = root + "ev/";
+        {
+            Collection c("ev", root, 40, structure, encoded(encoding));
+            for(int i = 0; i < DOCUMENTS; i++) c.insert(make_document(i));
+            for(int i = 0; i < DOCUMENTS; i++){
+                if(deleted(i)) c.delete_one({{"_id", "e" + to_string(i)}});
+            }
+            check_contents(c, string(encoding) + " вставка");
+        }
+        check_headers(dir, parse_segment_encoding(encoding));
+
+        // Сегменты читаются в своём кодировании, даже если в настройках другое
+        const char* other = string(encoding) == "msgpack" ? "json" : "msgpack";
+        {
+            Collection c("ev", root, 40, structure, encoded(other));
+            check_contents(c, string(encoding) + " открытие с другим кодированием");
+            CHECK(c.convert_encoding() == (DOCUMENTS + 39) / 40);
+            CHECK(c.convert_encoding() == 0);
+            check_contents(c, string(encoding) + " перекодирование");
+        }
+        check_headers(dir, parse_segment_encoding(other));
+        {
+            Collection c("ev", root, 40, structure, encoded(other));
+            check_contents(c, string(encoding) + " открытие после перекодирования");
+        }
+        fs::remove_all(root);
+    }
+    return g_failures;
+}
@@ -0,0 +1,134 @@
+// Скомпилированные фильтры: дерево предикатов даёт те же ответы, что
+// и правила сравнения полей (отсутствующее поле не подходит ни под одно
+// условие, массив как значение поля не сравнивается), а коллекция с
+// индексами и зонами отвечает так же, как перебор документов.
+#include "scan_check.h"
+
+using namespace std;
+namespace fs = filesystem;
+
+// [фильтр, документ, подходит ли документ]
+static json cases(){
+    json doc = {{"a", 5}, {"s", "x\"y"}, {"f", 2.5}, {"b", true}, {"o", {{"k", 1}}}};
+    return json::array({
+        {json::object(), doc, true},
+        {{{"a", 5}}, doc, true},
+        {{{"a", 6}}, doc, false},
+        {{{"a", 5.0}}, doc, true},
+        {{{"s", "x\"y"}}, doc, true},
+        {{{"o", {{"$eq", {{"k", 1}}}}}}, doc, true},
+        {{{"a", {{"$ne", 6}}}}, doc, true},
+        {{{"missing", {{"$ne", 6}}}}, doc, false},
+        {{{"missing", {{"$nin", json::array({1})}}}}, doc, false},
+        {{{"a", {{"$gt", 4}, {"$lt", 6}}}}, doc, true},
+        {{{"a", {{"$gte", 5}, {"$lte", 5}}}}, doc, true},
+        {{{"a", {{"$gt", 5}}}}, doc, false},
+        {{{"f", {{"$gt", 2}, {"$lt", 3}}}}, doc, true},
+        {{{"s", {{"$gt", "x"}}}}, doc, true},
+        {{{"a", {{"$in", json::array({1, 5})}}}}, doc, true},
+        {{{"a", {{"$in", json::array({1, 2})}}}}, doc, false},
+        {{{"o", {{"$in", json::array({json({{"k", 1}})})}}}}, doc, true},
+        {{{"a", {{"$nin", json::array({1, 2})}}}}, doc, true},
+        {{{"b", true}}, doc, true},
+        {{{"a", json::array({5})}}, doc, true},
+        {{{"$or", json::array({{{"a", 1}}, {{"s", "x\"y"}}})}}, doc, true},
+        {{{"$or", json::array({{{"a", 1}}, {{"s", "z"}}})}}, doc, false},
+        {{{"$and", json::array({{{"a", 5}}, {{"b", true}}})}}, doc, true},
+        {{{"$not", {{"a", 5}}}}, doc, false},
+        {{{"$not", {{"a", 6}}}}, doc, true},
+        {{{"a", 5}, {"$or", json::array({{{"b", false}}, {{"f", {{"$gte", 2.5}}}}})}}, doc, true},
+        {{{"s", {{"$contains", "\"y"}}}}, doc, true},
+        {{{"s", {{"$regex", "^x.y$"}}}}, doc, true},
+        {{{"a", {{"$regex", "5"}}}}, doc, false}
+    });
+}
+
+static void check_cases(){
+    for(const auto& item : cases()){
+        Filter filter(item[0]);
+        bool matched = filter.matches(item[1]);
+        if(matched != item[2].get<bool>()) cerr << "фильтр " << item[0].dump() << "\n";
+        CHECK(matched == item[2].get<bool>());
+    }
+
+    const json invalid[] = {
+        json::array({1}),
+        {{"a", {{"$unknown", 1}}}},
+        {{"a", {{"$in", 1}}}},
+        {{"$or", {{"a", 1}}}},
+        {{"a", {{"$regex", "("}}}},
+        {{"a", {{"$contains", 1}}}}
+    };
+    for(const json& filter : invalid){
+        bool rejected = false;
+        try{
+            Filter compiled(filter);
+        }catch(const runtime_error&){
+            rejected = true;
+        }
+        if(!rejected) cerr << "принят фильтр " << filter.dump() << "\n";
+        CHECK(rejected);
+    }
+}
+
+static json make_document(int i){
+    json document = {
+        {"_id", "f" + to_string(i)},
+        {"host", "web-" + to_string(i % 7)},
+        {"port", i % 50},
+        {"score", (i % 20) * 0.5},
+        {"ok", i % 3 == 0},
+        {"timestamp", "2026-10-18T" + string(i % 24 < 10 ? "0" : "") + to_string(i % 24) + ":00:00Z"}
+    };
+    if(i % 11 == 0) document.erase("host");
+    if(i % 9 == 0) document["port"] = "n/a";
+    return document;
+}
+
+static json filters(){
+    return json::array({
+        json::object(),
+        {{"host", "web-3"}},
+        {{"host", {{"$ne", "web-3"}}}},
+        {{"host", {{"$in", json::array({"web-1", "web-2", "nothing"})}}}},
+        {{"host", {{"$nin", json::array({"web-1", "web-2"})}}}},
+        {{"port", {{"$gte", 10}, {"$lt", 20}}}},
+        {{"port", {{"$gt", 45}}}},
+        {{"port", "n/a"}},
+        {{"port", {{"$lt", 3}}}},
+        {{"score", {{"$lte", 1.5}}}},
+        {{"ok", true}},
+        {{"timestamp", {{"$gte", "2026-10-18T20:00:00Z"}}}},
+        {{"$or", json::array({{{"host", "web-1"}}, {{"port", {{"$lt", 5}}}}})}},
+        {{"$and", json::array({{{"host", "web-1"}}, {{"ok", true}}})}},
+        {{"$not", {{"host", "web-1"}}}},
+        {{"host", "web-2"}, {"$not", {{"port", {{"$gte", 25}}}}}},
+        {{"_id", "f10"}},
+        {{"_id", {{"$in", json::array({"f1", "f2", "f500"})}}}}
+    });
+}
+
+int main(){
+    check_cases();
+
+    json structure = {{"host", "str"}, {"port", "int"}, {"score", "float"}, {"timestamp", "timestamp"}};
+    const char* formats[] = {"row", "columnar"};
+    for(const char* sealed : formats){
+        string root = test_dir(string("filter_") + sealed);
+        CollectionOptions options;
+        options.sealed_format = sealed;
+        options.indexes.push_back("host");
+        options.indexes.push_back("port");
+
+        Collection c("ev", root, 60, structure, options);
+        Vector<json> documents;
+        for(int i = 0; i < 500; i++){
+            documents.push_back(make_document(i));
+            c.insert(documents[i]);
+        }
+        c.seal_segments(100);
+        check_against_scan(c, documents, filters(), sealed);
+        fs::remove_all(root);
+    }
+    return g_failures;
+}
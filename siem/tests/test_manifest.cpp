@@ -0,0 +1,196 @@
+// Открытие коллекции по manifest.json и файлам индексов N.idx: с сохранёнными
+// индексами, без них, с испорченными, после смены настроек индексов и без
+// манифеста (перебор файлов). Во всех случаях ответы запросов те же.
+#include "check.h"
+#include "collection/collection.h"
+#include <fstream>
+
+using namespace std;
+namespace fs = filesystem;
+
+static const int DOCUMENTS = 300;
+
+static json make_document(int i){
+    return {
+        {"_id", "m" + to_string(i)},
+        {"host", "web-" + to_string(i % 7)},
+        {"user", "u" + to_string(i % 4)},
+        {"port", i},
+        {"msg", "login from host" + to_string(i % 9) + " ok"},
+        {"timestamp", "2026-10-18T" + string(i % 24 < 10 ? "0" : "") + to_string(i % 24) + ":00:00Z"}
+    };
+}
+
+static json structure(){
+    return {{"host", "str"}, {"user", "str"}, {"port", "int"}, {"msg", "str"}, {"timestamp", "timestamp"}};
+}
+
+static bool deleted(int i){ return i % 10 == 3; }
+
+// Запросы, которые идут через индексы, зоны и скетчи сегментов
+static json answers(const Collection& c){
+    json out = json::array();
+    out.push_back(c.count(json::object()));
+    out.push_back(c.count({{"host", "web-3"}}));
+    out.push_back(c.count({{"user", {{"$in", json::array({"u1", "u2"})}}}}));
+    out.push_back(c.count({{"port", {{"$gte", 100}, {"$lt", 150}}}}));
+    out.push_back(c.count({{"msg", {{"$text", "host4"}}}}));
+    out.push_back(c.count({{"msg", {{"$contains", "host5 o"}}}}));
+    out.push_back(c.count({{"timestamp", {{"$gte", "2026-10-18T05:00:00Z"}, {"$lt", "2026-10-18T07:00:00Z"}}}}));
+    out.push_back(c.contains_id("m3"));
+    out.push_back(c.contains_id("m4"));
+    out.push_back(c.find_one({{"_id", "m250"}}, json::object(), json::object()));
+    out.push_back(c.approx_distinct(json::object(), "user").estimate());
+    return out;
+}
+
+static json expected_answers(){
+    json out = json::array();
+    long long counts[7] = {0, 0, 0, 0, 0, 0, 0};
+    for(int i = 0; i < DOCUMENTS; i++){
+        if(deleted(i)) continue;
+        counts[0]++;
+        if(i % 7 == 3) counts[1]++;
+        if(i % 4 == 1 || i % 4 == 2) counts[2]++;
+        if(i >= 100 && i < 150) counts[3]++;
+        if(i % 9 == 4) counts[4]++;
+        if(i % 9 == 5) counts[5]++;
+        if(i % 24 == 5 || i % 24 == 6) counts[6]++;
+    }
+    for(long long count : counts) out.push_back(count);
+    out.push_back(false);
+    out.push_back(true);
+    out.push_back(make_document(250));
+    out.push_back(4);
+    return out;
+}
+
+static CollectionOptions options_for(const string& sealed, bool with_user_index){
+    CollectionOptions options;
+    options.sealed_format = sealed;
+    options.indexes.push_back("host");
+    if(with_user_index) options.indexes.push_back("user");
+    options.text_fields.push_back("msg");
+    options.trigram_fields.push_back("msg");
+    options.distinct_fields.push_back("user");
+    return options;
+}
+
+static int count_files(const string& dir, const string& extension){
+    int n = 0;
+    for(const auto& entry : fs::directory_iterator(dir)){
+        if(entry.path().extension() == extension) n++;
+    }
+    return n;
+}
+
+static void run(const string& sealed){
+    string root = test_dir("manifest_" + sealed);
+    string dir = root + "ev/";
+    json expected = expected_answers();
+
+    auto check_open = [&](bool with_user_index, const string& step){
+        Collection c("ev", root, 50, structure(), options_for(sealed, with_user_index));
+        bool ok = answers(c) == expected;
+        if(!ok) cerr << sealed << ": " << step << ": " << answers(c).dump() << "\n";
+        CHECK(ok);
+    };
+
+    {
+        Collection c("ev", root, 50, structure(), options_for(sealed, false));
+        for(int i = 0; i < DOCUMENTS; i++) c.insert(make_document(i));
+        for(int i = 0; i < DOCUMENTS; i++){
+            if(deleted(i)) c.delete_one({{"_id", "m" + to_string(i)}});
+        }
+        while(c.seal_segments(100) > 0){}
+        CHECK(answers(c) == expected);
+    }
+    CHECK(fs::exists(dir + "manifest.json"));
+    CHECK(count_files(dir, ".idx") == DOCUMENTS / 50 - 1);
+
+    check_open(false, "открытие по N.idx");
+
+    // Другие настройки индексов: N.idx не подходит и индексы строятся заново
+    check_open(true, "другие индексы");
+    check_open(false, "прежние индексы");
+
+    for(const auto& entry : fs::directory_iterator(dir)){
+        if(entry.path().extension() != ".idx") continue;
+        ofstream out(entry.path(), ios::binary | ios::trunc);
+        out << "not cbor";
+    }
+    check_open(false, "испорченный N.idx");
+
+    for(const auto& entry : fs::directory_iterator(dir)){
+        if(entry.path().extension() == ".idx") fs::remove(entry.path());
+    }
+    check_open(false, "без N.idx");
+
+    fs::remove(dir + "manifest.json");
+    check_open(false, "без манифеста");
+
+    fs::remove_all(root);
+}
+
+// Манифест описывает только начало активного сегмента: записи, дописанные
+// после него, и недописанная запись в хвосте находятся перебором хвоста.
+// Размер запечатанного сегмента, не совпадающий с файлом, ведёт к полному перебору.
+static void run_tail(){
+    string root = test_dir("manifest_tail");
+    string dir = root + "ev/";
+    const int total = 140;
+    auto check_all = [&](const string& step){
+        Collection c("ev", root, 50, structure(), options_for("row", false));
+        bool ok = c.count(json::object()) == total;
+        for(int i = 0; i < total; i += 7){
+            ok = ok && c.find_one({{"_id", "m" + to_string(i)}}, json::object(), json::object()) == make_document(i);
+        }
+        ok = ok && c.count({{"port", {{"$gte", 40}, {"$lt", 60}}}}) == 20;
+        if(!ok) cerr << "хвост: " << step << "\n";
+        CHECK(ok);
+    };
+
+    {
+        Collection c("ev", root, 50, structure(), options_for("row", false));
+        for(int i = 0; i < 120; i++) c.insert(make_document(i));
+        while(c.seal_segments(100) > 0){}
+        for(int i = 120; i < total; i++) c.insert(make_document(i));
+    }
+    long long active_size = (long long)fs::file_size(dir + "3.seg");
+    {
+        ofstream out(dir + "3.seg", ios::binary | ios::app);
+        out.write("\xE8\x03\x00\x00{\"_id\"", 11);
+    }
+    check_all("дописанное после манифеста");
+    CHECK((long long)fs::file_size(dir + "3.seg") == active_size);
+
+    // Размер сегмента в манифесте больше файла и посреди записи
+    json manifest;
+    {
+        ifstream in(dir + "manifest.json");
+        in >> manifest;
+    }
+    for(auto& entry : manifest["segments"]){
+        if(entry["number"] == 1) entry["bytes"] = entry["bytes"].get<long long>() + 100;
+        if(entry["number"] == 2) entry["bytes"] = entry["bytes"].get<long long>() - 3;
+    }
+    {
+        ofstream out(dir + "manifest.json", ios::trunc);
+        out << manifest.dump();
+    }
+    for(const auto& entry : fs::directory_iterator(dir)){
+        if(entry.path().extension() == ".idx") fs::remove(entry.path());
+    }
+    long long sealed_size = (long long)fs::file_size(dir + "2.seg");
+    check_all("неверный размер в манифесте");
+    CHECK((long long)fs::file_size(dir + "2.seg") == sealed_size);
+
+    fs::remove_all(root);
+}
+
+int main(){
+    run("row");
+    run("columnar");
+    run_tail();
+    return g_failures;
+}
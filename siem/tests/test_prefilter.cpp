@@ -0,0 +1,76 @@
+// Префильтр по байтам записи: равенство строк проверяется до разбора
+// документа в любом кодировании. Строки с кавычками, обратной косой чертой,
+// управляющими символами и юникодом, длинные строки и значения, которые
+// встречаются в других полях, не должны терять совпадения.
+#include "scan_check.h"
+
+using namespace std;
+namespace fs = filesystem;
+
+static const char* VALUES[] = {
+    "plain",
+    "quote \"admin\"",
+    "back\\slash",
+    "C:\\Windows\\System32",
+    "tab\tnew\nline",
+    "ctrl\x01\x1f",
+    "slash/path",
+    "ünïcode ÜNÏCODE",
+    "emoji \xF0\x9F\x94\x92",
+    "a string longer than twenty three bytes for cbor and msgpack lengths",
+    "x",
+    "",
+    "12",
+    "true",
+    "null"
+};
+
+static json make_document(int i){
+    int n = sizeof(VALUES) / sizeof(VALUES[0]);
+    json document = {
+        {"_id", "p" + to_string(i)},
+        {"user", VALUES[i % n]},
+        // То же значение в другом поле не должно давать совпадение по user
+        {"note", VALUES[(i + 1) % n]},
+        {"port", i % 20}
+    };
+    if(i % 7 == 0) document["user"] = 12;
+    if(i % 13 == 0) document["user"] = json::array({VALUES[0]});
+    return document;
+}
+
+static json filters(){
+    json out = json::array();
+    for(const char* value : VALUES){
+        out.push_back({{"user", value}});
+        out.push_back({{"user", {{"$eq", value}}}});
+        out.push_back({{"note", value}, {"port", {{"$lt", 10}}}});
+        out.push_back({{"user", {{"$in", json::array({value, "nothing"})}}}});
+    }
+    out.push_back({{"user", 12}});
+    out.push_back({{"user", "plai"}});
+    out.push_back({{"user", "Plain"}});
+    out.push_back({{"$or", json::array({{{"user", "plain"}}, {{"note", "plain"}}})}});
+    out.push_back({{"$not", {{"user", "plain"}}}});
+    out.push_back({{"user", "plain"}, {"note", "quote \"admin\""}});
+    return out;
+}
+
+int main(){
+    const char* encodings[] = {"json", "cbor", "msgpack"};
+    for(const char* encoding : encodings){
+        string root = test_dir(string("prefilter_") + encoding);
+        CollectionOptions options;
+        options.encoding = encoding;
+
+        Collection c("ev", root, 70, {{"user", "str"}, {"note", "str"}, {"port", "int"}}, options);
+        Vector<json> documents;
+        for(int i = 0; i < 400; i++){
+            documents.push_back(make_document(i));
+            c.insert(documents[i]);
+        }
+        check_against_scan(c, documents, filters(), encoding);
+        fs::remove_all(root);
+    }
+    return g_failures;
+}
@@ -0,0 +1,116 @@
+// Сегменты N.seg: вставка только дописывает запись [u32 длина][документ]
+// в конец файла, недописанная запись в хвосте отбрасывается при открытии,
+// и вставка после этого продолжается с того же места.
+#include "check.h"
+#include "collection/collection.h"
+#include <fstream>
+#include <iterator>
+
+using namespace std;
+namespace fs = filesystem;
+
+static const int DOCUMENTS = 200;
+
+static json make_document(int i){
+    json document = {
+        {"_id", "s" + to_string(i)},
+        {"host", "web-" + to_string(i % 7)},
+        {"port", i},
+        {"msg", "user \"admin\" \\ path C:\\tmp ünïcode " + to_string(i)},
+        {"nested", {{"k", i}, {"list", json::array({i, "x", nullptr})}}}
+    };
+    if(i % 5 == 0) document["extra"] = {{"note", "x" + to_string(i)}};
+    return document;
+}
+
+static string read_file(const string& path){
+    ifstream in(path, ios::binary);
+    return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+}
+
+// Последний (активный) сегмент коллекции
+static string active_segment(const string& dir){
+    string active;
+    int active_number = 0;
+    for(const auto& entry : fs::directory_iterator(dir)){
+        if(entry.path().extension() != ".seg") continue;
+        int number = stoi(entry.path().stem().string());
+        if(number > active_number){
+            active_number = number;
+            active = entry.path().string();
+        }
+    }
+    return active;
+}
+
+static void check_contents(const Collection& c, int documents, const string& step){
+    bool ok = true;
+    for(int i = 0; i < documents; i++){
+        ok = ok && c.find_one({{"_id", "s" + to_string(i)}}, json::object(), json::object()) == make_document(i);
+    }
+    if(!ok) cerr << "шаг: " << step << "\n";
+    CHECK(ok);
+    CHECK(c.count(json::object()) == documents);
+}
+
+int main(){
+    string root = test_dir("segments");
+    string dir = root + "ev/";
+    json structure = {{"host", "str"}, {"port", "int"}, {"msg", "str"}};
+
+    {
+        Collection c("ev", root, 50, structure);
+        for(int i = 0; i < DOCUMENTS; i++){
+            string active = active_segment(dir);
+            string before = read_file(active);
+            c.insert(make_document(i));
+            // Вставка в тот же сегмент не трогает уже записанные байты
+            string after = read_file(active);
+            if(active == active_segment(dir)){
+                CHECK(after.size() > before.size());
+                CHECK(after.compare(0, before.size(), before) == 0);
+            }
+        }
+        check_contents(c, DOCUMENTS, "вставка");
+    }
+
+    int files = 0;
+    for(const auto& entry : fs::directory_iterator(dir)){
+        if(entry.path().extension() != ".seg") continue;
+        files++;
+        CHECK(read_file(entry.path().string()).compare(0, 4, "SSEG") == 0);
+    }
+    CHECK(files == DOCUMENTS / 50);
+
+    {
+        Collection c("ev", root, 50, structure);
+        check_contents(c, DOCUMENTS, "открытие");
+    }
+
+    // Недописанная запись и недописанная длина в хвосте активного сегмента
+    string active = active_segment(dir);
+    long long size = (long long)fs::file_size(active);
+    const string tails[] = {string("\xE8\x03\x00\x00{\"_", 7), string("\x10\x00", 2)};
+    int inserted = DOCUMENTS;
+    for(const string& tail : tails){
+        {
+            ofstream out(active, ios::binary | ios::app);
+            out.write(tail.data(), (streamsize)tail.size());
+        }
+        Collection c("ev", root, 1000, structure);
+        CHECK((long long)fs::file_size(active) == size);
+        check_contents(c, inserted, "недописанная запись");
+
+        c.insert(make_document(inserted));
+        inserted++;
+        check_contents(c, inserted, "вставка после недописанной записи");
+        size = (long long)fs::file_size(active);
+    }
+    {
+        Collection c("ev", root, 1000, structure);
+        check_contents(c, inserted, "открытие после восстановления");
+    }
+
+    fs::remove_all(root);
+    return g_failures;
+}
@@ -0,0 +1,150 @@
+// Сужение $regex и $contains по индексу триграмм: литералы regex_literals
+// входят в любую строку, где выражение находится, а коллекция с индексом
+// триграмм, префильтром и колоночными сегментами отвечает так же, как
+// перебор документов.
+#include "scan_check.h"
+#include "collection/trigram_index.h"
+#include <regex>
+#include <algorithm>
+
+using namespace std;
+namespace fs = filesystem;
+
+static string lower(string s){
+    transform(s.begin(), s.end(), s.begin(), [](unsigned char ch){ return (char)tolower(ch); });
+    return s;
+}
+
+static const char* CORPUS[] = {
+    "cmd.exe /c whoami",
+    "CMD.EXE /C net user",
+    "cmdxexe is not cmd",
+    "C:\\Windows\\System32\\svchost.exe",
+    "c:\\windows\\system32\\drivers",
+    "connect to 10.0.0.15 port 443",
+    "connect to 10.0.0.x refused",
+    "100000015",
+    "aAbc and ABC",
+    "line1\nline2",
+    "sys32 and system32",
+    "quote \"admin\" here",
+    "tab\there",
+    "unicode ünïcode ÜNÏCODE",
+    "Zbc zbc",
+    "abc\x01" "def",
+    "short",
+    ""
+};
+
+static const char* PATTERNS[] = {
+    "cmd\\.exe",
+    "cmd.exe",
+    "a\\x41bc",
+    "\\x41bc",
+    "\\u0041bc",
+    "10\\.0\\.0\\.[0-9]+",
+    "sys(tem)?32",
+    "\\\\Windows\\\\System32",
+    "\\\\windows",
+    "\\cJline2",
+    "line1\\nline2",
+    "[A-Z]bc",
+    "\\bnet user\\b",
+    "(whoami|net user)",
+    "quote \"admin\"",
+    "tab\\there",
+    "c\\x01def",
+    "abc\\x01def",
+    "\\d{3}0{4}",
+    "ünïcode",
+    "connect to 10(\\.0){2}",
+    "(abc)\\1",
+    "svchost\\.exe$",
+    "^cmd"
+};
+
+static const int COPIES = 30;
+
+// Каждый литерал выражения входит в любую строку, где выражение находится
+static void check_literals(){
+    for(const char* pattern : PATTERNS){
+        Vector<string> literals;
+        TrigramIndex::regex_literals(pattern, literals);
+        for(int icase = 0; icase < 2; icase++){
+            auto flags = regex::ECMAScript;
+            if(icase) flags |= regex::icase;
+            regex re(pattern, flags);
+            for(const char* text : CORPUS){
+                if(!regex_search(text, re)) continue;
+                for(unsigned int i = 0; i < literals.get_size(); i++){
+                    bool found = icase ? lower(text).find(lower(literals[i])) != string::npos
+                                       : string(text).find(literals[i]) != string::npos;
+                    if(!found){
+                        cerr << "выражение " << pattern << ": литерал " << literals[i]
+                             << " не входит в \"" << text << "\"\n";
+                    }
+                    CHECK(found);
+                }
+            }
+        }
+    }
+}
+
+static json filters(){
+    json out = json::array();
+    for(const char* pattern : PATTERNS){
+        out.push_back({{"msg", {{"$regex", pattern}}}});
+        out.push_back({{"msg", {{"$regex", pattern}, {"$options", "i"}}}});
+    }
+    for(const char* text : CORPUS){
+        if(*text == 0) continue;
+        out.push_back({{"msg", {{"$contains", text}}}});
+    }
+    out.push_back({{"msg", {{"$contains", "\\Windows\\"}}}});
+    out.push_back({{"msg", {{"$contains", "\"admin\""}}}});
+    out.push_back({{"msg", {{"$regex", "cmd\\.exe"}}}, {"host", "h1"}});
+    out.push_back({{"$or", json::array({{{"msg", {{"$regex", "\\x41bc"}}}},
+                                       {{"msg", {{"$contains", "\\System32"}}}}})}});
+    return out;
+}
+
+static void check_collection(const string& encoding, const string& sealed){
+    string root = test_dir("trigram_" + encoding + "_" + sealed);
+    CollectionOptions options;
+    options.encoding = encoding;
+    options.sealed_format = sealed;
+    options.trigram_fields.push_back("msg");
+
+    Collection c("ev", root, 40, {{"msg", "str"}, {"host", "str"}}, options);
+    Vector<json> documents;
+    int n = 0;
+    for(int copy = 0; copy < COPIES; copy++){
+        for(const char* text : CORPUS){
+            json document = {{"_id", "m" + to_string(n)}, {"msg", text}, {"host", "h" + to_string(n % 3)}};
+            c.insert(document);
+            documents.push_back(document);
+            n++;
+        }
+    }
+    // Часть сегментов запечатана, последний остаётся строковым и активным
+    c.seal_segments(6);
+    check_against_scan(c, documents, filters(), encoding + "/" + sealed);
+    fs::remove_all(root);
+}
+
+int main(){
+    check_literals();
+
+    // Перебор сам по себе должен что-то находить, иначе сравнение ничего не проверяет
+    Filter windows(json({{"msg", {{"$regex", "\\\\Windows"}, {"$options", "i"}}}}));
+    CHECK(windows.matches({{"msg", CORPUS[4]}}));
+    Filter hex(json({{"msg", {{"$regex", "a\\x41bc"}}}}));
+    CHECK(hex.matches({{"msg", CORPUS[8]}}));
+
+    const char* encodings[] = {"json", "cbor", "msgpack"};
+    const char* formats[] = {"row", "columnar"};
+    for(const char* encoding : encodings){
+        for(const char* sealed : formats) check_collection(encoding, sealed);
+    }
+    return g_failures;
+}
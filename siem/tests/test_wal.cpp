@@ -0,0 +1,217 @@
+// Восстановление по журналу: база, от которой остался только wal.log,
+// недописанный хвост журнала, докатка после контрольной точки и номера LSN
+// после очистки журнала; повтор _id до применения вставки журналом. Снимки каталога базы делаются под io_mutex, пока
+// база открыта, - как после аварийной остановки процесса.
+#include "check.h"
+#include "database/database.h"
+#include <fstream>
+#include <thread>
+#include <atomic>
+
+using namespace std;
+namespace fs = filesystem;
+
+static const string DB = "db";
+
+static string write_schema(const string& root){
+    json schema = {
+        {"name", "test"},
+        {"tuples_limit", 20},
+        {"structure", {{"ev", {{"_id", "str"}, {"host", "str"}, {"n", "int"}}}}},
+        {"indexes", {{"ev", json::array({"host"})}}}
+    };
+    string path = root + "schema.json";
+    ofstream out(path);
+    out << schema.dump();
+    return path;
+}
+
+static json make_document(int i){
+    return {{"_id", "e" + to_string(i)}, {"host", "h" + to_string(i % 5)}, {"n", i}};
+}
+
+// Все документы коллекции по порядку _id
+static json contents(Database& db, mutex& io_mutex){
+    lock_guard<mutex> lock(io_mutex);
+    Vector<json> found = db.get_collection("ev").find(json::object(), json::object(), {{"_id", 1}});
+    json out = json::array();
+    for(unsigned int i = 0; i < found.get_size(); i++) out.push_back(found[i]);
+    return out;
+}
+
+// Копия каталога базы: целиком или только журнал
+static string snapshot(Database& db, mutex& io_mutex, const string& name, bool wal_only){
+    string root = test_dir("wal_" + name);
+    fs::create_directories(root + DB);
+    lock_guard<mutex> lock(io_mutex);
+    if(wal_only) fs::copy_file(db.get_base_path() + "wal.log", root + DB + "/wal.log");
+    else fs::copy(db.get_base_path(), root + DB, fs::copy_options::recursive);
+    return root;
+}
+
+static void append_bytes(const string& path, const string& bytes){
+    ofstream out(path, ios::binary | ios::app);
+    out.write(bytes.data(), (streamsize)bytes.size());
+}
+
+int main(){
+    string root = test_dir("wal");
+    string schema = write_schema(root);
+
+    mutex io_mutex;
+    Database db(schema, DB, root);
+    db.enable_wal(WalAckMode::Fsync, 1, io_mutex);
+
+    for(int i = 0; i < 100; i++) db.insert("ev", make_document(i));
+    CHECK(db.delete_many("ev", {{"host", "h3"}}) == 20);
+    db.insert("ev", make_document(3));
+    bool rejected = false;
+    try{
+        db.insert("ev", make_document(4));
+    }catch(const exception&){
+        rejected = true;
+    }
+    CHECK(rejected);
+    json expected = contents(db, io_mutex);
+    CHECK(expected.size() == 81);
+
+    // От базы остался только журнал: докатка восстанавливает вставки и
+    // удаления в исходном порядке
+    {
+        string copy = snapshot(db, io_mutex, "log_only", true);
+        mutex copy_mutex;
+        Database restored(schema, DB, copy);
+        restored.enable_wal(WalAckMode::Fsync, 1, copy_mutex);
+        CHECK(contents(restored, copy_mutex) == expected);
+        CHECK(restored.get_collection("ev").count({{"host", "h3"}}) == 1);
+    }
+
+    // Недописанная запись и мусор в конце журнала отбрасываются
+    {
+        string copy = snapshot(db, io_mutex, "torn", true);
+        string log = copy + DB + "/wal.log";
+        append_bytes(log, string("\x40\x00\x00\x00{\"lsn\":", 11));
+        mutex copy_mutex;
+        Database restored(schema, DB, copy);
+        restored.enable_wal(WalAckMode::Fsync, 1, copy_mutex);
+        CHECK(contents(restored, copy_mutex) == expected);
+    }
+    {
+        string copy = snapshot(db, io_mutex, "garbage", true);
+        string log = copy + DB + "/wal.log";
+        append_bytes(log, string("\x05\x00\x00\x00oops!", 9));
+        mutex copy_mutex;
+        Database restored(schema, DB, copy);
+        restored.enable_wal(WalAckMode::Fsync, 1, copy_mutex);
+        CHECK(contents(restored, copy_mutex) == expected);
+    }
+
+    // После контрольной точки докатываются только более поздние записи
+    {
+        lock_guard<mutex> lock(io_mutex);
+        db.checkpoint();
+    }
+    for(int i = 100; i < 120; i++) db.insert("ev", make_document(i));
+    CHECK(db.delete_many("ev", {{"n", {{"$lt", 10}}}}) == 9);
+    json after_checkpoint = contents(db, io_mutex);
+
+    string crashed = snapshot(db, io_mutex, "checkpoint", false);
+    {
+        mutex copy_mutex;
+        Database restored(schema, DB, crashed);
+        restored.enable_wal(WalAckMode::Fsync, 1, copy_mutex);
+        CHECK(contents(restored, copy_mutex) == after_checkpoint);
+
+        // Журнал очищен при открытии; новые записи получают LSN после
+        // контрольной точки и переживают ещё одну аварию
+        for(int i = 200; i < 210; i++) restored.insert("ev", make_document(i));
+        CHECK(restored.delete_many("ev", {{"_id", "e100"}}) == 1);
+        json expected_again = contents(restored, copy_mutex);
+        CHECK(expected_again.size() == after_checkpoint.size() + 9);
+
+        string again = snapshot(restored, copy_mutex, "again", false);
+        mutex again_mutex;
+        Database reopened(schema, DB, again);
+        reopened.enable_wal(WalAckMode::Fsync, 1, again_mutex);
+        CHECK(contents(reopened, again_mutex) == expected_again);
+        fs::remove_all(again);
+    }
+
+    // Докатка напрямую: записи до after_lsn пропускаются, LSN возрастают
+    {
+        string log = root + "direct.log";
+        {
+            WriteAheadLog wal(log, WalAckMode::Fsync, 1);
+            wal.replay(0, [](const WalRecord&){});
+            wal.start([](Vector<WalRecord>&){});
+            for(int i = 0; i < 5; i++) wal.submit("ev", make_document(i));
+            wal.submit("ev", {{"host", "h1"}}, WalOp::Delete);
+        }
+        WriteAheadLog wal(log, WalAckMode::Fsync, 1);
+        Vector<WalRecord> records;
+        long long last = wal.replay(2, [&](const WalRecord& record){ records.push_back(record); });
+        CHECK(last == 6);
+        CHECK(records.get_size() == 4);
+        if(records.get_size() == 4){
+            CHECK(records[0].lsn == 3);
+            CHECK(records[0].op == WalOp::Insert);
+            CHECK(records[0].document == make_document(2));
+            CHECK(records[3].op == WalOp::Delete);
+            CHECK(records[3].document == json({{"host", "h1"}}));
+        }
+    }
+
+    // В режиме buffer вставка подтверждается до применения: повтор того же
+    // _id, в том числе одновременный из нескольких потоков, отклоняется сразу
+    {
+        string buffered_root = test_dir("wal_buffer");
+        string buffered_schema = write_schema(buffered_root);
+        mutex buffered_mutex;
+        Database buffered(buffered_schema, DB, buffered_root);
+        buffered.enable_wal(WalAckMode::Buffer, 200, buffered_mutex);
+
+        buffered.insert("ev", make_document(1));
+        bool duplicate_rejected = false;
+        try{
+            buffered.insert("ev", make_document(1));
+        }catch(const exception&){
+            duplicate_rejected = true;
+        }
+        CHECK(duplicate_rejected);
+
+        atomic<int> accepted(0);
+        Vector<thread*> threads;
+        for(int t = 0; t < 8; t++){
+            threads.push_back(new thread([&](){
+                try{
+                    buffered.insert("ev", make_document(2));
+                    accepted++;
+                }catch(const exception&){
+                }
+            }));
+        }
+        for(unsigned int t = 0; t < threads.get_size(); t++){
+            threads[t]->join();
+            delete threads[t];
+        }
+        CHECK(accepted == 1);
+
+        // Удаление ждёт применения при любом режиме: после него вставки применены
+        CHECK(buffered.delete_many("ev", {{"_id", "none"}}) == 0);
+        CHECK(contents(buffered, buffered_mutex).size() == 2);
+        duplicate_rejected = false;
+        try{
+            buffered.insert("ev", make_document(2));
+        }catch(const exception&){
+            duplicate_rejected = true;
+        }
+        CHECK(duplicate_rejected);
+        buffered.insert("ev", make_document(3));
+        CHECK(buffered.delete_many("ev", {{"_id", "e3"}}) == 1);
+    }
+
+    for(const char* name : {"log_only", "torn", "garbage", "checkpoint", "buffer"}){
+        fs::remove_all(fs::temp_directory_path() / (string("siem_test_wal_") + name));
+    }
+    return g_failures;
+}
@@ -0,0 +1,75 @@
+// Зоны сегментов и значения null: null не входит в минимум и максимум поля,
+// но подходит под $eq null, $lt/$lte, $in с null, $ne и $nin. Сегменты только
+// из null, смешанные и без null не должны отсекаться там, где перебор
+// документов находит совпадения, ни сразу, ни после открытия по N.idx.
+#include "scan_check.h"
+
+using namespace std;
+namespace fs = filesystem;
+
+static json make_document(int i){
+    json document = {{"_id", "z" + to_string(i)}, {"port", i}, {"host", "h" + to_string(i % 3)}};
+    // Первые 10 документов занимают целые сегменты, дальше null вперемешку
+    if(i < 10 || (i >= 25 && i % 4 == 0)) document["port"] = nullptr;
+    return document;
+}
+
+static json filters(){
+    return json::array({
+        {{"port", nullptr}},
+        {{"port", {{"$eq", nullptr}}}},
+        {{"port", {{"$ne", nullptr}}}},
+        {{"port", {{"$lt", 5}}}},
+        {{"port", {{"$lte", 0}}}},
+        {{"port", {{"$lt", 30}, {"$gt", 12}}}},
+        {{"port", {{"$gt", 5}}}},
+        {{"port", {{"$gte", nullptr}}}},
+        {{"port", {{"$ne", 5}}}},
+        {{"port", {{"$ne", 30}}}},
+        {{"port", {{"$nin", json::array({5, 12})}}}},
+        {{"port", {{"$nin", json::array({nullptr})}}}},
+        {{"port", {{"$in", json::array({nullptr, 100})}}}},
+        {{"port", {{"$in", json::array({12, 30})}}}},
+        {{"port", 12}},
+        {{"port", nullptr}, {"host", "h1"}},
+        {{"$or", json::array({{{"port", nullptr}}, {{"port", 40}}})}},
+        {{"$not", {{"port", nullptr}}}}
+    });
+}
+
+int main(){
+    const char* formats[] = {"row", "columnar"};
+    for(const char* sealed : formats){
+        string root = test_dir(string("zone_map_") + sealed);
+        CollectionOptions options;
+        options.sealed_format = sealed;
+        json structure = {{"port", "int"}, {"host", "str"}};
+
+        Vector<json> documents;
+        {
+            Collection c("ev", root, 5, structure, options);
+            // Первые 25 документов - пример из отчёта: 10 с port: null
+            for(int i = 0; i < 25; i++){
+                documents.push_back(make_document(i));
+                c.insert(documents[i]);
+            }
+            check_against_scan(c, documents, filters(), string(sealed) + " 25");
+            CHECK(c.count({{"port", nullptr}}) == 10);
+            CHECK(c.count({{"port", {{"$lt", 5}}}}) == 10);
+            CHECK(c.count({{"port", {{"$ne", 5}}}}) == 25);
+
+            for(int i = 25; i < 60; i++){
+                documents.push_back(make_document(i));
+                c.insert(documents[i]);
+            }
+            while(c.seal_segments(100) > 0){}
+            check_against_scan(c, documents, filters(), sealed);
+        }
+        {
+            Collection c("ev", root, 5, structure, options);
+            check_against_scan(c, documents, filters(), string(sealed) + " открытие");
+        }
+        fs::remove_all(root);
+    }
+    return g_failures;
+}
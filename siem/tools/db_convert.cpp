@@ -0,0 +1,88 @@
+#include <iostream>
+#include <string>
+#include <filesystem>
+#include "../schema/schema.h"
+#include "../collection/collection.h"
+
+using namespace std;
+namespace fs = filesystem;
+
+// Разовый офлайн-перевод папки данных: файлы N.json переводятся в сегменты N.seg,
+// а строковые сегменты перекодируются в кодирование из storage.<коллекция>.encoding.
+// Запускать при остановленном db_server.
+
+static string g_schema_path = "schema.json";
+static string g_data_root = "data";
+static Vector<string> g_databases;
+
+static void usage(){
+    cout << "использование: db_convert [--schema путь_к_schema.json] [--data-root папка_данных]\n"
+         << "                  [--db имя_базы ...]\n"
+         << "без --db обрабатываются все базы в папке данных\n";
+}
+
+static void parse_args(int argc, char** argv){
+    for(int i = 1; i < argc; i++){
+        string a = argv[i];
+        if(a == "--schema" && i + 1 < argc) g_schema_path = argv[++i];
+        else if(a == "--data-root" && i + 1 < argc) g_data_root = argv[++i];
+        else if(a == "--db" && i + 1 < argc) g_databases.push_back(argv[++i]);
+        else if(a == "--help" || a == "-h"){ usage(); exit(0); }
+        else throw runtime_error("неизвестный аргумент: " + a);
+    }
+}
+
+static int count_legacy_files(const string& collection_path){
+    int count = 0;
+    while(fs::exists(collection_path + to_string(count + 1) + ".json")) count++;
+    return count;
+}
+
+static void convert_database(const Schema& schema, const string& db_name){
+    string base_path = g_data_root + "/" + db_name + "/";
+    cout << "база " << db_name << ":" << endl;
+
+    auto it = schema.structure.begin();
+    auto end_it = schema.structure.end();
+    while(it != end_it){
+        auto kv = *it;
+        ++it;
+        if(!fs::exists(base_path + kv.key)) continue;
+
+        CollectionOptions options;
+        schema.options.try_get(kv.key, options);
+
+        int legacy = count_legacy_files(base_path + kv.key + "/");
+        Collection coll(kv.key, base_path, schema.tuples_limit, kv.value, options);
+        int converted = coll.convert_encoding();
+        coll.sync();
+
+        cout << "  " << kv.key << ": N.json -> N.seg: " << legacy
+             << ", перекодировано сегментов: " << converted
+             << " (" << (options.encoding.empty() ? "json" : options.encoding) << ")" << endl;
+    }
+}
+
+int main(int argc, char** argv){
+    try{
+        parse_args(argc, argv);
+        Schema schema = load_schema(g_schema_path);
+
+        if(g_databases.empty()){
+            if(!fs::is_directory(g_data_root)){
+                throw runtime_error("папка данных не найдена: " + g_data_root);
+            }
+            for(const auto& entry : fs::directory_iterator(g_data_root)){
+                if(entry.is_directory()) g_databases.push_back(entry.path().filename().string());
+            }
+        }
+
+        for(unsigned int i = 0; i < g_databases.get_size(); i++){
+            convert_database(schema, g_databases[i]);
+        }
+    }catch(const exception& e){
+        cerr << "ошибка: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}